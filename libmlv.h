@@ -19,8 +19,52 @@ typedef uint64_t (* mlv_Reader) (void * ud,
                                  uint64_t bytes,
                                  void * out);
 
+/* Return: number of bytes written */
+typedef uint64_t (* mlv_Writer) (void * ud,
+                                 uint64_t pos,
+                                 uint64_t bytes,
+                                 void * in);
+
 typedef void (* mlv_Close) (void * ud);
 
+/* Asynchronous reader, starts reading bytes at pos of a chunk (chunk_ud is
+ * the chunk's data pointer, as passed to mlv_Reader) in to out. The read
+ * stays outstanding until returned by mlv_AsyncComplete with the same tag.
+ * Return: zero if the read could not be started (such as the queue being
+ * full), it is then done with the synchronous reader instead */
+typedef int (* mlv_AsyncSubmit) (void * ud,
+                                 void * chunk_ud,
+                                 uint64_t pos,
+                                 uint64_t bytes,
+                                 void * out,
+                                 uint64_t tag);
+
+/* Outputs up to max_reads finished reads' tags and number of bytes read,
+ * waiting until at least min_reads have finished (zero to only poll).
+ * Return: number of reads output */
+typedef int (* mlv_AsyncComplete) (void * ud,
+                                   int min_reads,
+                                   int max_reads,
+                                   uint64_t * tags_out,
+                                   uint64_t * bytes_read_out);
+
+/* Optional, tells the asynchronous reader that reads will mostly be in to
+ * this memory, so it can be set up for faster reading (such as io_uring
+ * registered buffers). Replaces the last one, NULL for none.
+ * Return: zero if it couldn't be (reads in to it still work) */
+typedef int (* mlv_AsyncRegisterBuffer) (void * ud,
+                                         void * buffer,
+                                         uint64_t size);
+
+/* Called by mlv_IndexReadBlocks with each block, index is its position in
+ * the list of entries. Data is only valid until it returns.
+ * Return: zero to stop reading */
+typedef int (* mlv_BlockCallback) (void * ud,
+                                   uint64_t index,
+                                   int64_t entry_id,
+                                   void * data,
+                                   uint32_t bytes);
+
 /******************************************************************************/
 
 /******************************* MLV DataSource *******************************/
@@ -45,6 +89,22 @@ void mlv_DataSourceSetChunk(mlv_DataSource * DataSource,
                             mlv_Reader Reader,
                             mlv_Close Closer);
 
+/* Declare that the reader can safely be called from multiple threads at the
+ * same time, which allows things like mlv_IndexBuildParallel to use threads.
+ * Default is not thread-safe. */
+void mlv_DataSourceSetThreadSafe(mlv_DataSource * DataSource, int IsThreadSafe);
+int mlv_DataSourceIsThreadSafe(mlv_DataSource * DataSource);
+
+/* Modification time of a chunk's file (any format, as long as it changes when
+ * the file does). Used to check if a saved index still matches the clip. */
+void mlv_DataSourceSetChunkModificationTime(mlv_DataSource * DataSource, int Chunk, uint64_t Time);
+uint64_t mlv_DataSourceGetChunkModificationTime(mlv_DataSource * DataSource, int Chunk);
+
+/* If all of a chunk's data is in memory (such as a memory mapped file), you
+ * can set a pointer to it, so it can be used without copying. The reader is
+ * still required. */
+void mlv_DataSourceSetChunkPointer(mlv_DataSource * DataSource, int Chunk, void * Pointer);
+
 /* Set chunk count */
 void mlv_DataSourceSetChunkCount(mlv_DataSource * DataSource, int ChunkCount);
 
@@ -54,6 +114,28 @@ int mlv_DataSourceGetNumChunks(mlv_DataSource * DataSource);
 /* Returns the size of a chunk */
 uint64_t mlv_DataSourceGetChunkSize(mlv_DataSource * DataSource, int Chunk);
 
+/* Change a chunk's size, such as when its file has grown */
+void mlv_DataSourceSetChunkSize(mlv_DataSource * DataSource, int Chunk, uint64_t Size);
+
+/* For clips that are still being written (or copied), updates the data
+ * source's chunk sizes and adds any new chunks (with mlv_DataSourceSetChunkSize,
+ * mlv_DataSourceSetChunkCount and mlv_DataSourceSetChunk).
+ * Return: non-zero if anything changed */
+typedef int (* mlv_Refresher) (void * ud, mlv_DataSource * DataSource);
+
+/* Optional, for mlv_DataSourceRefresh. Closer is called with RefresherUD when
+ * the data source is closed (can be NULL). */
+void mlv_DataSourceSetRefresher(mlv_DataSource * DataSource,
+                                mlv_Refresher Refresher,
+                                mlv_Close Closer,
+                                void * RefresherUD);
+
+/* Picks up data written to the clip since the data source was made or last
+ * refreshed, it can then be indexed (see mlv_IndexSetTailMode). Must not be
+ * done while the data source is being used by another thread. Returns non-zero
+ * if anything changed, zero if nothing did or there is no refresher. */
+int mlv_DataSourceRefresh(mlv_DataSource * DataSource);
+
 /* Get data, used by index and frame extractor. Returns number of bytes read */
 uint64_t mlv_DataSourceGetData(mlv_DataSource * DataSource,
                                int Chunk,
@@ -61,6 +143,70 @@ uint64_t mlv_DataSourceGetData(mlv_DataSource * DataSource,
                                uint64_t Bytes,
                                void * Out);
 
+/* Optional asynchronous reader, so that many reads can be waited on at once
+ * (mlv_DataSourceSubmitRead). AsyncUD is passed to Submit, Complete and
+ * Closer, which is called when the data source is closed (can be NULL). */
+void mlv_DataSourceSetAsyncReader(mlv_DataSource * DataSource,
+                                  mlv_AsyncSubmit Submit,
+                                  mlv_AsyncComplete Complete,
+                                  mlv_Close Closer,
+                                  void * AsyncUD);
+
+int mlv_DataSourceHasAsyncReader(mlv_DataSource * DataSource);
+
+/* Optional, for mlv_DataSourceRegisterReadBuffer */
+void mlv_DataSourceSetAsyncRegisterBuffer(mlv_DataSource * DataSource,
+                                          mlv_AsyncRegisterBuffer RegisterBuffer);
+
+/* Tells the asynchronous reader that reads will be in to Buffer, which must
+ * stay valid until another buffer (or NULL) is registered, which must only be
+ * done with no reads outstanding. Returns zero if the reader has nothing to
+ * gain from it. */
+int mlv_DataSourceRegisterReadBuffer(mlv_DataSource * DataSource,
+                                     void * Buffer,
+                                     uint64_t Size);
+
+/* Starts reading Bytes at Pos of a chunk in to Out, which must stay valid
+ * until the read is completed, and is found by Tag when it is. Without an
+ * asynchronous reader (or if it can't take the read) the read is done now,
+ * but still has to be completed. Returns zero if the read could not be
+ * queued, in which case it will not be completed. Reads are submitted and
+ * completed by one thread at a time, and all must be completed before the
+ * data source is closed. */
+int mlv_DataSourceSubmitRead(mlv_DataSource * DataSource,
+                             int Chunk,
+                             uint64_t Pos,
+                             uint64_t Bytes,
+                             void * Out,
+                             uint64_t Tag);
+
+/* Outputs up to MaxReads finished reads' tags and number of bytes read (less
+ * than asked for if the read failed), waiting until at least MinReads have
+ * finished, or all outstanding ones if there are less. Returns number of reads
+ * output. */
+int mlv_DataSourceCompleteReads(mlv_DataSource * DataSource,
+                                int MinReads,
+                                int MaxReads,
+                                uint64_t * TagsOut,
+                                uint64_t * BytesReadOut);
+
+/* Same as mlv_DataSourceCompleteReads, without waiting */
+int mlv_DataSourcePollReads(mlv_DataSource * DataSource,
+                            int MaxReads,
+                            uint64_t * TagsOut,
+                            uint64_t * BytesReadOut);
+
+/* Number of reads submitted and not completed yet */
+int mlv_DataSourceGetNumOutstandingReads(mlv_DataSource * DataSource);
+
+/* Returns pointer to data, if the chunk has been given a pointer with
+ * mlv_DataSourceSetChunkPointer. Returns NULL if not, or if the range is not
+ * within the chunk, in which case use mlv_DataSourceGetData instead. */
+void * mlv_DataSourceGetDataPointer(mlv_DataSource * DataSource,
+                                    int Chunk,
+                                    uint64_t Pos,
+                                    uint64_t Bytes);
+
 /******************************************************************************/
 
 /********************************* MLV Index **********************************/
@@ -77,9 +223,33 @@ void mlv_IndexBuild(mlv_Index * Index,
                     mlv_DataSource * DataSource,
                     uint64_t MaxBlocks);
 
+/* Allocates memory for NumEntries entries in one go, so that indexing does not
+ * have to grow the index as it goes. Useful if you know roughly how many blocks
+ * there are (for example from the chunk sizes and frame size). If memory can't
+ * be allocated, the index is left as it was and will grow while indexing. */
+void mlv_IndexReserve(mlv_Index * Index, uint64_t NumEntries);
+
+/* Indexes the rest of the MLV, with each chunk indexed on its own thread
+ * (NumThreads at a time), which is much faster for clips with many chunks.
+ * The DataSource's reader must be thread-safe (mlv_DataSourceSetThreadSafe),
+ * otherwise, or if libmlv was built with LIBMLV_NO_THREADS, this will do the
+ * same as mlv_IndexBuild(Index, DataSource, 0). The allocator does not need
+ * to be thread-safe, calls to it are serialised. */
+void mlv_IndexBuildParallel(mlv_Index * Index,
+                            mlv_DataSource * DataSource,
+                            int NumThreads);
+
 /* Checks if indexing is complete */
 int mlv_IndexIsComplete(mlv_Index * Index);
 
+/* Tail mode, for clips that are still being written (or copied). Set it before
+ * building. A block cut off at the end of the last chunk is left until it has
+ * been written, and indexing stays at the end of the last chunk rather than
+ * finishing, so that after mlv_DataSourceRefresh, mlv_IndexBuild only indexes
+ * the new blocks (including new chunks). "Complete" then means everything
+ * written so far has been indexed. */
+void mlv_IndexSetTailMode(mlv_Index * Index, int TailMode);
+
 /* This will optimise (sort) the index for better performance.
  * Call this after the clip is fully indexed otherwise it's a waste, as more
  * indexing will just undo the sorting just done by this. */
@@ -111,8 +281,37 @@ int64_t mlv_IndexFindEntry( mlv_Index * Index,
                              * will return the second matching entry and so on... */
                             uint64_t EntryNumber );
 
+/* Returns entry ID of the last block of BlockType with a timestamp at or before
+ * Timestamp, such as the EXPO or LENS block in effect at a frame. BlockType can
+ * be NULL for a block of any type. Returns -1 if there isn't one. Fast
+ * (bisection) when the index has been optimised and BlockType is given. */
+int64_t mlv_IndexFindEntryBefore(mlv_Index * Index,
+                                 uint8_t * BlockType,
+                                 uint64_t Timestamp);
+
+/* Finds a frame (BlockType "VIDF" or "AUDF") that hasn't been indexed yet
+ * without indexing everything before it, such as for showing a frame from far
+ * in to a huge clip straight away. Its position is estimated from the average
+ * size of frames indexed so far, the next valid block is found from there and
+ * indexed on from. The parts skipped are indexed later by mlv_IndexBuild as
+ * usual, which is needed before saving (mlv_IndexSave). Returns the frame's
+ * entry ID, or -1 if it couldn't be found this way (such as when it is near
+ * where indexing is up to, or too few frames have been indexed to estimate
+ * from), in which case build as usual. */
+int64_t mlv_IndexSeekFrame(mlv_Index * Index,
+                           mlv_DataSource * DataSource,
+                           uint8_t * BlockType,
+                           uint64_t FrameNumber);
+
 /* Returns entry ID of the next entry after the one you've provided.
- * Returns -1 if there's no more entries left. */
+ * Returns -1 if there's no more entries left. Entry IDs stay valid while
+ * indexing continues, as new entries are added on the end.
+ * mlv_IndexOptimise, mlv_IndexOptimiseForStorage and mlv_IndexLoad move
+ * entries around, so IDs from before them must not be used after. An entry
+ * found by mlv_IndexSeekFrame may later be found by mlv_IndexBuild not to
+ * have been a real block (the seek started inside a block that looked like a
+ * valid one), it is then removed: this function and searching skip it, and
+ * its size is zero. */
 int64_t mlv_IndexGetNextEntry(mlv_Index * Index, uint64_t EntryID);
 
 /* Retrieves data of a block. Will return how many bytes were output.
@@ -148,17 +347,117 @@ void mlv_IndexGetBlockType(mlv_Index * Index,
 /* Returns how much memory the index is using. */
 uint64_t mlv_IndexGetSize(mlv_Index * Index);
 
+/* Reads whole blocks of NumEntries entries (such as all VIDF blocks for
+ * exporting), calling Callback with each one in the order of EntryIDs. Up to
+ * QueueDepth reads are kept going at once through mlv_DataSourceSubmitRead,
+ * in to a buffer of BufferSize bytes (0 for a default size, it grows if a
+ * block does not fit), which is registered with the data source. No other
+ * reads may be outstanding on the data source meanwhile. Returns number of
+ * blocks passed to Callback, less than NumEntries if a read failed or
+ * Callback returned zero. */
+uint64_t mlv_IndexReadBlocks(mlv_Index * Index,
+                             mlv_DataSource * DataSource,
+                             int64_t * EntryIDs,
+                             uint64_t NumEntries,
+                             int QueueDepth,
+                             uint64_t BufferSize,
+                             mlv_BlockCallback Callback,
+                             void * CallbackUD);
+
+/* Saves the index, so it can be loaded next time instead of indexing again.
+ * The file is a valid Magic Lantern .IDX file, with everything else the index
+ * has stored in an extra block. Returns zero if writing failed, or if parts
+ * indexed by mlv_IndexSeekFrame have not been joined up by building yet. */
+int mlv_IndexSave(mlv_Index * Index,
+                  mlv_DataSource * DataSource,
+                  mlv_Writer Writer,
+                  void * WriterUD);
+
+/* Loads an index saved by mlv_IndexSave, replacing what was in Index.
+ * Returns zero if the file is not valid, or the clip's chunk sizes or
+ * modification times have changed since the index was saved, in which case
+ * the index will be empty and has to be built as normal. */
+int mlv_IndexLoad(mlv_Index * Index,
+                  mlv_DataSource * DataSource,
+                  mlv_Reader Reader,
+                  void * ReaderUD);
+
 /* Prints the index. For debugging. Will remove eventually. */
 void mlv_IndexPrint(mlv_Index * Index);
 
 /******************************************************************************/
 
+/******************************* MLV Frame Cache ******************************/
+
+/* Keeps decoded frames, so that going back to them (such as scrubbing over
+ * the same part of a clip) does not need reading and decoding them again.
+ * Frames are found by index and frame number, and when the cache is over its
+ * memory budget, the least recently used frames are evicted. Can be used by
+ * many threads and frame extractors at once, so its allocator must then be
+ * thread-safe. */
+
+typedef struct mlv_FrameCache mlv_FrameCache;
+
+mlv_FrameCache * mlv_newFrameCache(mlv_Alloc Allocator, void * AllocatorUD, uint64_t MemoryBudget);
+/* All frames got from the cache must be released first */
+void mlv_closeFrameCache(mlv_FrameCache * FrameCache);
+
+/* Returns a frame, or NULL if it is not in the cache, counting a hit or miss.
+ * The frame is pinned (will not be evicted) until mlv_FrameCacheRelease. */
+uint16_t * mlv_FrameCacheGet(mlv_FrameCache * FrameCache,
+                             mlv_Index * Index,
+                             uint64_t FrameNumber,
+                             int * WidthOut,
+                             int * HeightOut,
+                             int * BitdepthOut);
+
+void mlv_FrameCacheRelease(mlv_FrameCache * FrameCache, uint16_t * Frame);
+
+/* Copies a frame in to the cache, evicting frames to make space for it.
+ * Returns zero if it does not fit, as the budget is too small or the rest
+ * of the frames are pinned. */
+int mlv_FrameCachePut(mlv_FrameCache * FrameCache,
+                      mlv_Index * Index,
+                      uint64_t FrameNumber,
+                      uint16_t * Frame,
+                      int Width,
+                      int Height,
+                      int Bitdepth);
+
+/* Removes all frames of Index, or all frames if Index is NULL. Must be done
+ * before closing an index, as another one could get the same address. Frames
+ * that mlv_FrameCachePut is still copying in when this is called are not
+ * added, whichever index they are of. */
+void mlv_FrameCacheClear(mlv_FrameCache * FrameCache, mlv_Index * Index);
+
+void mlv_FrameCacheSetMemoryBudget(mlv_FrameCache * FrameCache, uint64_t MemoryBudget);
+
+/* Memory used by the frames in the cache */
+uint64_t mlv_FrameCacheGetSize(mlv_FrameCache * FrameCache);
+
+/* How many times mlv_FrameCacheGet found or didn't find a frame */
+void mlv_FrameCacheGetStats(mlv_FrameCache * FrameCache, uint64_t * HitsOut, uint64_t * MissesOut);
+
+/******************************************************************************/
+
 /***************************** MLV Frame Extractor ****************************/
 
 typedef struct mlv_FrameExtractor mlv_FrameExtractor;
 
 mlv_FrameExtractor * mlv_newFrameExtractor(mlv_Alloc Allocator, void * AllocatorUD);
-
+void mlv_closeFrameExtractor(mlv_FrameExtractor * FrameExtractor);
+
+/* AllowIndexing can be this, for frames that have not been indexed yet to be
+ * found by mlv_IndexSeekFrame first, rather than building up to them */
+#define MLV_INDEX_LAZILY 2
+
+/* Returns the frame's data as it is stored in the file (packed or LJ92), with
+ * its size output to NumBytesOut. Returns NULL if the frame can't be found.
+ * If AllowIndexing is set, the index will be built further until the frame
+ * is found (see MLV_INDEX_LAZILY). The data is valid until the next call to
+ * the frame extractor. It may point straight in to the data source's memory
+ * (if it has any, see mlv_DataSourceSetChunkPointer), so must not be
+ * modified. */
 void * mlv_FrameExtractorGetFrameData(mlv_FrameExtractor * FrameExtractor,
                                       mlv_Index * Index,
                                       mlv_DataSource * DataSource,
@@ -166,12 +465,17 @@ void * mlv_FrameExtractorGetFrameData(mlv_FrameExtractor * FrameExtractor,
                                       uint64_t * NumBytesOut,
                                       int AllowIndexing);
 
+/* Returns the frame unpacked/decoded to 16 bits per pixel, or NULL on error.
+ * Memory is kept and reused between calls, so getting frames of the same
+ * size does no allocation. Valid until the next call to the frame extractor. */
 uint16_t * mlv_FrameExtractorGetFrame(mlv_FrameExtractor * FrameExtractor,
                                       mlv_Index * Index,
                                       mlv_DataSource * DataSource,
                                       uint64_t FrameNumber,
                                       int AllowIndexing);
 
+/* Returns audio frame's data, number of 16 bit samples is output to NumSamplesOut.
+ * Like mlv_FrameExtractorGetFrameData, it must not be modified. */
 uint16_t * mlv_FrameExtractorGetAudioData(mlv_FrameExtractor * FrameExtractor,
                                           uint64_t AudioFrameNumber,
                                           mlv_Index * Index,
@@ -179,9 +483,77 @@ uint16_t * mlv_FrameExtractorGetAudioData(mlv_FrameExtractor * FrameExtractor,
                                           uint64_t * NumSamplesOut,
                                           int AllowIndexing);
 
-/* Will free any frame data (happens automatically anyway on next frame) */
+/* Dimensions and bitdepth of the last frame returned by mlv_FrameExtractorGetFrame */
+int mlv_FrameExtractorGetWidth(mlv_FrameExtractor * FrameExtractor);
+int mlv_FrameExtractorGetHeight(mlv_FrameExtractor * FrameExtractor);
+int mlv_FrameExtractorGetBitdepth(mlv_FrameExtractor * FrameExtractor);
+
+/* LJ92 frames that are split in slices (restart intervals) get each of their
+ * slices decoded on one of NumThreads threads by mlv_FrameExtractorGetFrame,
+ * so a single big frame is decoded sooner. Threads are started for each
+ * frame. Frames without slices are decoded as usual. Default is 1 thread. */
+void mlv_FrameExtractorSetSliceThreads(mlv_FrameExtractor * FrameExtractor, int NumThreads);
+
+/* Makes mlv_FrameExtractorGetFrame look for frames in Cache before reading
+ * and decoding them, in which case the frame is straight from the cache, and
+ * put decoded frames in it. Frames decoded by decoding threads (including for
+ * playback) are too. Set it before starting decoding. NULL for no cache. */
+void mlv_FrameExtractorSetCache(mlv_FrameExtractor * FrameExtractor, mlv_FrameCache * Cache);
+
+/* Will free any frame data (happens automatically anyway on next frame), and
+ * stops decoding if it was started */
 void mlv_FrameExtractorFree(mlv_FrameExtractor * FrameExtractor);
 
+/* Starts decoding NumFrames frames from FirstFrame on NumThreads threads, each
+ * decoding a different frame, so that decoding LJ92 clips is not limited to
+ * one core. Get the frames with mlv_FrameExtractorGetDecodedFrame. The frames
+ * must already be in the index, and Index must not be changed until decoding
+ * is stopped. If the DataSource is not thread-safe, reading is done by one
+ * thread at a time. The allocator is called from the decoding threads (one at
+ * a time), so must be thread-safe if it is used by anything else meanwhile.
+ * If threads can't be used, frames are decoded when they are asked for.
+ * Stops any decoding that was already started. Returns zero on error. */
+int mlv_FrameExtractorStartDecoding(mlv_FrameExtractor * FrameExtractor,
+                                    mlv_Index * Index,
+                                    mlv_DataSource * DataSource,
+                                    uint64_t FirstFrame,
+                                    uint64_t NumFrames,
+                                    int NumThreads);
+
+/* Returns the next decoded frame, in order, waiting for it if it is not
+ * decoded yet. Its frame number is output to FrameNumberOut. Returns NULL if
+ * the frame could not be decoded (the next call will give the frame after it),
+ * or once all frames have been returned. Valid until the next call, and the
+ * frame extractor's width, height and bitdepth are set to the frame's. */
+uint16_t * mlv_FrameExtractorGetDecodedFrame(mlv_FrameExtractor * FrameExtractor,
+                                             uint64_t * FrameNumberOut);
+
+/* Starts decoding for playback of a clip with NumFrames frames, from frame 0
+ * forwards. Like mlv_FrameExtractorStartDecoding, but frames are decoded
+ * ahead of the playhead, as many as fit in roughly MemoryBudget bytes (at
+ * least two, one being the frame last returned). Get frames with
+ * mlv_FrameExtractorGetDecodedFrame, it returns NULL at the end of the clip,
+ * and stop with mlv_FrameExtractorStopDecoding. Returns zero on error. */
+int mlv_FrameExtractorStartPlayback(mlv_FrameExtractor * FrameExtractor,
+                                    mlv_Index * Index,
+                                    mlv_DataSource * DataSource,
+                                    uint64_t NumFrames,
+                                    uint64_t MemoryBudget,
+                                    int NumThreads);
+
+/* Moves the playhead, so that the next decoded frame is Frame, and frames
+ * after it are Speed frames apart (negative plays backwards, zero is the
+ * same as one). Frames decoded ahead for the old playhead are thrown away,
+ * and frames being decoded are once they are done, so scrubbing does not wait
+ * for them. Must not be called at the same time as
+ * mlv_FrameExtractorGetDecodedFrame. Returns zero if playback was not started. */
+int mlv_FrameExtractorSeekPlayback(mlv_FrameExtractor * FrameExtractor,
+                                   uint64_t Frame,
+                                   int Speed);
+
+/* Stops decoding threads and frees their memory */
+void mlv_FrameExtractorStopDecoding(mlv_FrameExtractor * FrameExtractor);
+
 /******************************************************************************/
 
 /* MLV Constants */
@@ -207,7 +579,15 @@ void mlv_FrameExtractorFree(mlv_FrameExtractor * FrameExtractor);
 /* Private utility functions */
 void * mlv_Malloc(mlv_Alloc Allocator, void * AllocatorUD, uint64_t Size);
 void * mlv_Malloc2(void * UseAllocatorFrom, uint64_t Size);
+void mlv_GetAllocator(void * Pointer, mlv_Alloc * AllocatorOut, void ** AllocatorUDOut);
 void mlv_Free(void * Pointer);
 void * mlv_Realloc(void * Pointer, uint64_t NewSize);
 
+/* Threads are used by mlv_IndexBuildParallel and frame extractor decoding, to
+ * build without them define LIBMLV_NO_THREADS (everything is then done on the
+ * calling thread) */
+#if !defined(LIBMLV_NO_THREADS) && defined(_MSC_VER)
+#define LIBMLV_NO_THREADS
+#endif
+
 #endif
\ No newline at end of file
@@ -1,10 +1,42 @@
+/* For O_DIRECT */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "libmlv.h"
 #include "libmlvaux.h"
 
+#ifdef _WIN32
+#define flockfile _lock_file
+#define funlockfile _unlock_file
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MLVL_HAVE_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/* Asynchronous reading needs threads, and uses io_uring on Linux if it can
+ * (define MLVL_NO_IO_URING to always use threads) */
+#ifndef LIBMLV_NO_THREADS
+#define MLVL_HAVE_ASYNC
+#include <pthread.h>
+#if defined(__linux__) && !defined(MLVL_NO_IO_URING)
+#define MLVL_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
 /* Simple implementations of mlv_Alloc, mlv_Reader and mlv_Close */
 
 static void * mlv_alloc(void * ud, void * ptr, uint64_t osize, uint64_t nsize)
@@ -20,10 +52,20 @@ static void * mlv_alloc(void * ud, void * ptr, uint64_t osize, uint64_t nsize)
     }
 }
 
+/* Locks the file so that the seek and read happen together (thread-safe) */
 static uint64_t mlv_reader(void * ud, uint64_t pos, uint64_t bytes, void * out)
+{
+    flockfile(ud);
+    fseek(ud, pos, SEEK_SET);
+    uint64_t bytes_read = fread(out, 1, bytes, ud);
+    funlockfile(ud);
+    return bytes_read;
+}
+
+static uint64_t mlv_writer(void * ud, uint64_t pos, uint64_t bytes, void * in)
 {
     fseek(ud, pos, SEEK_SET);
-    return fread(out, bytes, 1, ud);
+    return fwrite(in, 1, bytes, ud);
 }
 
 static void mlv_close(void * ud)
@@ -43,52 +85,255 @@ mlv_FrameExtractor * mlvL_newFrameExtractor()
     return mlv_newFrameExtractor(mlv_alloc, NULL);
 }
 
+mlv_FrameCache * mlvL_newFrameCache(uint64_t MemoryBudget)
+{
+    return mlv_newFrameCache(mlv_alloc, NULL, MemoryBudget);
+}
+
 static int file_exists(char * path)
 {
     FILE * file = fopen(path, "r");
+    if (file == NULL) return 0;
     fclose(file);
-    return (file == NULL) ? 0 : 1;
+    return 1;
 }
 
-mlv_DataSource * mlvL_newDataSource(char * MainChunkFileName,
-                                    int SearchForAdditionalChunks)
+/* Finds the MLV's chunk files (.MLV, .M00, .M01...). Returns number of chunks,
+ * or zero if the main one doesn't exist. Names other than the first must be
+ * freed with free_chunk_file_names. */
+static int find_chunk_files(char * MainChunkFileName,
+                            int SearchForAdditionalChunks,
+                            char * FileNamesOut[MLV_MAX_NUM_CHUNKS])
 {
-    mlv_DataSource * datasource = NULL;
+    if (!file_exists(MainChunkFileName)) return 0;
+
+    int num_chunks = 1;
+    FileNamesOut[0] = MainChunkFileName;
 
-    if (file_exists(MainChunkFileName))
+    if (SearchForAdditionalChunks)
     {
-        char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
-        int num_chunks = 1;
-        file_names[0] = MainChunkFileName;
+        uint64_t path_length = strlen(MainChunkFileName);
+        char * path = malloc(path_length+1);
+        strcpy(path, MainChunkFileName);
 
-        if (SearchForAdditionalChunks)
+        do {
+            path[path_length-1] = '0' + ((num_chunks - 1) % 10);
+            path[path_length-2] = '0' + ((num_chunks - 1) / 10);
+            if (file_exists(path))
+            {
+                FileNamesOut[num_chunks] = malloc(path_length+1);
+                strcpy(FileNamesOut[num_chunks], path);
+                ++num_chunks;
+            }
+            else
+            {
+                break;
+            }
+        } while (num_chunks < MLV_MAX_NUM_CHUNKS);
+
+        free(path);
+    }
+
+    return num_chunks;
+}
+
+static void free_chunk_file_names(char ** FileNames, int NumChunks)
+{
+    for (int c = NumChunks-1; c > 0; --c)
+    {
+        free(FileNames[c]);
+    }
+}
+
+/* Opens a chunk file with stdio, returns zero if it couldn't be */
+static int open_file_chunk(mlv_DataSource * DataSource, int Chunk, char * FileName)
+{
+    FILE * file = (FileName != NULL) ? fopen(FileName, "r") : NULL;
+    if (file == NULL) return 0;
+
+    fseek(file, 0, SEEK_END);
+    uint64_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    mlv_DataSourceSetChunk(DataSource, Chunk, file, size, NULL, NULL);
+
+    struct stat file_info;
+    if (stat(FileName, &file_info) == 0)
+        mlv_DataSourceSetChunkModificationTime(DataSource, Chunk, file_info.st_mtime);
+
+    return 1;
+}
+
+#ifdef MLVL_HAVE_POSIX
+typedef struct direct_bounce direct_bounce_t;
+static int open_posix_chunk(mlv_DataSource * DataSource, int Chunk, char * FileName, int AccessPattern, direct_bounce_t * Bounce, int * FDOut);
+static void retain_direct_bounce(direct_bounce_t * Bounce);
+static void release_direct_bounce(direct_bounce_t * Bounce);
+#endif
+
+/******** Refreshing (clips still being written) ********/
+
+/* Chunk files are looked at again by name, for their new sizes, and for new
+ * chunks if they were searched for in the first place */
+typedef struct
+{
+    char * file_names[MLV_MAX_NUM_CHUNKS];
+    int search_for_additional_chunks;
+    int is_posix; /* Opened by open_posix_chunk, otherwise open_file_chunk */
+    int access_pattern;
+#ifdef MLVL_HAVE_POSIX
+    direct_bounce_t * direct_bounce; /* For new MLVL_ACCESS_DIRECT chunks */
+#endif
+} chunk_files_t;
+
+static void mlv_chunk_files_close(void * ud)
+{
+    chunk_files_t * files = ud;
+    for (int c = 0; c < MLV_MAX_NUM_CHUNKS; ++c) free(files->file_names[c]);
+#ifdef MLVL_HAVE_POSIX
+    release_direct_bounce(files->direct_bounce);
+#endif
+    free(files);
+}
+
+static int mlv_chunk_files_refresh(void * ud, mlv_DataSource * DataSource)
+{
+    chunk_files_t * files = ud;
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+    int changed = 0;
+
+    for (int c = 0; c < num_chunks; ++c)
+    {
+        struct stat file_info;
+        if ( files->file_names[c] != NULL && stat(files->file_names[c], &file_info) == 0
+          && (uint64_t)file_info.st_size != mlv_DataSourceGetChunkSize(DataSource, c) )
         {
-            uint64_t path_length = strlen(MainChunkFileName);
-            char * path = malloc(path_length+1);
-            strcpy(path, MainChunkFileName);
-
-            do {
-                path[path_length-1] = '0' + ((num_chunks - 1) % 10);
-                path[path_length-2] = '0' + ((num_chunks - 1) / 10);
-                if (file_exists(path))
-                {
-                    file_names[num_chunks] = malloc(path_length+1);
-                    strcpy(file_names[num_chunks], path);
-                    ++num_chunks;
-                }
-                else
-                {
-                    break;
-                }
-            } while (num_chunks < MLV_MAX_NUM_CHUNKS);
+            mlv_DataSourceSetChunkSize(DataSource, c, file_info.st_size);
+            mlv_DataSourceSetChunkModificationTime(DataSource, c, file_info.st_mtime);
+            changed = 1;
         }
+    }
+
+    if (!files->search_for_additional_chunks) return changed;
 
-        datasource = mlvL_newDataSourceFromChunks(file_names, num_chunks);
+    char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
+    int num_files = find_chunk_files(files->file_names[0], 1, file_names);
 
-        for (int c = num_chunks-1; c > 0; --c)
+    /* The chunk count only goes up once a new chunk has been opened, so that
+     * closing never sees one that wasn't */
+    for (int c = num_chunks; c < num_files; ++c)
+    {
+        char * name = malloc(strlen(file_names[c]) + 1);
+        if (name == NULL) break;
+        strcpy(name, file_names[c]);
+
+        mlv_DataSourceSetChunkCount(DataSource, c + 1);
+
+        int opened;
+#ifdef MLVL_HAVE_POSIX
+        if (files->is_posix) opened = open_posix_chunk(DataSource, c, name, files->access_pattern, files->direct_bounce, NULL);
+        else
+#endif
+        opened = open_file_chunk(DataSource, c, name);
+
+        if (!opened)
         {
-            free(file_names[c]);
+            mlv_DataSourceSetChunkCount(DataSource, c);
+            free(name);
+            break;
         }
+
+        files->file_names[c] = name;
+        changed = 1;
+    }
+
+    free_chunk_file_names(file_names, num_files);
+    return changed;
+}
+
+/* Lets mlv_DataSourceRefresh pick up new data, if memory can be had. Returns
+ * the refresher's state, or NULL if there wasn't memory. */
+static chunk_files_t * set_chunk_files_refresher(mlv_DataSource * DataSource,
+                                      char ** ChunkFileNames,
+                                      int NumFiles,
+                                      int SearchForAdditionalChunks,
+                                      int IsPOSIX,
+                                      int AccessPattern)
+{
+    chunk_files_t * files = calloc(1, sizeof(chunk_files_t));
+    if (files == NULL) return NULL;
+
+    for (int c = 0; c < NumFiles; ++c)
+    {
+        files->file_names[c] = malloc(strlen(ChunkFileNames[c]) + 1);
+        if (files->file_names[c] == NULL)
+        {
+            mlv_chunk_files_close(files);
+            return NULL;
+        }
+        strcpy(files->file_names[c], ChunkFileNames[c]);
+    }
+
+    files->search_for_additional_chunks = SearchForAdditionalChunks;
+    files->is_posix = IsPOSIX;
+    files->access_pattern = AccessPattern;
+
+    mlv_DataSourceSetRefresher(DataSource, mlv_chunk_files_refresh, mlv_chunk_files_close, files);
+    return files;
+}
+
+/******** stdio data source ********/
+
+static mlv_DataSource * new_file_data_source(char ** ChunkFileNames,
+                                             int NumFiles)
+{
+    int err = 0;
+    if (NumFiles > MLV_MAX_NUM_CHUNKS) return NULL;
+
+    mlv_DataSource * datasource = mlv_newDataSource(mlv_alloc, NULL);
+
+    if (datasource != NULL)
+    {
+        mlv_DataSourceSetReader(datasource, mlv_reader);
+        mlv_DataSourceSetCloser(datasource, mlv_close);
+        mlv_DataSourceSetThreadSafe(datasource, 1);
+        mlv_DataSourceSetChunkCount(datasource, NumFiles);
+
+        for (int c = 0; c < NumFiles && !err; ++c)
+        {
+            if (!open_file_chunk(datasource, c, ChunkFileNames[c]))
+            {
+                /* So that closing only closes chunks that were opened */
+                mlv_DataSourceSetChunkCount(datasource, c);
+                err = 1;
+            }
+        }
+    }
+
+    if (err)
+    {
+        /* Something failed, so delete it and return NULL */
+        if (datasource != NULL) mlv_closeDataSource(datasource);
+        return NULL;
+    }
+    else
+    {
+        return datasource;
+    }
+}
+
+mlv_DataSource * mlvL_newDataSource(char * MainChunkFileName,
+                                    int SearchForAdditionalChunks)
+{
+    mlv_DataSource * datasource = NULL;
+    char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
+    int num_chunks = find_chunk_files(MainChunkFileName, SearchForAdditionalChunks, file_names);
+
+    if (num_chunks > 0)
+    {
+        datasource = new_file_data_source(file_names, num_chunks);
+        if (datasource != NULL) set_chunk_files_refresher(datasource, file_names, num_chunks, SearchForAdditionalChunks, 0, 0);
+        free_chunk_file_names(file_names, num_chunks);
     }
 
     return datasource;
@@ -96,35 +341,437 @@ mlv_DataSource * mlvL_newDataSource(char * MainChunkFileName,
 
 mlv_DataSource * mlvL_newDataSourceFromChunks(char ** ChunkFileNames,
                                               int NumFiles)
+{
+    mlv_DataSource * datasource = new_file_data_source(ChunkFileNames, NumFiles);
+    if (datasource != NULL) set_chunk_files_refresher(datasource, ChunkFileNames, NumFiles, 0, 0, 0);
+    return datasource;
+}
+
+/******** POSIX data source ********/
+
+#ifdef MLVL_HAVE_POSIX
+
+/* File descriptors are stored directly as the chunk data pointer */
+#define FD_TO_UD(FD) ((void *)(intptr_t)(FD))
+#define UD_TO_FD(UD) ((int)(intptr_t)(UD))
+
+/* pread needs no seeking, so no locking, and reads straight in to out */
+static uint64_t mlv_posix_reader(void * ud, uint64_t pos, uint64_t bytes, void * out)
+{
+    uint64_t bytes_read = 0;
+
+    while (bytes_read < bytes)
+    {
+        ssize_t result = pread(UD_TO_FD(ud), (uint8_t *)out + bytes_read, bytes - bytes_read, pos + bytes_read);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) break;
+        bytes_read += result;
+    }
+
+    return bytes_read;
+}
+
+static void mlv_posix_close(void * ud)
+{
+    if (UD_TO_FD(ud) >= 0) close(UD_TO_FD(ud));
+}
+
+/* In MLVL_ACCESS_DIRECT mode, reads at least this big skip the page cache,
+ * smaller ones (such as block headers read while indexing) are cached */
+#define MLVL_DIRECT_MIN_READ (256 * 1024)
+
+/* O_DIRECT reads must be aligned in the file and in memory to the device's
+ * block size, which this is a multiple of */
+#define MLVL_DIRECT_ALIGNMENT ((uint64_t)4096)
+
+/* Reads that can't go straight in to the output are done through this much
+ * aligned memory at a time */
+#define MLVL_DIRECT_BOUNCE_SIZE ((uint64_t)1 << 20)
+
+#define DIRECT_ALIGN_DOWN(X) ((X) & ~(MLVL_DIRECT_ALIGNMENT - 1))
+#define DIRECT_ALIGN_UP(X) DIRECT_ALIGN_DOWN((X) + MLVL_DIRECT_ALIGNMENT - 1)
+
+/* Aligned memory for reads that can't go straight in to the output. A data
+ * source's direct chunks share one, as does its refresher (which opens more
+ * of them), and it is freed when the last of those is closed. */
+struct direct_bounce
+{
+    void * memory; /* MLVL_DIRECT_BOUNCE_SIZE bytes, allocated when first used */
+    int num_users;
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_t mutex; /* Held while memory is in use */
+#endif
+};
+
+#ifndef LIBMLV_NO_THREADS
+#define LOCK_BOUNCE(Bounce) pthread_mutex_lock(&(Bounce)->mutex)
+#define TRYLOCK_BOUNCE(Bounce) (pthread_mutex_trylock(&(Bounce)->mutex) == 0)
+#define UNLOCK_BOUNCE(Bounce) pthread_mutex_unlock(&(Bounce)->mutex)
+#else
+#define LOCK_BOUNCE(Bounce) ((void)(Bounce))
+#define TRYLOCK_BOUNCE(Bounce) ((void)(Bounce), 1)
+#define UNLOCK_BOUNCE(Bounce) ((void)(Bounce))
+#endif
+
+static direct_bounce_t * new_direct_bounce(void)
+{
+    direct_bounce_t * bounce = calloc(1, sizeof(direct_bounce_t));
+    if (bounce == NULL) return NULL;
+    bounce->num_users = 1;
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_init(&bounce->mutex, NULL);
+#endif
+    return bounce;
+}
+
+static void retain_direct_bounce(direct_bounce_t * Bounce)
+{
+    if (Bounce == NULL) return;
+    LOCK_BOUNCE(Bounce);
+    ++Bounce->num_users;
+    UNLOCK_BOUNCE(Bounce);
+}
+
+static void release_direct_bounce(direct_bounce_t * Bounce)
+{
+    if (Bounce == NULL) return;
+    LOCK_BOUNCE(Bounce);
+    int num_users = --Bounce->num_users;
+    UNLOCK_BOUNCE(Bounce);
+    if (num_users > 0) return;
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_destroy(&Bounce->mutex);
+#endif
+    free(Bounce->memory);
+    free(Bounce);
+}
+
+/* Returns the shared memory, or if another thread is using it, Size bytes of
+ * its own. Either way put_bounce must be called after, even if this returned
+ * NULL. */
+static void * get_bounce(direct_bounce_t * Bounce, uint64_t Size, int * IsSharedOut)
+{
+    void * memory = NULL;
+
+    if (!TRYLOCK_BOUNCE(Bounce))
+    {
+        *IsSharedOut = 0;
+        if (posix_memalign(&memory, MLVL_DIRECT_ALIGNMENT, Size) != 0) return NULL;
+        return memory;
+    }
+
+    *IsSharedOut = 1;
+    if (Bounce->memory == NULL && posix_memalign(&memory, MLVL_DIRECT_ALIGNMENT, MLVL_DIRECT_BOUNCE_SIZE) == 0)
+        Bounce->memory = memory;
+    return Bounce->memory;
+}
+
+static void put_bounce(direct_bounce_t * Bounce, void * Memory, int IsShared)
+{
+    if (IsShared) UNLOCK_BOUNCE(Bounce);
+    else free(Memory);
+}
+
+/* Chunk opened twice, direct_fd bypasses the page cache (-1 if the system or
+ * file system does not allow it) */
+typedef struct
+{
+    int fd;
+    int direct_fd;
+    direct_bounce_t * bounce;
+} direct_chunk_t;
+
+/* Reads the aligned blocks around Pos to Pos+Bytes in to aligned memory, and
+ * copies out the part that was asked for */
+static uint64_t direct_read_bounced(direct_chunk_t * Chunk, uint64_t Pos, uint64_t Bytes, uint8_t * Out)
+{
+    if (Bytes == 0) return 0;
+
+    uint64_t block_pos = DIRECT_ALIGN_DOWN(Pos);
+    uint64_t end = Pos + Bytes;
+    uint64_t bounce_size = DIRECT_ALIGN_UP(end) - block_pos;
+    if (bounce_size > MLVL_DIRECT_BOUNCE_SIZE) bounce_size = MLVL_DIRECT_BOUNCE_SIZE;
+
+    int is_shared;
+    void * bounce = get_bounce(Chunk->bounce, bounce_size, &is_shared);
+    if (bounce == NULL)
+    {
+        put_bounce(Chunk->bounce, NULL, is_shared);
+        return 0;
+    }
+
+    uint64_t bytes_read = 0;
+
+    while (bytes_read < Bytes)
+    {
+        uint64_t to_read = DIRECT_ALIGN_UP(end) - block_pos;
+        if (to_read > bounce_size) to_read = bounce_size;
+
+        uint64_t got = mlv_posix_reader(FD_TO_UD(Chunk->direct_fd), block_pos, to_read, bounce);
+
+        /* Where the next wanted byte is in the bounce buffer */
+        uint64_t offset = Pos + bytes_read - block_pos;
+        if (got <= offset) break;
+
+        uint64_t to_copy = got - offset;
+        if (to_copy > Bytes - bytes_read) to_copy = Bytes - bytes_read;
+        memcpy(Out + bytes_read, (uint8_t *)bounce + offset, to_copy);
+        bytes_read += to_copy;
+
+        if (got < to_read) break;
+        block_pos += to_read;
+    }
+
+    put_bounce(Chunk->bounce, bounce, is_shared);
+    return bytes_read;
+}
+
+static uint64_t mlv_direct_reader(void * ud, uint64_t pos, uint64_t bytes, void * out)
+{
+    direct_chunk_t * chunk = ud;
+    uint8_t * out8 = out;
+
+    if (bytes < MLVL_DIRECT_MIN_READ || chunk->direct_fd < 0)
+        return mlv_posix_reader(FD_TO_UD(chunk->fd), pos, bytes, out);
+
+    uint64_t bytes_read;
+    uint64_t middle_start = DIRECT_ALIGN_UP(pos);
+    uint64_t middle_end = DIRECT_ALIGN_DOWN(pos + bytes);
+
+    if (((uintptr_t)(out8 + (middle_start - pos)) & (MLVL_DIRECT_ALIGNMENT - 1)) == 0)
+    {
+        /* The aligned middle goes straight in to the output, the unaligned
+         * head and tail through aligned memory */
+        bytes_read = direct_read_bounced(chunk, pos, middle_start - pos, out8);
+        if (bytes_read == middle_start - pos)
+            bytes_read += mlv_posix_reader(FD_TO_UD(chunk->direct_fd), middle_start, middle_end - middle_start, out8 + bytes_read);
+        if (bytes_read == middle_end - pos)
+            bytes_read += direct_read_bounced(chunk, middle_end, pos + bytes - middle_end, out8 + bytes_read);
+    }
+    else
+    {
+        /* Output is not aligned the same as the file, so all of it has to be
+         * copied */
+        bytes_read = direct_read_bounced(chunk, pos, bytes, out8);
+    }
+
+    /* The rest is read as normal, in case the direct read failed (some file
+     * systems refuse it). At the end of the file this reads nothing. */
+    if (bytes_read < bytes)
+        bytes_read += mlv_posix_reader(FD_TO_UD(chunk->fd), pos + bytes_read, bytes - bytes_read, out8 + bytes_read);
+
+    return bytes_read;
+}
+
+static void mlv_direct_close(void * ud)
+{
+    direct_chunk_t * chunk = ud;
+    close(chunk->fd);
+    if (chunk->direct_fd >= 0) close(chunk->direct_fd);
+    release_direct_bounce(chunk->bounce);
+    free(chunk);
+}
+
+/* Opens a chunk file again, without the page cache */
+static int open_direct(char * FileName)
+{
+#if defined(O_DIRECT)
+    return open(FileName, O_RDONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+    int fd = open(FileName, O_RDONLY);
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) == -1)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+#else
+    (void)FileName;
+    return -1;
+#endif
+}
+
+/* Opens a chunk file for a POSIX data source, its file descriptor is output
+ * to FDOut if it is not NULL. MLVL_ACCESS_DIRECT chunks use Bounce for reads
+ * that aren't aligned. Returns zero if it couldn't be opened. */
+static int open_posix_chunk(mlv_DataSource * DataSource, int Chunk, char * FileName, int AccessPattern, direct_bounce_t * Bounce, int * FDOut)
+{
+    int fd = open(FileName, O_RDONLY);
+    struct stat file_info;
+
+    direct_chunk_t * direct = NULL;
+    if (fd >= 0 && (AccessPattern & MLVL_ACCESS_DIRECT) && (direct = malloc(sizeof(direct_chunk_t))) == NULL)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    if (fd < 0 || fstat(fd, &file_info) != 0)
+    {
+        if (fd >= 0) close(fd);
+        free(direct);
+        return 0;
+    }
+
+    if (direct != NULL)
+    {
+        direct->fd = fd;
+        direct->direct_fd = open_direct(FileName);
+        direct->bounce = Bounce;
+        retain_direct_bounce(Bounce);
+        mlv_DataSourceSetChunk(DataSource, Chunk, direct, file_info.st_size, mlv_direct_reader, mlv_direct_close);
+    }
+    else
+    {
+        mlv_DataSourceSetChunk(DataSource, Chunk, FD_TO_UD(fd), file_info.st_size, NULL, NULL);
+    }
+    if (FDOut != NULL) *FDOut = fd;
+    mlv_DataSourceSetChunkModificationTime(DataSource, Chunk, file_info.st_mtime);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if ((AccessPattern & ~MLVL_ACCESS_DIRECT) == MLVL_ACCESS_SEQUENTIAL)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    else if ((AccessPattern & ~MLVL_ACCESS_DIRECT) == MLVL_ACCESS_RANDOM)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+    return 1;
+}
+
+/* File descriptors of the chunks are output to FDsOut, if it is not NULL.
+ * Also sets up refreshing, which opens new chunks the same way. */
+static mlv_DataSource * new_posix_data_source(char ** ChunkFileNames,
+                                              int NumFiles,
+                                              int SearchForAdditionalChunks,
+                                              int AccessPattern,
+                                              int * FDsOut)
 {
     int err = 0;
     if (NumFiles > MLV_MAX_NUM_CHUNKS) return NULL;
 
+    direct_bounce_t * bounce = NULL;
+    if ((AccessPattern & MLVL_ACCESS_DIRECT) && (bounce = new_direct_bounce()) == NULL) return NULL;
+
     mlv_DataSource * datasource = mlv_newDataSource(mlv_alloc, NULL);
+    if (datasource == NULL) err = 1;
 
     if (datasource != NULL)
     {
-        mlv_DataSourceSetReader(datasource, mlv_reader);
-        mlv_DataSourceSetCloser(datasource, mlv_close);
+        mlv_DataSourceSetReader(datasource, mlv_posix_reader);
+        mlv_DataSourceSetCloser(datasource, mlv_posix_close);
+        mlv_DataSourceSetThreadSafe(datasource, 1);
+        mlv_DataSourceSetChunkCount(datasource, NumFiles);
+
+        /* So that closing after an error only closes chunks that were opened */
+        for (int c = 0; c < NumFiles; ++c)
+            mlv_DataSourceSetChunk(datasource, c, FD_TO_UD(-1), 0, NULL, NULL);
+
+        for (int c = 0; c < NumFiles && !err; ++c)
+            if (!open_posix_chunk(datasource, c, ChunkFileNames[c], AccessPattern, bounce, (FDsOut != NULL) ? FDsOut + c : NULL))
+                err = 1;
+    }
+
+    if (!err)
+    {
+        chunk_files_t * files = set_chunk_files_refresher(datasource, ChunkFileNames, NumFiles, SearchForAdditionalChunks, 1, AccessPattern);
+        if (files != NULL)
+        {
+            files->direct_bounce = bounce;
+            retain_direct_bounce(bounce);
+        }
+    }
+
+    /* The chunks and refresher have their own hold on it now */
+    release_direct_bounce(bounce);
+
+    if (err)
+    {
+        /* Something failed, so delete it and return NULL */
+        if (datasource != NULL) mlv_closeDataSource(datasource);
+        return NULL;
+    }
+    else
+    {
+        return datasource;
+    }
+}
+
+/* A memory mapped chunk */
+typedef struct {
+    uint8_t * data;
+    uint64_t size;
+} mapped_chunk_t;
+
+static uint64_t mlv_mmap_reader(void * ud, uint64_t pos, uint64_t bytes, void * out)
+{
+    mapped_chunk_t * chunk = ud;
+    if (pos >= chunk->size) return 0;
+    if (bytes > chunk->size - pos) bytes = chunk->size - pos;
+    memcpy(out, chunk->data + pos, bytes);
+    return bytes;
+}
+
+static void mlv_mmap_close(void * ud)
+{
+    mapped_chunk_t * chunk = ud;
+    if (chunk == NULL) return;
+    if (chunk->data != NULL) munmap(chunk->data, chunk->size);
+    free(chunk);
+}
+
+static mlv_DataSource * new_mmap_data_source(char ** ChunkFileNames,
+                                             int NumFiles)
+{
+    int err = 0;
+    if (NumFiles > MLV_MAX_NUM_CHUNKS) return NULL;
+
+    mlv_DataSource * datasource = mlv_newDataSource(mlv_alloc, NULL);
+
+    if (datasource != NULL)
+    {
+        mlv_DataSourceSetReader(datasource, mlv_mmap_reader);
+        mlv_DataSourceSetCloser(datasource, mlv_mmap_close);
+        mlv_DataSourceSetThreadSafe(datasource, 1);
         mlv_DataSourceSetChunkCount(datasource, NumFiles);
 
+        /* So that closing after an error only closes chunks that were mapped */
+        for (int c = 0; c < NumFiles; ++c)
+            mlv_DataSourceSetChunk(datasource, c, NULL, 0, NULL, NULL);
+
         for (int c = 0; c < NumFiles && !err; ++c)
         {
-            if (ChunkFileNames[c] != NULL)
+            int fd = open(ChunkFileNames[c], O_RDONLY);
+            struct stat file_info;
+            mapped_chunk_t * chunk = malloc(sizeof(mapped_chunk_t));
+
+            if (fd >= 0 && chunk != NULL && fstat(fd, &file_info) == 0)
             {
-                FILE * file = fopen(ChunkFileNames[c], "r");
+                chunk->size = file_info.st_size;
+                chunk->data = NULL;
 
-                if (file != NULL)
+                if (chunk->size > 0)
                 {
-                    fseek(file, 0, SEEK_END);
-                    uint64_t size = ftell(file);
-                    fseek(file, 0, SEEK_SET);
-
-                    mlv_DataSourceSetChunk(datasource, c, file, size, NULL, NULL);
+                    chunk->data = mmap(NULL, chunk->size, PROT_READ, MAP_SHARED, fd, 0);
+                    if (chunk->data == MAP_FAILED)
+                    {
+                        chunk->data = NULL;
+                        err = 1;
+                    }
                 }
-                else err = 1;
+
+                mlv_DataSourceSetChunk(datasource, c, chunk, chunk->size, NULL, NULL);
+                mlv_DataSourceSetChunkPointer(datasource, c, chunk->data);
+                mlv_DataSourceSetChunkModificationTime(datasource, c, file_info.st_mtime);
             }
-            else err = 1;
+            else
+            {
+                free(chunk);
+                err = 1;
+            }
+
+            /* Mapping stays valid after closing */
+            if (fd >= 0) close(fd);
         }
     }
 
@@ -138,4 +785,603 @@ mlv_DataSource * mlvL_newDataSourceFromChunks(char ** ChunkFileNames,
     {
         return datasource;
     }
-}
\ No newline at end of file
+}
+
+/******** Asynchronous reading ********/
+
+#ifdef MLVL_HAVE_ASYNC
+
+/* Most reads an asynchronous reader can have outstanding, and most threads
+ * it reads on when io_uring can't be used */
+#define MLVL_MAX_QUEUE_DEPTH 256
+#define MLVL_MAX_ASYNC_THREADS 16
+
+/* Bigger reads are done synchronously, as an io_uring read is at most 4 GiB */
+#define MLVL_MAX_ASYNC_READ ((uint64_t)1 << 30)
+
+typedef struct
+{
+    void * chunk_ud;
+    uint64_t pos;
+    uint64_t bytes;
+    uint64_t bytes_read;
+    uint8_t * out;
+    uint64_t tag;
+    struct iovec iov;
+} async_read_t;
+
+#ifdef MLVL_HAVE_IO_URING
+typedef struct
+{
+    int fd;
+    unsigned num_entries;
+    unsigned to_submit;
+
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    struct io_uring_sqe * sqes;
+
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    struct io_uring_cqe * cqes;
+
+    void * sq_ring;
+    size_t sq_ring_size;
+    void * cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+#endif
+
+/* Reads are done with io_uring if the kernel has it, otherwise on a pool of
+ * threads using pread */
+typedef struct
+{
+    int queue_depth;
+    async_read_t * reads;
+
+    /* Reads not in use, only used by the submitting thread */
+    int * free_reads;
+    int num_free;
+
+#ifdef MLVL_HAVE_IO_URING
+    int use_uring;
+    uring_t ring;
+
+    /* Chunk files, registered with io_uring so they are not looked up for
+     * each read (fixed files), a read's fixed file is its chunk's number */
+    int fds[MLV_MAX_NUM_CHUNKS];
+    int num_fds;
+    int files_registered;
+
+    /* Registered buffer (mlv_DataSourceRegisterReadBuffer), reads in to it
+     * skip mapping the memory for each read */
+    uint8_t * buffer;
+    uint64_t buffer_size;
+#endif
+
+    /* Thread pool. Queued and done reads are ring buffers of read numbers.
+     * Threads read with the chunks' reader. */
+    mlv_Reader chunk_reader;
+    pthread_t threads[MLVL_MAX_ASYNC_THREADS];
+    int num_threads;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t read_queued;
+    pthread_cond_t read_done;
+    int * queued;
+    int first_queued;
+    int num_queued;
+    int * done;
+    int first_done;
+    int num_done;
+} async_reader_t;
+
+#ifdef MLVL_HAVE_IO_URING
+
+static int uring_setup(uring_t * Ring, unsigned NumEntries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    Ring->fd = syscall(__NR_io_uring_setup, NumEntries, &params);
+    if (Ring->fd < 0) return 0;
+
+    Ring->num_entries = params.sq_entries;
+    Ring->to_submit = 0;
+    Ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    Ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    Ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Both rings can be in one mapping */
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (Ring->cq_ring_size > Ring->sq_ring_size) Ring->sq_ring_size = Ring->cq_ring_size;
+        Ring->cq_ring_size = 0;
+    }
+
+    Ring->sq_ring = mmap(NULL, Ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring->fd, IORING_OFF_SQ_RING);
+    Ring->cq_ring = Ring->sq_ring;
+    if (Ring->sq_ring != MAP_FAILED && Ring->cq_ring_size > 0)
+        Ring->cq_ring = mmap(NULL, Ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring->fd, IORING_OFF_CQ_RING);
+    Ring->sqes = mmap(NULL, Ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring->fd, IORING_OFF_SQES);
+
+    if (Ring->sq_ring == MAP_FAILED || Ring->cq_ring == MAP_FAILED || Ring->sqes == MAP_FAILED)
+    {
+        if (Ring->sqes != MAP_FAILED) munmap(Ring->sqes, Ring->sqes_size);
+        if (Ring->cq_ring != MAP_FAILED && Ring->cq_ring_size > 0) munmap(Ring->cq_ring, Ring->cq_ring_size);
+        if (Ring->sq_ring != MAP_FAILED) munmap(Ring->sq_ring, Ring->sq_ring_size);
+        close(Ring->fd);
+        return 0;
+    }
+
+    uint8_t * sq = Ring->sq_ring;
+    Ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    Ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    Ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    Ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    uint8_t * cq = Ring->cq_ring;
+    Ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    Ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    Ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    Ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 1;
+}
+
+static int uring_register(uring_t * Ring, unsigned Opcode, void * Arg, unsigned NumArgs)
+{
+    int result;
+    do result = syscall(__NR_io_uring_register, Ring->fd, Opcode, Arg, NumArgs);
+    while (result < 0 && errno == EINTR);
+    return result >= 0;
+}
+
+static void uring_close(uring_t * Ring)
+{
+    munmap(Ring->sqes, Ring->sqes_size);
+    if (Ring->cq_ring_size > 0) munmap(Ring->cq_ring, Ring->cq_ring_size);
+    munmap(Ring->sq_ring, Ring->sq_ring_size);
+    close(Ring->fd);
+}
+
+/* Submits queued reads, and waits for MinComplete reads to finish */
+static int uring_enter(uring_t * Ring, unsigned MinComplete)
+{
+    while (1)
+    {
+        unsigned flags = (MinComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+        int result = syscall(__NR_io_uring_enter, Ring->fd, Ring->to_submit, MinComplete, flags, NULL, 0);
+
+        if (result >= 0)
+        {
+            Ring->to_submit -= result;
+            if (Ring->to_submit == 0 || MinComplete > 0) return 1;
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return 0;
+    }
+}
+
+/* Queues the rest of a read, the kernel gets it on the next uring_enter */
+static int uring_queue_read(async_reader_t * Reader, async_read_t * Read, uint64_t ReadNumber)
+{
+    uring_t * Ring = &Reader->ring;
+    unsigned tail = *Ring->sq_tail;
+
+    /* Submission queue full (it is as big as the reader's queue depth, so
+     * only if the kernel has not taken them yet) */
+    if (tail - __atomic_load_n(Ring->sq_head, __ATOMIC_ACQUIRE) >= Ring->num_entries)
+        if (!uring_enter(Ring, 0)) return 0;
+
+    unsigned index = tail & *Ring->sq_mask;
+    struct io_uring_sqe * sqe = Ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    uint8_t * out = Read->out + Read->bytes_read;
+    uint64_t bytes = Read->bytes - Read->bytes_read;
+
+    if (Reader->buffer != NULL && out >= Reader->buffer && bytes <= (uint64_t)(Reader->buffer + Reader->buffer_size - out))
+    {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uintptr_t)out;
+        sqe->len = bytes;
+        sqe->buf_index = 0;
+    }
+    else
+    {
+        /* READV rather than READ, for older kernels */
+        Read->iov.iov_base = out;
+        Read->iov.iov_len = bytes;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uintptr_t)&Read->iov;
+        sqe->len = 1;
+    }
+
+    sqe->fd = UD_TO_FD(Read->chunk_ud);
+    if (Reader->files_registered)
+    {
+        for (int f = 0; f < Reader->num_fds; ++f)
+        {
+            if (Reader->fds[f] == sqe->fd)
+            {
+                sqe->fd = f;
+                sqe->flags |= IOSQE_FIXED_FILE;
+                break;
+            }
+        }
+    }
+
+    sqe->off = Read->pos + Read->bytes_read;
+    sqe->user_data = ReadNumber;
+
+    Ring->sq_array[index] = index;
+    __atomic_store_n(Ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    Ring->to_submit++;
+
+    return 1;
+}
+
+/* Outputs up to MaxReads finished reads' numbers, reads that were cut short
+ * are queued again for the rest */
+static int uring_reap(async_reader_t * Reader, int MaxReads, int * ReadsOut)
+{
+    uring_t * Ring = &Reader->ring;
+    int num_reads = 0;
+    unsigned head = *Ring->cq_head;
+
+    while (num_reads < MaxReads && head != __atomic_load_n(Ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe * cqe = Ring->cqes + (head & *Ring->cq_mask);
+        int read_number = cqe->user_data;
+        int result = cqe->res;
+        __atomic_store_n(Ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+        async_read_t * read = Reader->reads + read_number;
+        if (result > 0) read->bytes_read += result;
+
+        int retry = (result == -EINTR || result == -EAGAIN || (result > 0 && read->bytes_read < read->bytes));
+        if (!retry || !uring_queue_read(Reader, read, read_number))
+            ReadsOut[num_reads++] = read_number;
+    }
+
+    return num_reads;
+}
+
+#endif
+
+static void * async_read_thread(void * Arg)
+{
+    async_reader_t * reader = Arg;
+
+    pthread_mutex_lock(&reader->mutex);
+
+    while (1)
+    {
+        while (!reader->stop && reader->num_queued == 0)
+            pthread_cond_wait(&reader->read_queued, &reader->mutex);
+
+        if (reader->stop) break;
+
+        int read_number = reader->queued[reader->first_queued];
+        reader->first_queued = (reader->first_queued + 1) % reader->queue_depth;
+        reader->num_queued--;
+
+        pthread_mutex_unlock(&reader->mutex);
+
+        async_read_t * read = reader->reads + read_number;
+        read->bytes_read = reader->chunk_reader(read->chunk_ud, read->pos, read->bytes, read->out);
+
+        pthread_mutex_lock(&reader->mutex);
+
+        reader->done[(reader->first_done + reader->num_done) % reader->queue_depth] = read_number;
+        reader->num_done++;
+        pthread_cond_signal(&reader->read_done);
+    }
+
+    pthread_mutex_unlock(&reader->mutex);
+
+    return NULL;
+}
+
+static int mlv_async_submit(void * ud, void * chunk_ud, uint64_t pos, uint64_t bytes, void * out, uint64_t tag)
+{
+    async_reader_t * reader = ud;
+    if (reader->num_free == 0 || bytes > MLVL_MAX_ASYNC_READ) return 0;
+
+    int read_number = reader->free_reads[--reader->num_free];
+    async_read_t * read = reader->reads + read_number;
+    read->chunk_ud = chunk_ud;
+    read->pos = pos;
+    read->bytes = bytes;
+    read->bytes_read = 0;
+    read->out = out;
+    read->tag = tag;
+
+#ifdef MLVL_HAVE_IO_URING
+    if (reader->use_uring)
+    {
+        if (uring_queue_read(reader, read, read_number)) return 1;
+        reader->num_free++;
+        return 0;
+    }
+#endif
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->queued[(reader->first_queued + reader->num_queued) % reader->queue_depth] = read_number;
+    reader->num_queued++;
+    pthread_cond_signal(&reader->read_queued);
+    pthread_mutex_unlock(&reader->mutex);
+
+    return 1;
+}
+
+static int mlv_async_complete(void * ud, int min_reads, int max_reads, uint64_t * tags_out, uint64_t * bytes_read_out)
+{
+    async_reader_t * reader = ud;
+    int read_numbers[MLVL_MAX_QUEUE_DEPTH];
+    int num_reads = 0;
+
+    if (max_reads > reader->queue_depth) max_reads = reader->queue_depth;
+    if (min_reads > max_reads) min_reads = max_reads;
+
+#ifdef MLVL_HAVE_IO_URING
+    if (reader->use_uring)
+    {
+        uring_t * ring = &reader->ring;
+        if (ring->to_submit > 0) uring_enter(ring, 0);
+
+        num_reads = uring_reap(reader, max_reads, read_numbers);
+        while (num_reads < min_reads)
+        {
+            if (!uring_enter(ring, 1)) break;
+            num_reads += uring_reap(reader, max_reads - num_reads, read_numbers + num_reads);
+        }
+    }
+    else
+#endif
+    {
+        pthread_mutex_lock(&reader->mutex);
+
+        while (reader->num_done < min_reads)
+            pthread_cond_wait(&reader->read_done, &reader->mutex);
+
+        while (num_reads < max_reads && reader->num_done > 0)
+        {
+            read_numbers[num_reads++] = reader->done[reader->first_done];
+            reader->first_done = (reader->first_done + 1) % reader->queue_depth;
+            reader->num_done--;
+        }
+
+        pthread_mutex_unlock(&reader->mutex);
+    }
+
+    for (int r = 0; r < num_reads; ++r)
+    {
+        async_read_t * read = reader->reads + read_numbers[r];
+        tags_out[r] = read->tag;
+        bytes_read_out[r] = read->bytes_read;
+        reader->free_reads[reader->num_free++] = read_numbers[r];
+    }
+
+    return num_reads;
+}
+
+static int mlv_async_register_buffer(void * ud, void * buffer, uint64_t size)
+{
+#ifdef MLVL_HAVE_IO_URING
+    async_reader_t * reader = ud;
+    if (!reader->use_uring) return 0;
+
+    if (reader->buffer != NULL)
+    {
+        uring_register(&reader->ring, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        reader->buffer = NULL;
+        reader->buffer_size = 0;
+    }
+
+    if (buffer == NULL) return 1;
+
+    /* The kernel takes at most 1 GiB, bigger buffers are read in to as
+     * normal past that */
+    if (size > ((uint64_t)1 << 30)) size = (uint64_t)1 << 30;
+
+    struct iovec iov = {buffer, size};
+    if (!uring_register(&reader->ring, IORING_REGISTER_BUFFERS, &iov, 1)) return 0;
+
+    reader->buffer = buffer;
+    reader->buffer_size = size;
+    return 1;
+#else
+    (void)ud; (void)buffer; (void)size;
+    return 0;
+#endif
+}
+
+static void mlv_async_close(void * ud)
+{
+    async_reader_t * reader = ud;
+
+#ifdef MLVL_HAVE_IO_URING
+    if (reader->use_uring) uring_close(&reader->ring);
+#endif
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->stop = 1;
+    pthread_cond_broadcast(&reader->read_queued);
+    pthread_mutex_unlock(&reader->mutex);
+
+    for (int t = 0; t < reader->num_threads; ++t) pthread_join(reader->threads[t], NULL);
+
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->read_queued);
+    pthread_cond_destroy(&reader->read_done);
+
+    free(reader->reads);
+    free(reader->free_reads);
+    free(reader->queued);
+    free(reader->done);
+    free(reader);
+}
+
+/* With the chunks opened for MLVL_ACCESS_DIRECT (Direct is non-zero) reads
+ * are done on threads by mlv_direct_reader, as io_uring would need every
+ * read to be aligned */
+static async_reader_t * new_async_reader(int QueueDepth, int * FDs, int NumFDs, int Direct)
+{
+    if (QueueDepth > MLVL_MAX_QUEUE_DEPTH) QueueDepth = MLVL_MAX_QUEUE_DEPTH;
+
+    async_reader_t * reader = calloc(1, sizeof(async_reader_t));
+    if (reader == NULL) return NULL;
+
+    reader->queue_depth = QueueDepth;
+    reader->chunk_reader = Direct ? mlv_direct_reader : mlv_posix_reader;
+    reader->reads = calloc(QueueDepth, sizeof(async_read_t));
+    reader->free_reads = malloc(QueueDepth * sizeof(int));
+    reader->queued = malloc(QueueDepth * sizeof(int));
+    reader->done = malloc(QueueDepth * sizeof(int));
+
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->read_queued, NULL);
+    pthread_cond_init(&reader->read_done, NULL);
+
+    if (reader->reads == NULL || reader->free_reads == NULL || reader->queued == NULL || reader->done == NULL)
+    {
+        mlv_async_close(reader);
+        return NULL;
+    }
+
+    for (int r = 0; r < QueueDepth; ++r) reader->free_reads[r] = QueueDepth - 1 - r;
+    reader->num_free = QueueDepth;
+
+#ifdef MLVL_HAVE_IO_URING
+    reader->use_uring = !Direct && uring_setup(&reader->ring, QueueDepth);
+    if (reader->use_uring)
+    {
+        for (int f = 0; f < NumFDs; ++f) reader->fds[f] = FDs[f];
+        reader->num_fds = NumFDs;
+        reader->files_registered = uring_register(&reader->ring, IORING_REGISTER_FILES, reader->fds, NumFDs);
+        return reader;
+    }
+#else
+    (void)FDs; (void)NumFDs;
+#endif
+
+    int num_threads = (QueueDepth < MLVL_MAX_ASYNC_THREADS) ? QueueDepth : MLVL_MAX_ASYNC_THREADS;
+    while (reader->num_threads < num_threads && pthread_create(&reader->threads[reader->num_threads], NULL, async_read_thread, reader) == 0)
+        reader->num_threads++;
+
+    if (reader->num_threads == 0)
+    {
+        mlv_async_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+#endif
+
+#endif
+
+mlv_DataSource * mlvL_newDataSourcePOSIX(char * MainChunkFileName,
+                                         int SearchForAdditionalChunks,
+                                         int AccessPattern)
+{
+#ifdef MLVL_HAVE_POSIX
+    mlv_DataSource * datasource = NULL;
+    char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
+    int num_chunks = find_chunk_files(MainChunkFileName, SearchForAdditionalChunks, file_names);
+
+    if (num_chunks > 0)
+    {
+        datasource = new_posix_data_source(file_names, num_chunks, SearchForAdditionalChunks, AccessPattern, NULL);
+        free_chunk_file_names(file_names, num_chunks);
+    }
+
+    return datasource;
+#else
+    return mlvL_newDataSource(MainChunkFileName, SearchForAdditionalChunks);
+#endif
+}
+
+mlv_DataSource * mlvL_newDataSourceMMAP(char * MainChunkFileName,
+                                        int SearchForAdditionalChunks)
+{
+#ifdef MLVL_HAVE_POSIX
+    mlv_DataSource * datasource = NULL;
+    char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
+    int num_chunks = find_chunk_files(MainChunkFileName, SearchForAdditionalChunks, file_names);
+
+    if (num_chunks > 0)
+    {
+        datasource = new_mmap_data_source(file_names, num_chunks);
+        free_chunk_file_names(file_names, num_chunks);
+    }
+
+    return datasource;
+#else
+    return mlvL_newDataSource(MainChunkFileName, SearchForAdditionalChunks);
+#endif
+}
+
+mlv_DataSource * mlvL_newDataSourceAsync(char * MainChunkFileName,
+                                         int SearchForAdditionalChunks,
+                                         int AccessPattern,
+                                         int QueueDepth)
+{
+#ifdef MLVL_HAVE_ASYNC
+    mlv_DataSource * datasource = NULL;
+    char * file_names[MLV_MAX_NUM_CHUNKS] = {NULL};
+    int fds[MLV_MAX_NUM_CHUNKS];
+    int num_chunks = find_chunk_files(MainChunkFileName, SearchForAdditionalChunks, file_names);
+
+    if (num_chunks > 0)
+    {
+        datasource = new_posix_data_source(file_names, num_chunks, SearchForAdditionalChunks, AccessPattern, fds);
+        free_chunk_file_names(file_names, num_chunks);
+    }
+
+    async_reader_t * reader = (datasource != NULL && QueueDepth > 0) ? new_async_reader(QueueDepth, fds, num_chunks, AccessPattern & MLVL_ACCESS_DIRECT) : NULL;
+    if (reader != NULL)
+    {
+        mlv_DataSourceSetAsyncReader(datasource, mlv_async_submit, mlv_async_complete, mlv_async_close, reader);
+        mlv_DataSourceSetAsyncRegisterBuffer(datasource, mlv_async_register_buffer);
+    }
+
+    return datasource;
+#else
+    (void)QueueDepth;
+    return mlvL_newDataSourcePOSIX(MainChunkFileName, SearchForAdditionalChunks, AccessPattern);
+#endif
+}
+
+int mlvL_IndexSave(mlv_Index * Index,
+                   mlv_DataSource * DataSource,
+                   char * IndexFileName)
+{
+    FILE * file = fopen(IndexFileName, "wb");
+    if (file == NULL) return 0;
+
+    int success = mlv_IndexSave(Index, DataSource, mlv_writer, file);
+
+    if (fclose(file) != 0) success = 0;
+    if (!success) remove(IndexFileName);
+    return success;
+}
+
+int mlvL_IndexLoad(mlv_Index * Index,
+                   mlv_DataSource * DataSource,
+                   char * IndexFileName)
+{
+    FILE * file = fopen(IndexFileName, "rb");
+    if (file == NULL) return 0;
+
+    int success = mlv_IndexLoad(Index, DataSource, mlv_reader, file);
+
+    fclose(file);
+    return success;
+}
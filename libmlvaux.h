@@ -7,10 +7,65 @@ mlv_Index * mlvL_newIndex();
 
 mlv_FrameExtractor * mlvL_newFrameExtractor();
 
+mlv_FrameCache * mlvL_newFrameCache(uint64_t MemoryBudget);
+
+/* All data sources below except mlvL_newDataSourceMMAP can be refreshed
+ * (mlv_DataSourceRefresh) for clips that are still being written, the chunk
+ * files are looked at again for their new sizes, and for new chunks if
+ * SearchForAdditionalChunks was set. */
+
 mlv_DataSource * mlvL_newDataSource(char * MainChunkFileName,
                                     int SearchForAdditionalChunks);
 
 mlv_DataSource * mlvL_newDataSourceFromChunks(char ** ChunkFileNames,
                                               int NumFiles);
 
+/* How a data source is going to be read, for the operating system to optimise
+ * caching and read-ahead */
+#define MLVL_ACCESS_NORMAL 0
+#define MLVL_ACCESS_SEQUENTIAL 1 /* Such as playback or exporting */
+#define MLVL_ACCESS_RANDOM 2 /* Such as seeking around the clip */
+
+/* Can be OR'd with one of the above. Large reads (such as frames) bypass the
+ * page cache with O_DIRECT, so that streaming through a lot of footage does
+ * not evict everything else from it. Small reads (such as block headers read
+ * by mlv_IndexBuild) are still cached. */
+#define MLVL_ACCESS_DIRECT 4
+
+/* Data source using file descriptors and pread, which is thread-safe without
+ * locking and reads straight in to the output. AccessPattern is one of
+ * MLVL_ACCESS_... On systems without POSIX, same as mlvL_newDataSource. */
+mlv_DataSource * mlvL_newDataSourcePOSIX(char * MainChunkFileName,
+                                         int SearchForAdditionalChunks,
+                                         int AccessPattern);
+
+/* Same as mlvL_newDataSourcePOSIX, with an asynchronous reader that can have
+ * QueueDepth reads outstanding at once (see mlv_DataSourceSubmitRead), which
+ * uses io_uring on Linux, otherwise a pool of threads. 16 to 64 keeps an NVMe
+ * drive busy. With io_uring the chunk files are registered (fixed files), as
+ * are buffers from mlv_DataSourceRegisterReadBuffer, such as the one used by
+ * mlv_IndexReadBlocks. Without POSIX or threads there is no asynchronous
+ * reader. With MLVL_ACCESS_DIRECT threads are used rather than io_uring. */
+mlv_DataSource * mlvL_newDataSourceAsync(char * MainChunkFileName,
+                                         int SearchForAdditionalChunks,
+                                         int AccessPattern,
+                                         int QueueDepth);
+
+/* Data source that memory maps the chunk files, so their data can be used
+ * straight from the mapping without copying (mlv_DataSourceGetDataPointer).
+ * Thread-safe. Chunks are mapped at the size they were when opened, so it can't
+ * be refreshed. On systems without POSIX, same as mlvL_newDataSource. */
+mlv_DataSource * mlvL_newDataSourceMMAP(char * MainChunkFileName,
+                                        int SearchForAdditionalChunks);
+
+/* Save or load index to/from a file, such as "clip.IDX". Loading returns zero
+ * if the file doesn't exist or no longer matches the clip. */
+int mlvL_IndexSave(mlv_Index * Index,
+                   mlv_DataSource * DataSource,
+                   char * IndexFileName);
+
+int mlvL_IndexLoad(mlv_Index * Index,
+                   mlv_DataSource * DataSource,
+                   char * IndexFileName);
+
 #endif
\ No newline at end of file
@@ -3,18 +3,47 @@
 typedef struct
 {
     uint64_t size;
+    uint64_t modification_time;
+    void * pointer; /* If the whole chunk is in memory, pointer to it */
     void * ud;
     mlv_Reader reader;
     mlv_Close closer;
 }
 mlv_DataSource_Chunk;
 
+/* A read done synchronously by mlv_DataSourceSubmitRead */
+typedef struct
+{
+    uint64_t tag;
+    uint64_t bytes_read;
+}
+mlv_DataSource_FinishedRead;
+
 struct mlv_DataSource
 {
     uint8_t num_chunks;
+    uint8_t thread_safe;
     mlv_Reader reader;
     mlv_Close closer;
     mlv_DataSource_Chunk * chunks;
+
+    mlv_AsyncSubmit async_submit;
+    mlv_AsyncComplete async_complete;
+    mlv_Close async_closer;
+    mlv_AsyncRegisterBuffer async_register_buffer;
+    void * async_ud;
+    int async_outstanding;
+
+    mlv_Refresher refresher;
+    mlv_Close refresher_closer;
+    void * refresher_ud;
+
+    /* Reads that were done synchronously, waiting to be completed. A ring of
+     * finished_space, num_finished of them starting at first_finished. */
+    mlv_DataSource_FinishedRead * finished;
+    int first_finished;
+    int num_finished;
+    int finished_space;
 };
 
 mlv_DataSource * mlv_newDataSource(mlv_Alloc Allocator, void * AllocatorUD)
@@ -22,13 +51,33 @@ mlv_DataSource * mlv_newDataSource(mlv_Alloc Allocator, void * AllocatorUD)
     mlv_DataSource * data_source = mlv_Malloc(Allocator, AllocatorUD, sizeof(mlv_DataSource));
 
     data_source->num_chunks = 1;
+    data_source->thread_safe = 0;
+    data_source->reader = NULL;
+    data_source->closer = NULL;
     data_source->chunks = mlv_Malloc2(data_source, sizeof(mlv_DataSource_Chunk));
+    data_source->async_submit = NULL;
+    data_source->async_complete = NULL;
+    data_source->async_closer = NULL;
+    data_source->async_register_buffer = NULL;
+    data_source->async_ud = NULL;
+    data_source->async_outstanding = 0;
+    data_source->refresher = NULL;
+    data_source->refresher_closer = NULL;
+    data_source->refresher_ud = NULL;
+    data_source->finished = mlv_Malloc2(data_source, 0);
+    data_source->first_finished = 0;
+    data_source->num_finished = 0;
+    data_source->finished_space = 0;
 
     return data_source;
 }
 
 void mlv_closeDataSource(mlv_DataSource * DataSource)
 {
+    if (DataSource->async_closer != NULL) DataSource->async_closer(DataSource->async_ud);
+    if (DataSource->refresher_closer != NULL) DataSource->refresher_closer(DataSource->refresher_ud);
+    if (DataSource->finished != NULL) mlv_Free(DataSource->finished);
+
     for (int i = 0; i < DataSource->num_chunks; ++i)
     {
         mlv_DataSource_Chunk * chunk = DataSource->chunks + i;
@@ -59,10 +108,44 @@ void mlv_DataSourceSetChunk(mlv_DataSource * DataSource,
 {
     DataSource->chunks[Chunk].ud = Data;
     DataSource->chunks[Chunk].size = Size;
+    DataSource->chunks[Chunk].modification_time = 0;
+    DataSource->chunks[Chunk].pointer = NULL;
     DataSource->chunks[Chunk].reader = Reader;
     DataSource->chunks[Chunk].closer = Closer;
 }
 
+void mlv_DataSourceSetThreadSafe(mlv_DataSource * DataSource, int IsThreadSafe)
+{
+    DataSource->thread_safe = (IsThreadSafe != 0);
+}
+
+int mlv_DataSourceIsThreadSafe(mlv_DataSource * DataSource)
+{
+    return DataSource->thread_safe;
+}
+
+void mlv_DataSourceSetChunkModificationTime(mlv_DataSource * DataSource, int Chunk, uint64_t Time)
+{
+    DataSource->chunks[Chunk].modification_time = Time;
+}
+
+uint64_t mlv_DataSourceGetChunkModificationTime(mlv_DataSource * DataSource, int Chunk)
+{
+    if (Chunk < DataSource->num_chunks)
+    {
+        return DataSource->chunks[Chunk].modification_time;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+void mlv_DataSourceSetChunkPointer(mlv_DataSource * DataSource, int Chunk, void * Pointer)
+{
+    DataSource->chunks[Chunk].pointer = Pointer;
+}
+
 void mlv_DataSourceSetChunkCount(mlv_DataSource * DataSource, int ChunkCount)
 {
     DataSource->chunks = mlv_Realloc(DataSource->chunks, sizeof(mlv_DataSource_Chunk) * ChunkCount);
@@ -86,6 +169,27 @@ uint64_t mlv_DataSourceGetChunkSize(mlv_DataSource * DataSource, int Chunk)
     }
 }
 
+void mlv_DataSourceSetChunkSize(mlv_DataSource * DataSource, int Chunk, uint64_t Size)
+{
+    DataSource->chunks[Chunk].size = Size;
+}
+
+void mlv_DataSourceSetRefresher(mlv_DataSource * DataSource,
+                                mlv_Refresher Refresher,
+                                mlv_Close Closer,
+                                void * RefresherUD)
+{
+    DataSource->refresher = Refresher;
+    DataSource->refresher_closer = Closer;
+    DataSource->refresher_ud = RefresherUD;
+}
+
+int mlv_DataSourceRefresh(mlv_DataSource * DataSource)
+{
+    if (DataSource->refresher == NULL) return 0;
+    return DataSource->refresher(DataSource->refresher_ud, DataSource);
+}
+
 uint64_t mlv_DataSourceGetData(mlv_DataSource * DataSource,
                                int Chunk,
                                uint64_t Pos,
@@ -101,4 +205,177 @@ uint64_t mlv_DataSourceGetData(mlv_DataSource * DataSource,
     } else {
         return 0;
     }
-}
\ No newline at end of file
+}
+
+void * mlv_DataSourceGetDataPointer(mlv_DataSource * DataSource,
+                                    int Chunk,
+                                    uint64_t Pos,
+                                    uint64_t Bytes)
+{
+    if (Chunk >= DataSource->num_chunks) return NULL;
+
+    mlv_DataSource_Chunk * chunk = DataSource->chunks + Chunk;
+
+    if (chunk->pointer != NULL && Pos <= chunk->size && Bytes <= (chunk->size - Pos))
+    {
+        return (uint8_t *)chunk->pointer + Pos;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+void mlv_DataSourceSetAsyncReader(mlv_DataSource * DataSource,
+                                  mlv_AsyncSubmit Submit,
+                                  mlv_AsyncComplete Complete,
+                                  mlv_Close Closer,
+                                  void * AsyncUD)
+{
+    DataSource->async_submit = Submit;
+    DataSource->async_complete = Complete;
+    DataSource->async_closer = Closer;
+    DataSource->async_ud = AsyncUD;
+}
+
+int mlv_DataSourceHasAsyncReader(mlv_DataSource * DataSource)
+{
+    return DataSource->async_submit != NULL && DataSource->async_complete != NULL;
+}
+
+void mlv_DataSourceSetAsyncRegisterBuffer(mlv_DataSource * DataSource,
+                                          mlv_AsyncRegisterBuffer RegisterBuffer)
+{
+    DataSource->async_register_buffer = RegisterBuffer;
+}
+
+int mlv_DataSourceRegisterReadBuffer(mlv_DataSource * DataSource,
+                                     void * Buffer,
+                                     uint64_t Size)
+{
+    if (!mlv_DataSourceHasAsyncReader(DataSource) || DataSource->async_register_buffer == NULL)
+        return 0;
+
+    return DataSource->async_register_buffer(DataSource->async_ud, Buffer, Size);
+}
+
+/* Queues a read that has already been done, to be completed. Returns where
+ * it was queued, or NULL if there wasn't memory. */
+static mlv_DataSource_FinishedRead * add_finished_read(mlv_DataSource * DataSource, uint64_t Tag, uint64_t BytesRead)
+{
+    if (DataSource->finished == NULL) return NULL;
+
+    if (DataSource->num_finished == DataSource->finished_space)
+    {
+        int old_space = DataSource->finished_space;
+        int space = (old_space > 0) ? old_space * 2 : 16;
+        mlv_DataSource_FinishedRead * finished = mlv_Realloc(DataSource->finished, sizeof(mlv_DataSource_FinishedRead) * space);
+        if (finished == NULL) return NULL;
+
+        /* The ring is full, so the part that wrapped round to the start goes
+         * on after the rest (there is now room for it) */
+        for (int i = 0; i < DataSource->first_finished; ++i)
+            finished[old_space + i] = finished[i];
+
+        DataSource->finished = finished;
+        DataSource->finished_space = space;
+    }
+
+    int index = (DataSource->first_finished + DataSource->num_finished) % DataSource->finished_space;
+    mlv_DataSource_FinishedRead * read = DataSource->finished + index;
+    read->tag = Tag;
+    read->bytes_read = BytesRead;
+    DataSource->num_finished++;
+
+    return read;
+}
+
+int mlv_DataSourceSubmitRead(mlv_DataSource * DataSource,
+                             int Chunk,
+                             uint64_t Pos,
+                             uint64_t Bytes,
+                             void * Out,
+                             uint64_t Tag)
+{
+    if (Chunk < 0 || Chunk >= DataSource->num_chunks) return 0;
+
+    mlv_DataSource_Chunk * chunk = DataSource->chunks + Chunk;
+
+    /* Data in memory is quicker to copy than to go through the reader */
+    uint8_t * pointer = mlv_DataSourceGetDataPointer(DataSource, Chunk, Pos, Bytes);
+
+    if ( pointer == NULL && mlv_DataSourceHasAsyncReader(DataSource)
+      && DataSource->async_submit(DataSource->async_ud, chunk->ud, Pos, Bytes, Out, Tag) )
+    {
+        DataSource->async_outstanding++;
+        return 1;
+    }
+
+    /* Make sure it can be queued before reading */
+    mlv_DataSource_FinishedRead * read = add_finished_read(DataSource, Tag, 0);
+    if (read == NULL) return 0;
+
+    uint64_t bytes_read;
+    if (pointer != NULL)
+    {
+        for (uint64_t i = 0; i < Bytes; ++i) ((uint8_t *)Out)[i] = pointer[i];
+        bytes_read = Bytes;
+    }
+    else
+    {
+        bytes_read = mlv_DataSourceGetData(DataSource, Chunk, Pos, Bytes, Out);
+    }
+
+    read->bytes_read = bytes_read;
+
+    return 1;
+}
+
+int mlv_DataSourceCompleteReads(mlv_DataSource * DataSource,
+                                int MinReads,
+                                int MaxReads,
+                                uint64_t * TagsOut,
+                                uint64_t * BytesReadOut)
+{
+    int num_reads = 0;
+
+    while (num_reads < MaxReads && DataSource->num_finished > 0)
+    {
+        mlv_DataSource_FinishedRead * read = DataSource->finished + DataSource->first_finished;
+        DataSource->first_finished = (DataSource->first_finished + 1) % DataSource->finished_space;
+        DataSource->num_finished--;
+        TagsOut[num_reads] = read->tag;
+        BytesReadOut[num_reads] = read->bytes_read;
+        num_reads++;
+    }
+
+    if (num_reads < MaxReads && DataSource->async_outstanding > 0)
+    {
+        int min_reads = MinReads - num_reads;
+        if (min_reads > DataSource->async_outstanding) min_reads = DataSource->async_outstanding;
+        if (min_reads < 0) min_reads = 0;
+
+        int completed = DataSource->async_complete(DataSource->async_ud, min_reads, MaxReads - num_reads,
+                                                   TagsOut + num_reads, BytesReadOut + num_reads);
+        if (completed > 0)
+        {
+            DataSource->async_outstanding -= completed;
+            num_reads += completed;
+        }
+    }
+
+    return num_reads;
+}
+
+int mlv_DataSourcePollReads(mlv_DataSource * DataSource,
+                            int MaxReads,
+                            uint64_t * TagsOut,
+                            uint64_t * BytesReadOut)
+{
+    return mlv_DataSourceCompleteReads(DataSource, 0, MaxReads, TagsOut, BytesReadOut);
+}
+
+int mlv_DataSourceGetNumOutstandingReads(mlv_DataSource * DataSource)
+{
+    return DataSource->async_outstanding + DataSource->num_finished;
+}
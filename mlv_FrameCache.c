@@ -0,0 +1,383 @@
+#include "libmlv.h"
+
+#ifndef LIBMLV_NO_THREADS
+#include <pthread.h>
+#define LOCK_CACHE(Cache) pthread_mutex_lock(&(Cache)->mutex)
+#define UNLOCK_CACHE(Cache) pthread_mutex_unlock(&(Cache)->mutex)
+#else
+#define LOCK_CACHE(Cache) ((void)(Cache))
+#define UNLOCK_CACHE(Cache) ((void)(Cache))
+#endif
+
+/* Frames are stored straight after their entry, this far from its start.
+ * Allocations are only as aligned as the allocator makes them (and
+ * mlv_Malloc's header), so the entry is placed in its allocation such that
+ * the frame starts at a multiple of this, for vector loads. */
+#define FRAME_ALIGNMENT 32
+#define ENTRY_DATA_OFFSET ((sizeof(frame_cache_entry_t) + FRAME_ALIGNMENT - 1) & ~(uint64_t)(FRAME_ALIGNMENT - 1))
+
+/* Hash table starts with this many buckets, and doubles when there are more
+ * frames than buckets */
+#define INITIAL_NUM_BUCKETS 64
+
+typedef struct frame_cache_entry_t frame_cache_entry_t;
+
+struct frame_cache_entry_t
+{
+    /* Key */
+    mlv_Index * index;
+    uint64_t frame_number;
+
+    int width;
+    int height;
+    int bitdepth;
+    uint64_t data_size;
+
+    /* Frames handed out by mlv_FrameCacheGet that have not been released yet.
+     * A pinned frame is not evicted, and if it is removed (mlv_FrameCacheClear)
+     * it is only freed once released. */
+    int pins;
+    int removed;
+
+    /* The allocation the entry is in, which it may not be at the start of */
+    void * memory;
+
+    frame_cache_entry_t * hash_next;
+
+    /* Least recently used frame is last */
+    frame_cache_entry_t * lru_prev;
+    frame_cache_entry_t * lru_next;
+};
+
+struct mlv_FrameCache
+{
+    uint64_t budget;
+    uint64_t size;
+    uint64_t num_frames;
+
+    frame_cache_entry_t ** buckets;
+    uint64_t num_buckets;
+
+    frame_cache_entry_t * lru_first;
+    frame_cache_entry_t * lru_last;
+
+    uint64_t hits;
+    uint64_t misses;
+
+    /* Goes up with every mlv_FrameCacheClear, so that frames being copied in
+     * by mlv_FrameCachePut at the time are not added after it */
+    uint64_t generation;
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_t mutex;
+#endif
+};
+
+static inline uint16_t * entry_data(frame_cache_entry_t * Entry)
+{
+    return (uint16_t *)((uint8_t *)Entry + ENTRY_DATA_OFFSET);
+}
+
+static inline frame_cache_entry_t * data_entry(uint16_t * Data)
+{
+    return (frame_cache_entry_t *)((uint8_t *)Data - ENTRY_DATA_OFFSET);
+}
+
+/* How much of the budget a frame uses */
+static inline uint64_t entry_size(frame_cache_entry_t * Entry)
+{
+    return ENTRY_DATA_OFFSET + FRAME_ALIGNMENT + Entry->data_size;
+}
+
+/* Allocates an entry with space for DataSize bytes of frame, aligned */
+static frame_cache_entry_t * new_entry(mlv_FrameCache * Cache, uint64_t DataSize)
+{
+    uint8_t * memory = mlv_Malloc2(Cache, ENTRY_DATA_OFFSET + FRAME_ALIGNMENT + DataSize);
+    if (memory == NULL) return NULL;
+
+    uintptr_t data = ((uintptr_t)memory + ENTRY_DATA_OFFSET + FRAME_ALIGNMENT - 1) & ~(uintptr_t)(FRAME_ALIGNMENT - 1);
+    frame_cache_entry_t * entry = data_entry((uint16_t *)data);
+    entry->memory = memory;
+    return entry;
+}
+
+static inline uint64_t hash_key(mlv_Index * Index, uint64_t FrameNumber)
+{
+    uint64_t hash = (FrameNumber ^ ((uintptr_t)Index >> 4)) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 32);
+}
+
+mlv_FrameCache * mlv_newFrameCache(mlv_Alloc Allocator, void * AllocatorUD, uint64_t MemoryBudget)
+{
+    mlv_FrameCache * cache = mlv_Malloc(Allocator, AllocatorUD, sizeof(mlv_FrameCache));
+    if (cache == NULL) return NULL;
+
+    cache->buckets = mlv_Malloc2(cache, sizeof(frame_cache_entry_t *) * INITIAL_NUM_BUCKETS);
+    if (cache->buckets == NULL)
+    {
+        mlv_Free(cache);
+        return NULL;
+    }
+
+    cache->budget = MemoryBudget;
+    cache->size = 0;
+    cache->num_frames = 0;
+    cache->num_buckets = INITIAL_NUM_BUCKETS;
+    for (uint64_t b = 0; b < cache->num_buckets; ++b) cache->buckets[b] = NULL;
+    cache->lru_first = NULL;
+    cache->lru_last = NULL;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->generation = 0;
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_init(&cache->mutex, NULL);
+#endif
+
+    return cache;
+}
+
+static void lru_unlink(mlv_FrameCache * Cache, frame_cache_entry_t * Entry)
+{
+    if (Entry->lru_prev != NULL) Entry->lru_prev->lru_next = Entry->lru_next;
+    else Cache->lru_first = Entry->lru_next;
+    if (Entry->lru_next != NULL) Entry->lru_next->lru_prev = Entry->lru_prev;
+    else Cache->lru_last = Entry->lru_prev;
+}
+
+static void lru_push_first(mlv_FrameCache * Cache, frame_cache_entry_t * Entry)
+{
+    Entry->lru_prev = NULL;
+    Entry->lru_next = Cache->lru_first;
+    if (Cache->lru_first != NULL) Cache->lru_first->lru_prev = Entry;
+    else Cache->lru_last = Entry;
+    Cache->lru_first = Entry;
+}
+
+static frame_cache_entry_t ** find_entry(mlv_FrameCache * Cache, mlv_Index * Index, uint64_t FrameNumber)
+{
+    frame_cache_entry_t ** entry = Cache->buckets + (hash_key(Index, FrameNumber) & (Cache->num_buckets - 1));
+
+    while (*entry != NULL && ((*entry)->index != Index || (*entry)->frame_number != FrameNumber))
+        entry = &(*entry)->hash_next;
+
+    return entry;
+}
+
+/* Takes a frame out of the cache, it is freed now if not pinned, otherwise
+ * when it is released */
+static void remove_entry(mlv_FrameCache * Cache, frame_cache_entry_t * Entry)
+{
+    frame_cache_entry_t ** link = find_entry(Cache, Entry->index, Entry->frame_number);
+    *link = Entry->hash_next;
+    lru_unlink(Cache, Entry);
+
+    Cache->size -= entry_size(Entry);
+    Cache->num_frames--;
+
+    if (Entry->pins > 0) Entry->removed = 1;
+    else mlv_Free(Entry->memory);
+}
+
+/* Evicts least recently used frames until Size more bytes fit. Returns zero
+ * if they can't, as the rest are pinned or the budget is too small. */
+static int make_space(mlv_FrameCache * Cache, uint64_t Size)
+{
+    frame_cache_entry_t * entry = Cache->lru_last;
+
+    while (Cache->size + Size > Cache->budget && entry != NULL)
+    {
+        frame_cache_entry_t * prev = entry->lru_prev;
+        if (entry->pins == 0) remove_entry(Cache, entry);
+        entry = prev;
+    }
+
+    return Cache->size + Size <= Cache->budget;
+}
+
+/* Doubles the hash table, if memory can't be had the table stays as it is */
+static void grow_buckets(mlv_FrameCache * Cache)
+{
+    uint64_t num_buckets = Cache->num_buckets * 2;
+    frame_cache_entry_t ** buckets = mlv_Malloc2(Cache, sizeof(frame_cache_entry_t *) * num_buckets);
+    if (buckets == NULL) return;
+
+    for (uint64_t b = 0; b < num_buckets; ++b) buckets[b] = NULL;
+
+    for (uint64_t b = 0; b < Cache->num_buckets; ++b)
+    {
+        frame_cache_entry_t * entry = Cache->buckets[b];
+        while (entry != NULL)
+        {
+            frame_cache_entry_t * next = entry->hash_next;
+            frame_cache_entry_t ** bucket = buckets + (hash_key(entry->index, entry->frame_number) & (num_buckets - 1));
+            entry->hash_next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    mlv_Free(Cache->buckets);
+    Cache->buckets = buckets;
+    Cache->num_buckets = num_buckets;
+}
+
+uint16_t * mlv_FrameCacheGet(mlv_FrameCache * Cache,
+                             mlv_Index * Index,
+                             uint64_t FrameNumber,
+                             int * WidthOut,
+                             int * HeightOut,
+                             int * BitdepthOut)
+{
+    LOCK_CACHE(Cache);
+
+    frame_cache_entry_t * entry = *find_entry(Cache, Index, FrameNumber);
+
+    if (entry == NULL)
+    {
+        Cache->misses++;
+        UNLOCK_CACHE(Cache);
+        return NULL;
+    }
+
+    Cache->hits++;
+    entry->pins++;
+    lru_unlink(Cache, entry);
+    lru_push_first(Cache, entry);
+
+    UNLOCK_CACHE(Cache);
+
+    if (WidthOut != NULL) *WidthOut = entry->width;
+    if (HeightOut != NULL) *HeightOut = entry->height;
+    if (BitdepthOut != NULL) *BitdepthOut = entry->bitdepth;
+
+    return entry_data(entry);
+}
+
+void mlv_FrameCacheRelease(mlv_FrameCache * Cache, uint16_t * Frame)
+{
+    frame_cache_entry_t * entry = data_entry(Frame);
+
+    LOCK_CACHE(Cache);
+
+    if (--entry->pins == 0 && entry->removed) mlv_Free(entry->memory);
+
+    UNLOCK_CACHE(Cache);
+}
+
+int mlv_FrameCachePut(mlv_FrameCache * Cache,
+                      mlv_Index * Index,
+                      uint64_t FrameNumber,
+                      uint16_t * Frame,
+                      int Width,
+                      int Height,
+                      int Bitdepth)
+{
+    uint64_t data_size = (uint64_t)Width * Height * sizeof(uint16_t);
+    uint64_t size = ENTRY_DATA_OFFSET + FRAME_ALIGNMENT + data_size;
+
+    LOCK_CACHE(Cache);
+
+    /* Already there (such as put by another frame extractor) */
+    if (*find_entry(Cache, Index, FrameNumber) != NULL)
+    {
+        UNLOCK_CACHE(Cache);
+        return 1;
+    }
+
+    /* Space is taken from the budget now, but the frame only goes in the
+     * cache once copied, which is done unlocked */
+    frame_cache_entry_t * entry = make_space(Cache, size) ? new_entry(Cache, data_size) : NULL;
+    if (entry != NULL) Cache->size += size;
+    uint64_t generation = Cache->generation;
+
+    UNLOCK_CACHE(Cache);
+
+    if (entry == NULL) return 0;
+
+    entry->index = Index;
+    entry->frame_number = FrameNumber;
+    entry->width = Width;
+    entry->height = Height;
+    entry->bitdepth = Bitdepth;
+    entry->data_size = data_size;
+    entry->pins = 0;
+    entry->removed = 0;
+
+    uint16_t * data = entry_data(entry);
+    for (uint64_t i = 0; i < data_size / sizeof(uint16_t); ++i) data[i] = Frame[i];
+
+    LOCK_CACHE(Cache);
+
+    frame_cache_entry_t ** bucket = find_entry(Cache, Index, FrameNumber);
+    if (*bucket != NULL || Cache->generation != generation)
+    {
+        /* Put by another thread meanwhile, or the cache was cleared */
+        Cache->size -= size;
+        mlv_Free(entry->memory);
+    }
+    else
+    {
+        entry->hash_next = NULL;
+        *bucket = entry;
+        lru_push_first(Cache, entry);
+        Cache->num_frames++;
+        if (Cache->num_frames > Cache->num_buckets) grow_buckets(Cache);
+    }
+
+    UNLOCK_CACHE(Cache);
+    return 1;
+}
+
+void mlv_FrameCacheClear(mlv_FrameCache * Cache, mlv_Index * Index)
+{
+    LOCK_CACHE(Cache);
+
+    Cache->generation++;
+
+    frame_cache_entry_t * entry = Cache->lru_first;
+    while (entry != NULL)
+    {
+        frame_cache_entry_t * next = entry->lru_next;
+        if (Index == NULL || entry->index == Index) remove_entry(Cache, entry);
+        entry = next;
+    }
+
+    UNLOCK_CACHE(Cache);
+}
+
+void mlv_FrameCacheSetMemoryBudget(mlv_FrameCache * Cache, uint64_t MemoryBudget)
+{
+    LOCK_CACHE(Cache);
+    Cache->budget = MemoryBudget;
+    make_space(Cache, 0);
+    UNLOCK_CACHE(Cache);
+}
+
+uint64_t mlv_FrameCacheGetSize(mlv_FrameCache * Cache)
+{
+    LOCK_CACHE(Cache);
+    uint64_t size = Cache->size;
+    UNLOCK_CACHE(Cache);
+    return size;
+}
+
+void mlv_FrameCacheGetStats(mlv_FrameCache * Cache, uint64_t * HitsOut, uint64_t * MissesOut)
+{
+    LOCK_CACHE(Cache);
+    if (HitsOut != NULL) *HitsOut = Cache->hits;
+    if (MissesOut != NULL) *MissesOut = Cache->misses;
+    UNLOCK_CACHE(Cache);
+}
+
+void mlv_closeFrameCache(mlv_FrameCache * Cache)
+{
+    mlv_FrameCacheClear(Cache, NULL);
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_destroy(&Cache->mutex);
+#endif
+
+    mlv_Free(Cache->buckets);
+    mlv_Free(Cache);
+}
@@ -1,42 +1,1001 @@
 #include "libmlv.h"
 
-struct mlv_FrameExtractor
+#include "old/include/mlv_structs.h"
+#include "old/include/MLVFrameUtils.h"
+#include "old/src/liblj92/lj92.h"
+
+#ifndef LIBMLV_NO_THREADS
+#include <pthread.h>
+#endif
+
+/* How many blocks to index at a time while looking for a frame that is not
+ * in the index yet (only when AllowIndexing is set) */
+#define FRAME_SEARCH_INDEXING_STEP 50
+
+/* Extra bytes on the end of buffers, as the unpacking functions work in groups
+ * of 8 pixels and may read/write slightly past the end of the frame */
+#define BUFFER_PADDING 64
+
+/* How many frames each decoding thread can have decoded ahead */
+#define DECODED_FRAMES_PER_THREAD 2
+
+/* Most frames playback keeps decoded ahead, however big the memory budget */
+#define MAX_PLAYBACK_FRAMES 256
+
+/* Everything needed to decode a frame. The frame extractor has one, and so
+ * does each frame being decoded on a decoding thread. */
+typedef struct
 {
-    void * lj92_decoder;
+    /* LJ92 decoder, reopened for each frame so its memory gets reused. Its
+     * memory comes from lj92_allocator. */
+    lj92 lj92_decoder;
+    mlv_Alloc lj92_allocator;
+    void * lj92_allocator_ud;
+
+    /* Frame data as it is in the file (packed or LJ92), and memory size */
     void * encoded_data;
+    uint64_t encoded_data_size;
+
+    /* Frame data unpacked to 16 bits per pixel, and memory size */
     void * u16_data;
+    uint64_t u16_data_size;
+
+    /* Dimensions and bitdepth of the last decoded frame */
+    int width;
+    int height;
+    int bitdepth;
+
+    /* Threads LJ92 slices (restart intervals) are decoded on */
+    int slice_threads;
+} frame_decoder_t;
+
+/* Image format of the clip, from the RAWI and MLVI blocks */
+typedef struct
+{
+    int width;
+    int height;
+    int bitdepth;
+    int is_lj92;
+} image_format_t;
+
+typedef struct frame_decoding_t frame_decoding_t;
+
+struct mlv_FrameExtractor
+{
+    frame_decoder_t decoder;
+
+    /* Decoded frames are looked for here first, NULL if there is no cache.
+     * cached_frame is the last frame returned from it, which is kept pinned
+     * until the next call. */
+    mlv_FrameCache * cache;
+    uint16_t * cached_frame;
+
+    /* Frames being decoded on other threads (mlv_FrameExtractorStartDecoding),
+     * NULL if not started */
+    frame_decoding_t * decoding;
 };
 
+static void init_frame_decoder(frame_decoder_t * Decoder, void * UseAllocatorFrom)
+{
+    Decoder->lj92_decoder = NULL;
+    mlv_GetAllocator(UseAllocatorFrom, &Decoder->lj92_allocator, &Decoder->lj92_allocator_ud);
+    Decoder->encoded_data = mlv_Malloc2(UseAllocatorFrom, 0);
+    Decoder->encoded_data_size = 0;
+    Decoder->u16_data = mlv_Malloc2(UseAllocatorFrom, 0);
+    Decoder->u16_data_size = 0;
+    Decoder->width = 0;
+    Decoder->height = 0;
+    Decoder->bitdepth = 0;
+    Decoder->slice_threads = 1;
+}
+
+static void free_frame_decoder(frame_decoder_t * Decoder)
+{
+    if (Decoder->lj92_decoder != NULL)
+    {
+        lj92_close(Decoder->lj92_decoder);
+        Decoder->lj92_decoder = NULL;
+    }
+
+    if (Decoder->encoded_data != NULL)
+        Decoder->encoded_data = mlv_Realloc(Decoder->encoded_data, 0);
+    if (Decoder->u16_data != NULL)
+        Decoder->u16_data = mlv_Realloc(Decoder->u16_data, 0);
+
+    Decoder->encoded_data_size = 0;
+    Decoder->u16_data_size = 0;
+}
+
+static void uninit_frame_decoder(frame_decoder_t * Decoder)
+{
+    free_frame_decoder(Decoder);
+    if (Decoder->encoded_data != NULL) mlv_Free(Decoder->encoded_data);
+    if (Decoder->u16_data != NULL) mlv_Free(Decoder->u16_data);
+}
+
 mlv_FrameExtractor * mlv_newFrameExtractor(mlv_Alloc Allocator, void * AllocatorUD)
 {
     mlv_FrameExtractor * frame_extractor = mlv_Malloc(Allocator, AllocatorUD, sizeof(mlv_FrameExtractor));
 
-    frame_extractor->lj92_decoder = NULL;
-    frame_extractor->encoded_data = NULL;
-    frame_extractor->u16_data = NULL;
+    init_frame_decoder(&frame_extractor->decoder, frame_extractor);
+    frame_extractor->cache = NULL;
+    frame_extractor->cached_frame = NULL;
+    frame_extractor->decoding = NULL;
 
     return frame_extractor;
 }
 
+/* Lets the cache evict the frame last returned from it */
+static void release_cached_frame(mlv_FrameExtractor * FrameExtractor)
+{
+    if (FrameExtractor->cached_frame != NULL)
+    {
+        mlv_FrameCacheRelease(FrameExtractor->cache, FrameExtractor->cached_frame);
+        FrameExtractor->cached_frame = NULL;
+    }
+}
+
+void mlv_closeFrameExtractor(mlv_FrameExtractor * FrameExtractor)
+{
+    mlv_FrameExtractorStopDecoding(FrameExtractor);
+    release_cached_frame(FrameExtractor);
+    uninit_frame_decoder(&FrameExtractor->decoder);
+    mlv_Free(FrameExtractor);
+}
+
+/* Makes sure a buffer is at least Size bytes. Only ever grows, so that
+ * getting frames of the same size over and over does no allocation. Returns
+ * NULL if it can't grow, leaving the old buffer as it was. */
+static void * reserve_buffer(void ** Buffer, uint64_t * BufferSize, uint64_t Size)
+{
+    if (*Buffer != NULL && Size > *BufferSize)
+    {
+        void * new_buffer = mlv_Realloc(*Buffer, Size + BUFFER_PADDING);
+        if (new_buffer == NULL) return NULL;
+        *Buffer = new_buffer;
+        *BufferSize = Size;
+    }
+
+    return *Buffer;
+}
+
+/* Finds first entry of a block type (optionally with a frame number), will
+ * index more of the clip until it is found if AllowIndexing is set, seeking
+ * to frames first if it is MLV_INDEX_LAZILY */
+static int64_t find_entry(mlv_Index * Index,
+                          mlv_DataSource * DataSource,
+                          char * BlockType,
+                          int UseFrameNumber, uint64_t FrameNumber,
+                          int AllowIndexing)
+{
+    /* Frame numbers in the file are 32 bit */
+    if (UseFrameNumber && FrameNumber > UINT32_MAX) return -1;
+
+    int64_t entry = mlv_IndexFindEntry(Index, 0, (uint8_t *)BlockType, 0,0,0, 0,0,0, UseFrameNumber, FrameNumber, 1);
+
+    if (entry < 0 && AllowIndexing == MLV_INDEX_LAZILY && UseFrameNumber && DataSource != NULL)
+        entry = mlv_IndexSeekFrame(Index, DataSource, (uint8_t *)BlockType, FrameNumber);
+
+    while (entry < 0 && AllowIndexing && DataSource != NULL && !mlv_IndexIsComplete(Index))
+    {
+        mlv_IndexBuild(Index, DataSource, FRAME_SEARCH_INDEXING_STEP);
+        entry = mlv_IndexFindEntry(Index, 0, (uint8_t *)BlockType, 0,0,0, 0,0,0, UseFrameNumber, FrameNumber, 1);
+    }
+
+    return entry;
+}
+
+/* Finds where the payload of a VIDF or AUDF block is (the part after the
+ * header and frameSpace). Returns zero if the block is not valid. */
+static int find_frame_payload(mlv_Index * Index,
+                              mlv_DataSource * DataSource,
+                              int64_t EntryID,
+                              uint32_t HeaderSize,
+                              int * ChunkOut,
+                              uint64_t * PosOut,
+                              uint64_t * NumBytesOut)
+{
+    /* frameSpace is the last field of both the VIDF and AUDF header */
+    uint32_t frame_space = 0;
+    if (mlv_IndexGetBlockData(Index, EntryID, HeaderSize - sizeof(uint32_t), sizeof(uint32_t), &frame_space, DataSource) != sizeof(uint32_t))
+        return 0;
+
+    uint32_t block_size = mlv_IndexGetBlockSize(Index, EntryID);
+    uint64_t offset = (uint64_t)HeaderSize + frame_space;
+    if (offset > block_size) return 0;
+
+    mlv_IndexGetBlockLocation(Index, EntryID, ChunkOut, PosOut);
+    *PosOut += offset;
+    *NumBytesOut = block_size - offset;
+    return 1;
+}
+
+/* Returns a pointer to the payload in the data source's memory, or NULL if it
+ * does not have any. Padding must be there too, as unpacking may read past the
+ * end. Must be aligned for reading as uint16. */
+static void * get_payload_pointer(mlv_DataSource * DataSource, int Chunk, uint64_t Pos, uint64_t NumBytes)
+{
+    uint8_t * pointer = mlv_DataSourceGetDataPointer(DataSource, Chunk, Pos, NumBytes + BUFFER_PADDING);
+    if (pointer != NULL && ((uintptr_t)pointer % sizeof(uint16_t)) == 0) return pointer;
+    return NULL;
+}
+
+/* Gets the payload, straight from the data source's memory if it can,
+ * otherwise it is read in to encoded_data. Returns NULL if something goes
+ * wrong. */
+static void * read_frame_payload(frame_decoder_t * Decoder,
+                                 mlv_DataSource * DataSource,
+                                 int Chunk,
+                                 uint64_t Pos,
+                                 uint64_t NumBytes)
+{
+    void * pointer = get_payload_pointer(DataSource, Chunk, Pos, NumBytes);
+    if (pointer != NULL) return pointer;
+
+    if (reserve_buffer(&Decoder->encoded_data, &Decoder->encoded_data_size, NumBytes) == NULL)
+        return NULL;
+
+    if (mlv_DataSourceGetData(DataSource, Chunk, Pos, NumBytes, Decoder->encoded_data) != NumBytes)
+        return NULL;
+
+    return Decoder->encoded_data;
+}
+
+static void * get_frame_payload(frame_decoder_t * Decoder,
+                                mlv_Index * Index,
+                                mlv_DataSource * DataSource,
+                                int64_t EntryID,
+                                uint32_t HeaderSize,
+                                uint64_t * NumBytesOut)
+{
+    int chunk;
+    uint64_t pos, num_bytes;
+    if (!find_frame_payload(Index, DataSource, EntryID, HeaderSize, &chunk, &pos, &num_bytes))
+        return NULL;
+
+    void * payload = read_frame_payload(Decoder, DataSource, chunk, pos, num_bytes);
+    if (payload != NULL && NumBytesOut != NULL) *NumBytesOut = num_bytes;
+    return payload;
+}
+
+/* Image format comes from the RAWI block and compression from MLVI. Returns
+ * zero if they can't be found or the format is not valid. */
+static int get_image_format(mlv_Index * Index,
+                            mlv_DataSource * DataSource,
+                            int AllowIndexing,
+                            image_format_t * FormatOut)
+{
+    int64_t rawi_entry = find_entry(Index, DataSource, "RAWI", 0, 0, AllowIndexing);
+    int64_t mlvi_entry = find_entry(Index, DataSource, "MLVI", 0, 0, AllowIndexing);
+    if (rawi_entry < 0 || mlvi_entry < 0) return 0;
+
+    mlv_rawi_hdr_t rawi;
+    mlv_file_hdr_t mlvi;
+    if (mlv_IndexGetBlockData(Index, rawi_entry, 0, sizeof(rawi), &rawi, DataSource) != sizeof(rawi)) return 0;
+    if (mlv_IndexGetBlockData(Index, mlvi_entry, 0, sizeof(mlvi), &mlvi, DataSource) != sizeof(mlvi)) return 0;
+
+    FormatOut->width = rawi.xRes;
+    FormatOut->height = rawi.yRes;
+    FormatOut->bitdepth = rawi.raw_info.bits_per_pixel;
+    FormatOut->is_lj92 = (mlvi.videoClass & MLV_VIDEO_CLASS_FLAG_LJ92) != 0;
+
+    return FormatOut->width >= MLV_MIN_IMAGEDATA_WIDTH && FormatOut->width <= MLV_MAX_IMAGEDATA_WIDTH
+        && FormatOut->height >= MLV_MIN_IMAGEDATA_HEIGHT && FormatOut->height <= MLV_MAX_IMAGEDATA_HEIGHT;
+}
+
+/* Unpacks or decodes a frame's data in to the decoder's u16_data */
+#ifndef LIBMLV_NO_THREADS
+/* LJ92 slices being decoded, threads take the next one until all are done */
+typedef struct
+{
+    void (*func)(void *, int);
+    void * arg;
+    int count;
+    int next;
+    pthread_mutex_t mutex;
+} slice_decoding_t;
+
+static void * slice_decoding_thread(void * Arg)
+{
+    slice_decoding_t * slices = Arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&slices->mutex);
+        int slice = slices->next++;
+        pthread_mutex_unlock(&slices->mutex);
+
+        if (slice >= slices->count) break;
+        slices->func(slices->arg, slice);
+    }
+
+    return NULL;
+}
+
+/* Decodes LJ92 slices on Decoder->slice_threads threads, counting the calling
+ * thread. They only live as long as the frame, as this is meant for big
+ * frames, where starting threads takes no time in comparison. */
+static void decode_slices(void * Decoder, int Count, void (*Func)(void *, int), void * Arg)
+{
+    frame_decoder_t * decoder = Decoder;
+    pthread_t threads[LJ92_MAX_SLICES];
+    slice_decoding_t slices;
+    slices.func = Func;
+    slices.arg = Arg;
+    slices.count = Count;
+    slices.next = 0;
+    pthread_mutex_init(&slices.mutex, NULL);
+
+    int num_threads = decoder->slice_threads - 1;
+    if (num_threads > Count - 1) num_threads = Count - 1;
+    if (num_threads > LJ92_MAX_SLICES) num_threads = LJ92_MAX_SLICES;
+
+    int started = 0;
+    while (started < num_threads && pthread_create(&threads[started], NULL, slice_decoding_thread, &slices) == 0)
+        ++started;
+
+    slice_decoding_thread(&slices);
+
+    for (int t = 0; t < started; ++t) pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&slices.mutex);
+}
+#endif
+
+static uint16_t * decode_frame(frame_decoder_t * Decoder,
+                               image_format_t * Format,
+                               uint8_t * FrameData,
+                               uint64_t NumBytes)
+{
+    int bitdepth = Format->bitdepth;
+    uint64_t num_pixels = (uint64_t)Format->width * Format->height;
+    uint16_t * out = reserve_buffer(&Decoder->u16_data, &Decoder->u16_data_size, num_pixels * sizeof(uint16_t));
+    if (out == NULL) return NULL;
+
+    if (Format->is_lj92)
+    {
+        int lj92_width, lj92_height, lj92_bitdepth, lj92_components;
+        int result;
+
+        if (Decoder->lj92_decoder != NULL)
+            result = lj92_reopen(Decoder->lj92_decoder, FrameData, NumBytes, &lj92_width, &lj92_height, &lj92_bitdepth, &lj92_components);
+        else
+            result = lj92_open_with_allocator(&Decoder->lj92_decoder, FrameData, NumBytes, &lj92_width, &lj92_height, &lj92_bitdepth, &lj92_components,
+                                              Decoder->lj92_allocator, Decoder->lj92_allocator_ud);
+
+        if (result != LJ92_ERROR_NONE) return NULL;
+
+#ifndef LIBMLV_NO_THREADS
+        lj92_set_parallel(Decoder->lj92_decoder, (Decoder->slice_threads > 1) ? decode_slices : NULL, Decoder);
+#endif
+
+        /* The encoded image may be shaped differently (Magic Lantern uses 2
+         * components), but must still have the same number of pixels */
+        uint64_t lj92_pixels = (uint64_t)lj92_width * lj92_height * lj92_components;
+        if (lj92_pixels != num_pixels) return NULL;
+
+        if (lj92_decode(Decoder->lj92_decoder, out, lj92_pixels, 0, NULL, 0) != LJ92_ERROR_NONE) return NULL;
+
+        bitdepth = lj92_bitdepth;
+    }
+    else
+    {
+        /* Make sure there is enough data for the whole frame */
+        if (NumBytes < (num_pixels * bitdepth) / 8) return NULL;
+
+        switch (bitdepth)
+        {
+            case 14:
+                MLVUnpackFrame14((uint16_t *)FrameData, num_pixels, out);
+                break;
+            case 12:
+                MLVUnpackFrame12((uint16_t *)FrameData, num_pixels, out);
+                break;
+            case 10:
+                MLVUnpackFrame10((uint16_t *)FrameData, num_pixels, out);
+                break;
+            case 16:
+                for (uint64_t i = 0; i < num_pixels; ++i) out[i] = ((uint16_t *)FrameData)[i];
+                break;
+            default:
+                return NULL;
+        }
+    }
+
+    Decoder->width = Format->width;
+    Decoder->height = Format->height;
+    Decoder->bitdepth = bitdepth;
+
+    return out;
+}
+
 void * mlv_FrameExtractorGetFrameData(mlv_FrameExtractor * FrameExtractor,
                                       mlv_Index * Index,
                                       mlv_DataSource * DataSource,
                                       uint64_t FrameNumber,
                                       uint64_t * NumBytesOut,
-                                      int AllowIndexing);
+                                      int AllowIndexing)
+{
+    release_cached_frame(FrameExtractor);
+
+    int64_t entry = find_entry(Index, DataSource, "VIDF", 1, FrameNumber, AllowIndexing);
+    if (entry < 0) return NULL;
+
+    return get_frame_payload(&FrameExtractor->decoder, Index, DataSource, entry, sizeof(mlv_vidf_hdr_t), NumBytesOut);
+}
 
 uint16_t * mlv_FrameExtractorGetFrame(mlv_FrameExtractor * FrameExtractor,
                                       mlv_Index * Index,
                                       mlv_DataSource * DataSource,
                                       uint64_t FrameNumber,
-                                      int AllowIndexing);
+                                      int AllowIndexing)
+{
+    release_cached_frame(FrameExtractor);
+
+    mlv_FrameCache * cache = FrameExtractor->cache;
+    frame_decoder_t * decoder = &FrameExtractor->decoder;
+
+    if (cache != NULL)
+    {
+        uint16_t * frame = mlv_FrameCacheGet(cache, Index, FrameNumber, &decoder->width, &decoder->height, &decoder->bitdepth);
+        if (frame != NULL) return FrameExtractor->cached_frame = frame;
+    }
+
+    image_format_t format;
+    if (!get_image_format(Index, DataSource, AllowIndexing, &format)) return NULL;
+
+    uint64_t num_bytes;
+    uint8_t * frame_data = mlv_FrameExtractorGetFrameData(FrameExtractor, Index, DataSource, FrameNumber, &num_bytes, AllowIndexing);
+    if (frame_data == NULL) return NULL;
+
+    uint16_t * out = decode_frame(decoder, &format, frame_data, num_bytes);
+
+    if (out != NULL && cache != NULL)
+        mlv_FrameCachePut(cache, Index, FrameNumber, out, decoder->width, decoder->height, decoder->bitdepth);
+
+    return out;
+}
 
 uint16_t * mlv_FrameExtractorGetAudioData(mlv_FrameExtractor * FrameExtractor,
                                           uint64_t AudioFrameNumber,
                                           mlv_Index * Index,
                                           mlv_DataSource * DataSource,
                                           uint64_t * NumSamplesOut,
-                                          int AllowIndexing);
+                                          int AllowIndexing)
+{
+    release_cached_frame(FrameExtractor);
+
+    int64_t entry = find_entry(Index, DataSource, "AUDF", 1, AudioFrameNumber, AllowIndexing);
+    if (entry < 0) return NULL;
+
+    uint64_t num_bytes;
+    uint16_t * audio_data = get_frame_payload(&FrameExtractor->decoder, Index, DataSource, entry, sizeof(mlv_audf_hdr_t), &num_bytes);
+
+    if (audio_data != NULL && NumSamplesOut != NULL) *NumSamplesOut = num_bytes / sizeof(uint16_t);
+    return audio_data;
+}
+
+int mlv_FrameExtractorGetWidth(mlv_FrameExtractor * FrameExtractor)
+{
+    return FrameExtractor->decoder.width;
+}
 
-/* Will free any frame data (happens automatically anyway on next frame) */
-void mlv_FrameExtractorFree(mlv_FrameExtractor * FrameExtractor);
\ No newline at end of file
+int mlv_FrameExtractorGetHeight(mlv_FrameExtractor * FrameExtractor)
+{
+    return FrameExtractor->decoder.height;
+}
+
+int mlv_FrameExtractorGetBitdepth(mlv_FrameExtractor * FrameExtractor)
+{
+    return FrameExtractor->decoder.bitdepth;
+}
+
+void mlv_FrameExtractorSetSliceThreads(mlv_FrameExtractor * FrameExtractor, int NumThreads)
+{
+    FrameExtractor->decoder.slice_threads = (NumThreads > 1) ? NumThreads : 1;
+}
+
+void mlv_FrameExtractorSetCache(mlv_FrameExtractor * FrameExtractor, mlv_FrameCache * Cache)
+{
+    release_cached_frame(FrameExtractor);
+    FrameExtractor->cache = Cache;
+}
+
+void mlv_FrameExtractorFree(mlv_FrameExtractor * FrameExtractor)
+{
+    mlv_FrameExtractorStopDecoding(FrameExtractor);
+    release_cached_frame(FrameExtractor);
+    free_frame_decoder(&FrameExtractor->decoder);
+}
+
+/**************** Decoding on other threads ****************/
+
+#ifndef LIBMLV_NO_THREADS
+#define LOCK_DECODING(Decoding) pthread_mutex_lock(&(Decoding)->mutex)
+#define UNLOCK_DECODING(Decoding) pthread_mutex_unlock(&(Decoding)->mutex)
+#else
+#define LOCK_DECODING(Decoding)
+#define UNLOCK_DECODING(Decoding)
+#endif
+
+#define SLOT_FREE 0
+#define SLOT_DECODING 1
+#define SLOT_DONE 2
+#define SLOT_FAILED 3
+
+typedef struct
+{
+    frame_decoder_t decoder;
+    int state;
+} decode_slot_t;
+
+struct frame_decoding_t
+{
+    mlv_Index * index;
+    mlv_DataSource * data_source;
+    image_format_t format;
+
+    /* Frame extractor's cache, frames in it are copied instead of decoded,
+     * and decoded frames are put in it */
+    mlv_FrameCache * cache;
+
+    /* Frames are decoded in order of position, the frame at a position being
+     * first_frame + position * step, up to end_position. next_position is the
+     * next one for a thread to decode, next_returned_position is the next one
+     * for mlv_FrameExtractorGetDecodedFrame to return. */
+    uint64_t first_frame;
+    int64_t step;
+    uint64_t end_position;
+    uint64_t next_position;
+    uint64_t next_returned_position;
+
+    /* Playback only: frames in the clip, and the playback is changed (seek)
+     * each time generation goes up, frames of older ones get thrown away */
+    int is_playback;
+    uint64_t num_clip_frames;
+    uint64_t generation;
+
+    /* A position is decoded in slot position % num_slots, once the position
+     * before it in that slot has been returned and released. The last
+     * returned frame's slot is released on the next call. */
+    decode_slot_t * slots;
+    int num_slots;
+    int returned_slot;
+
+    /* If no threads are running, frames are decoded when they are asked for */
+    int num_threads;
+#ifndef LIBMLV_NO_THREADS
+    /* Allocator of the frame extractor, LJ92 decoders use it through
+     * decoding_alloc, which only lets one thread use it at a time */
+    mlv_Alloc allocator;
+    void * allocator_ud;
+    pthread_t * threads;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t slot_freed;
+    pthread_cond_t slot_decoded;
+#endif
+};
+
+static inline decode_slot_t * get_slot(frame_decoding_t * Decoding, uint64_t Position)
+{
+    return Decoding->slots + Position % Decoding->num_slots;
+}
+
+static inline uint64_t get_frame_at(frame_decoding_t * Decoding, uint64_t Position)
+{
+    return Decoding->first_frame + (uint64_t)((int64_t)Position * Decoding->step);
+}
+
+/* Starts playback (again) from Frame, frames after it are decoded Speed frames
+ * apart, until the start or end of the clip. Called with decoding locked. */
+static void set_playhead(frame_decoding_t * Decoding, uint64_t Frame, int Speed)
+{
+    if (Speed == 0) Speed = 1;
+
+    Decoding->first_frame = Frame;
+    Decoding->step = Speed;
+    Decoding->next_position = 0;
+    Decoding->next_returned_position = 0;
+
+    if (Frame >= Decoding->num_clip_frames)
+        Decoding->end_position = 0;
+    else if (Speed > 0)
+        Decoding->end_position = (Decoding->num_clip_frames - 1 - Frame) / Speed + 1;
+    else
+        Decoding->end_position = Frame / (uint64_t)(-(int64_t)Speed) + 1;
+}
+
+/* Copies a frame from the cache in to the decoder's u16_data, which must be
+ * big enough for the format already. Returns NULL if it is not cached. */
+static uint16_t * copy_cached_frame(frame_decoder_t * Decoder,
+                                    image_format_t * Format,
+                                    mlv_FrameCache * Cache,
+                                    mlv_Index * Index,
+                                    uint64_t FrameNumber)
+{
+    int width, height, bitdepth;
+    uint16_t * frame = mlv_FrameCacheGet(Cache, Index, FrameNumber, &width, &height, &bitdepth);
+    if (frame == NULL) return NULL;
+
+    uint16_t * out = NULL;
+    if (width == Format->width && height == Format->height)
+    {
+        out = Decoder->u16_data;
+        for (uint64_t i = 0; i < (uint64_t)width * height; ++i) out[i] = frame[i];
+        Decoder->width = width;
+        Decoder->height = height;
+        Decoder->bitdepth = bitdepth;
+    }
+
+    mlv_FrameCacheRelease(Cache, frame);
+    return out;
+}
+
+/* Decodes a frame in to a slot. Called with decoding locked, which is unlocked
+ * while decoding (and reading, if the data source is thread-safe). Memory is
+ * allocated while locked, so the allocator is used by one thread at a time. */
+static int decode_frame_in_slot(frame_decoding_t * Decoding, decode_slot_t * Slot, uint64_t FrameNumber)
+{
+    mlv_DataSource * data_source = Decoding->data_source;
+    frame_decoder_t * decoder = &Slot->decoder;
+    image_format_t * format = &Decoding->format;
+
+    int chunk;
+    uint64_t pos, num_bytes;
+    int64_t entry = find_entry(Decoding->index, data_source, "VIDF", 1, FrameNumber, 0);
+    if (entry < 0 || !find_frame_payload(Decoding->index, data_source, entry, sizeof(mlv_vidf_hdr_t), &chunk, &pos, &num_bytes))
+        return 0;
+
+    uint64_t u16_size = (uint64_t)format->width * format->height * sizeof(uint16_t);
+    if (reserve_buffer(&decoder->u16_data, &decoder->u16_data_size, u16_size) == NULL)
+        return 0;
+
+    if (Decoding->cache != NULL)
+    {
+        UNLOCK_DECODING(Decoding);
+        uint16_t * cached = copy_cached_frame(decoder, format, Decoding->cache, Decoding->index, FrameNumber);
+        LOCK_DECODING(Decoding);
+        if (cached != NULL) return 1;
+    }
+
+    if ( get_payload_pointer(data_source, chunk, pos, num_bytes) == NULL
+      && reserve_buffer(&decoder->encoded_data, &decoder->encoded_data_size, num_bytes) == NULL )
+        return 0;
+
+    int thread_safe = mlv_DataSourceIsThreadSafe(data_source);
+    uint8_t * frame_data = NULL;
+    if (!thread_safe) frame_data = read_frame_payload(decoder, data_source, chunk, pos, num_bytes);
+
+    UNLOCK_DECODING(Decoding);
+
+    if (thread_safe) frame_data = read_frame_payload(decoder, data_source, chunk, pos, num_bytes);
+    uint16_t * out = NULL;
+    if (frame_data != NULL) out = decode_frame(decoder, format, frame_data, num_bytes);
+
+    if (out != NULL && Decoding->cache != NULL)
+        mlv_FrameCachePut(Decoding->cache, Decoding->index, FrameNumber, out, decoder->width, decoder->height, decoder->bitdepth);
+
+    LOCK_DECODING(Decoding);
+
+    return out != NULL;
+}
+
+#ifndef LIBMLV_NO_THREADS
+
+static void * decoding_alloc(void * ud, void * ptr, uint64_t osize, uint64_t nsize)
+{
+    frame_decoding_t * decoding = ud;
+    pthread_mutex_lock(&decoding->mutex);
+    void * result = decoding->allocator(decoding->allocator_ud, ptr, osize, nsize);
+    pthread_mutex_unlock(&decoding->mutex);
+    return result;
+}
+
+static void * decoding_thread(void * Arg)
+{
+    frame_decoding_t * decoding = Arg;
+
+    pthread_mutex_lock(&decoding->mutex);
+
+    while (1)
+    {
+        /* Wait until the next frame's slot is free. While playing, there is
+         * always a next frame unless playback reached the end. */
+        decode_slot_t * slot = NULL;
+        while (!decoding->stop)
+        {
+            if (decoding->next_position < decoding->end_position)
+            {
+                slot = get_slot(decoding, decoding->next_position);
+                if (slot->state == SLOT_FREE) break;
+                slot = NULL;
+            }
+            else if (!decoding->is_playback) break;
+            pthread_cond_wait(&decoding->slot_freed, &decoding->mutex);
+        }
+
+        if (slot == NULL) break;
+
+        uint64_t frame = get_frame_at(decoding, decoding->next_position++);
+        uint64_t generation = decoding->generation;
+        slot->state = SLOT_DECODING;
+        int decoded = decode_frame_in_slot(decoding, slot, frame);
+
+        /* If there was a seek while decoding, the frame is not wanted */
+        if (generation != decoding->generation)
+        {
+            slot->state = SLOT_FREE;
+            pthread_cond_broadcast(&decoding->slot_freed);
+            continue;
+        }
+
+        slot->state = decoded ? SLOT_DONE : SLOT_FAILED;
+        pthread_cond_broadcast(&decoding->slot_decoded);
+    }
+
+    pthread_mutex_unlock(&decoding->mutex);
+
+    return NULL;
+}
+
+#endif
+
+/* Sets up decoding without starting it, NumSlots frames can be decoded at
+ * once. Returns NULL on error. */
+static frame_decoding_t * new_decoding(mlv_FrameExtractor * FrameExtractor,
+                                       mlv_Index * Index,
+                                       mlv_DataSource * DataSource,
+                                       image_format_t * Format,
+                                       int NumSlots)
+{
+    frame_decoding_t * decoding = mlv_Malloc2(FrameExtractor, sizeof(frame_decoding_t));
+    if (decoding == NULL) return NULL;
+
+    decoding->index = Index;
+    decoding->data_source = DataSource;
+    decoding->format = *Format;
+    decoding->cache = FrameExtractor->cache;
+    decoding->first_frame = 0;
+    decoding->step = 1;
+    decoding->end_position = 0;
+    decoding->next_position = 0;
+    decoding->next_returned_position = 0;
+    decoding->is_playback = 0;
+    decoding->num_clip_frames = 0;
+    decoding->generation = 0;
+    decoding->num_slots = NumSlots;
+    decoding->slots = mlv_Malloc2(FrameExtractor, sizeof(decode_slot_t) * decoding->num_slots);
+    decoding->returned_slot = -1;
+    decoding->num_threads = 0;
+
+    if (decoding->slots == NULL)
+    {
+        mlv_Free(decoding);
+        return NULL;
+    }
+
+    for (int s = 0; s < decoding->num_slots; ++s)
+    {
+        init_frame_decoder(&decoding->slots[s].decoder, FrameExtractor);
+        decoding->slots[s].state = SLOT_FREE;
+#ifndef LIBMLV_NO_THREADS
+        decoding->slots[s].decoder.lj92_allocator = decoding_alloc;
+        decoding->slots[s].decoder.lj92_allocator_ud = decoding;
+#endif
+    }
+
+#ifndef LIBMLV_NO_THREADS
+    mlv_GetAllocator(FrameExtractor, &decoding->allocator, &decoding->allocator_ud);
+    decoding->stop = 0;
+    pthread_mutex_init(&decoding->mutex, NULL);
+    pthread_cond_init(&decoding->slot_freed, NULL);
+    pthread_cond_init(&decoding->slot_decoded, NULL);
+    decoding->threads = NULL;
+#endif
+
+    return decoding;
+}
+
+/* Starts NumThreads decoding threads. If none could be started, frames get
+ * decoded on the calling thread when they are asked for. */
+static void start_decoding(mlv_FrameExtractor * FrameExtractor, frame_decoding_t * Decoding, int NumThreads)
+{
+#ifndef LIBMLV_NO_THREADS
+    Decoding->threads = mlv_Malloc2(FrameExtractor, sizeof(pthread_t) * (NumThreads + 1));
+    for (int t = 0; t < NumThreads && Decoding->threads != NULL; ++t)
+        if (pthread_create(&Decoding->threads[Decoding->num_threads], NULL, decoding_thread, Decoding) == 0)
+            Decoding->num_threads++;
+#else
+    (void)NumThreads;
+#endif
+
+    FrameExtractor->decoding = Decoding;
+}
+
+int mlv_FrameExtractorStartDecoding(mlv_FrameExtractor * FrameExtractor,
+                                    mlv_Index * Index,
+                                    mlv_DataSource * DataSource,
+                                    uint64_t FirstFrame,
+                                    uint64_t NumFrames,
+                                    int NumThreads)
+{
+    mlv_FrameExtractorStopDecoding(FrameExtractor);
+
+    image_format_t format;
+    if (!get_image_format(Index, DataSource, 0, &format)) return 0;
+
+#ifdef LIBMLV_NO_THREADS
+    NumThreads = 0;
+#endif
+    if (NumThreads < 0) NumThreads = 0;
+
+    int num_slots = (NumThreads > 0) ? NumThreads * DECODED_FRAMES_PER_THREAD : 1;
+    frame_decoding_t * decoding = new_decoding(FrameExtractor, Index, DataSource, &format, num_slots);
+    if (decoding == NULL) return 0;
+
+    decoding->first_frame = FirstFrame;
+    decoding->end_position = NumFrames;
+
+    start_decoding(FrameExtractor, decoding, NumThreads);
+    return 1;
+}
+
+int mlv_FrameExtractorStartPlayback(mlv_FrameExtractor * FrameExtractor,
+                                    mlv_Index * Index,
+                                    mlv_DataSource * DataSource,
+                                    uint64_t NumFrames,
+                                    uint64_t MemoryBudget,
+                                    int NumThreads)
+{
+    mlv_FrameExtractorStopDecoding(FrameExtractor);
+
+    image_format_t format;
+    if (!get_image_format(Index, DataSource, 0, &format)) return 0;
+
+#ifdef LIBMLV_NO_THREADS
+    NumThreads = 0;
+#endif
+    if (NumThreads < 0) NumThreads = 0;
+
+    /* Each slot has the decoded frame, and the frame as it is in the file,
+     * which is no bigger than the packed frame (LJ92 frames are smaller) */
+    uint64_t num_pixels = (uint64_t)format.width * format.height;
+    uint64_t slot_size = num_pixels * sizeof(uint16_t) + (num_pixels * format.bitdepth) / 8 + BUFFER_PADDING * 2;
+
+    /* One frame is out being shown, so at least one more is needed to decode
+     * anything ahead. No more threads than frames that can be decoded. */
+    uint64_t num_slots = MemoryBudget / slot_size;
+    if (num_slots > MAX_PLAYBACK_FRAMES) num_slots = MAX_PLAYBACK_FRAMES;
+    if (num_slots < 2) num_slots = 2;
+    if ((uint64_t)NumThreads > num_slots - 1) NumThreads = num_slots - 1;
+    if (NumThreads == 0) num_slots = 1;
+
+    frame_decoding_t * decoding = new_decoding(FrameExtractor, Index, DataSource, &format, num_slots);
+    if (decoding == NULL) return 0;
+
+    decoding->is_playback = 1;
+    decoding->num_clip_frames = NumFrames;
+    set_playhead(decoding, 0, 1);
+
+    start_decoding(FrameExtractor, decoding, NumThreads);
+    return 1;
+}
+
+int mlv_FrameExtractorSeekPlayback(mlv_FrameExtractor * FrameExtractor,
+                                   uint64_t Frame,
+                                   int Speed)
+{
+    frame_decoding_t * decoding = FrameExtractor->decoding;
+    if (decoding == NULL || !decoding->is_playback) return 0;
+
+    LOCK_DECODING(decoding);
+
+    /* Frames decoded ahead are thrown away, and ones still being decoded will
+     * be when they are done. The returned frame stays valid until the next
+     * mlv_FrameExtractorGetDecodedFrame. */
+    decoding->generation++;
+    set_playhead(decoding, Frame, Speed);
+
+    for (int s = 0; s < decoding->num_slots; ++s)
+    {
+        decode_slot_t * slot = decoding->slots + s;
+        if (s != decoding->returned_slot && (slot->state == SLOT_DONE || slot->state == SLOT_FAILED))
+            slot->state = SLOT_FREE;
+    }
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_cond_broadcast(&decoding->slot_freed);
+#endif
+
+    UNLOCK_DECODING(decoding);
+    return 1;
+}
+
+uint16_t * mlv_FrameExtractorGetDecodedFrame(mlv_FrameExtractor * FrameExtractor,
+                                             uint64_t * FrameNumberOut)
+{
+    frame_decoding_t * decoding = FrameExtractor->decoding;
+    if (decoding == NULL) return NULL;
+
+    release_cached_frame(FrameExtractor);
+
+    LOCK_DECODING(decoding);
+
+    if (decoding->returned_slot >= 0)
+    {
+        decoding->slots[decoding->returned_slot].state = SLOT_FREE;
+        decoding->returned_slot = -1;
+#ifndef LIBMLV_NO_THREADS
+        pthread_cond_broadcast(&decoding->slot_freed);
+#endif
+    }
+
+    if (decoding->next_returned_position >= decoding->end_position)
+    {
+        UNLOCK_DECODING(decoding);
+        return NULL;
+    }
+
+    uint64_t position = decoding->next_returned_position++;
+    uint64_t frame = get_frame_at(decoding, position);
+    decode_slot_t * slot = get_slot(decoding, position);
+
+    if (decoding->num_threads == 0)
+    {
+        slot->state = SLOT_DECODING;
+        slot->state = decode_frame_in_slot(decoding, slot, frame) ? SLOT_DONE : SLOT_FAILED;
+    }
+#ifndef LIBMLV_NO_THREADS
+    else
+    {
+        while (slot->state != SLOT_DONE && slot->state != SLOT_FAILED)
+            pthread_cond_wait(&decoding->slot_decoded, &decoding->mutex);
+    }
+#endif
+
+    decoding->returned_slot = slot - decoding->slots;
+    int decoded = (slot->state == SLOT_DONE);
+
+    UNLOCK_DECODING(decoding);
+
+    if (FrameNumberOut != NULL) *FrameNumberOut = frame;
+    if (!decoded) return NULL;
+
+    FrameExtractor->decoder.width = slot->decoder.width;
+    FrameExtractor->decoder.height = slot->decoder.height;
+    FrameExtractor->decoder.bitdepth = slot->decoder.bitdepth;
+
+    return slot->decoder.u16_data;
+}
+
+void mlv_FrameExtractorStopDecoding(mlv_FrameExtractor * FrameExtractor)
+{
+    frame_decoding_t * decoding = FrameExtractor->decoding;
+    if (decoding == NULL) return;
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_lock(&decoding->mutex);
+    decoding->stop = 1;
+    pthread_cond_broadcast(&decoding->slot_freed);
+    pthread_mutex_unlock(&decoding->mutex);
+
+    for (int t = 0; t < decoding->num_threads; ++t)
+        pthread_join(decoding->threads[t], NULL);
+
+    if (decoding->threads != NULL) mlv_Free(decoding->threads);
+#endif
+
+    /* Before the mutex is gone, as LJ92 decoders free through decoding_alloc */
+    for (int s = 0; s < decoding->num_slots; ++s)
+        uninit_frame_decoder(&decoding->slots[s].decoder);
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_destroy(&decoding->mutex);
+    pthread_cond_destroy(&decoding->slot_freed);
+    pthread_cond_destroy(&decoding->slot_decoded);
+#endif
+
+    mlv_Free(decoding->slots);
+    mlv_Free(decoding);
+    FrameExtractor->decoding = NULL;
+}
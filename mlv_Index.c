@@ -2,42 +2,97 @@
 #include <stdint.h>
 
 #include "libmlv.h"
+#include "old/include/mlv_structs.h"
+
+/* Threads are only used by mlv_IndexBuildParallel */
+#ifndef LIBMLV_NO_THREADS
+#include <pthread.h>
+#endif
 
 /* For comparing block type strings */
-#define BLOCKTYPE_INT(B) ((uint32_t)((B[0]<<24)|(B[1]<<16)|(B[2]<<8)|(B[3])))
+#define BLOCKTYPE_INT(B) (((uint32_t)(B)[0]<<24)|((uint32_t)(B)[1]<<16)|((uint32_t)(B)[2]<<8)|((uint32_t)(B)[3]))
 
-/* How much data one index entry holds */
-#define ENTRY_BYTES 38
+/* How much of the data of blocks that are too big to be fully stored in the
+ * index is kept (enough for the VIDF/AUDF header, such as frame number) */
+#define BLOCK_START_BYTES 38
 
 /* Blocks below or equal to this size will be fully stored in the index, so the
  * file will not have to be accessed to get their data, as it will already be
- * in the index. There is a 69% memory overhead to doing this!!!
- * The chosen value allows blocks to occupy up to 10 entries, as you can see! */
-#define MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX (ENTRY_BYTES*10)
-
-/* How many entries to allocate memory for (so that realloc wont have to be
- * called for adding every single entry) */
-#define ENTRY_ALLOCATION_GRANULARITY 25
-
-/* Index entry, 64 bytes size */
+ * in the index. */
+#define MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX (BLOCK_START_BYTES*10)
+
+/* How many entries to allocate memory for at first. After that the memory is
+ * doubled whenever it runs out, so realloc (and the copying it does) happens
+ * a logarithmic number of times, not once every few entries. */
+#define MIN_ENTRY_ALLOCATION 64
+
+/* How much of the file is read at a time while indexing, so that many small
+ * blocks can be indexed from one read instead of a read for each of them */
+#define READ_AHEAD_SIZE (1024*1024)
+
+/* After a block of at least this size, the next block will probably not be
+ * within the read-ahead window, so just a little is read (enough for the next
+ * block's header and data, and maybe a few small blocks after it). So a clip
+ * of real sized frames still takes about one read per frame, as each frame's
+ * header has to be read to know where the next block is, only the small
+ * blocks between frames come with it. */
+#define READ_AHEAD_BIG_BLOCK_SIZE (READ_AHEAD_SIZE/16)
+#define READ_AHEAD_SMALL_SIZE 4096
+
+/* Frame number tables start with memory for this many frames, and double
+ * in size whenever a bigger frame number comes up */
+#define FRAME_TABLE_MIN_SIZE 256
+
+/* Frame numbers bigger than this many more than the number of entries (times
+ * the number of chunks, as frames are spread between chunks and each chunk
+ * is indexed in turn) will not be put in the frame table, as they are most
+ * likely corrupted and would make the table enormous. Lookups then fall back
+ * to searching entries. */
+#define FRAME_TABLE_MAX_SLACK 4096
+
+/* Most parts of the clip that mlv_IndexSeekFrame can index ahead of where
+ * mlv_IndexBuild is up to */
+#define MAX_LAZY_REGIONS 64
+
+/* A position found by scanning for a block header is only taken as the start
+ * of a block if it is followed by this many valid block headers in a row (or
+ * valid blocks up to the end of the chunk) */
+#define RESYNC_CHAIN_LENGTH 4
+
+/* Most of the clip scanned for a block header after an estimated position */
+#define RESYNC_MAX_SCAN (64*1024*1024)
+
+/* mlv_IndexSeekFrame estimates where a frame is at most this many times, each
+ * time knowing more frames' positions */
+#define SEEK_MAX_TRIES 6
+
+/* If indexing from an estimated position finds a frame at most this many
+ * before the one wanted, indexing continues to it rather than estimating
+ * again, as long as it is within SEEK_MAX_WALK_BLOCKS */
+#define SEEK_WALK_FRAMES 8
+#define SEEK_MAX_WALK_BLOCKS 256
+
+/* Which order the entries are in (Index->sort_order) */
+#define INDEX_ORDER_FILE 0 /* Order they were indexed in */
+#define INDEX_ORDER_READING 1 /* Sorted by mlv_IndexOptimise */
+#define INDEX_ORDER_STORAGE 2 /* Sorted by mlv_IndexOptimiseForStorage */
+
+/* Chunk and position of a block are stored together in one uint64, chunk in
+ * the top 8 bits (MLV_MAX_CHUNK_SIZE leaves plenty of space for position) */
+#define BLOCK_LOCATION(Chunk, Pos) (((uint64_t)(Chunk) << 56) | (Pos))
+#define BLOCK_LOCATION_CHUNK(L) ((int)((L) >> 56))
+#define BLOCK_LOCATION_POS(L) ((L) & 0x00FFFFFFFFFFFFFFULL)
+
+/* Frame number -> entry ID table, for VIDF or AUDF blocks */
 typedef struct {
-    /* Basic identifying information */
-    uint8_t block_type[4];
-    uint32_t block_size;
-    uint64_t block_timestamp;
-
-    /* These two identify which block this entry represents,
-     * by file position and chunk number */
-    uint64_t block_pos;
-    uint8_t block_chunk;
-
-    /* One block might have a few index entries to store the entire block's
-     * data in the index (only for blocks below a size threshold) */
-    uint8_t block_part;
-
-    /* Data (always excludes the first 16 bytes, as in the header) */
-    uint8_t data[ENTRY_BYTES];
-} mlv_IndexEntry;
+    /* How many frame numbers there is memory for */
+    uint64_t size;
+    /* Entry ID of each frame number, negative if it has not been indexed */
+    int64_t * entries;
+    /* If zero, some frames could not be added, so a frame missing from the
+     * table does not mean it isn't in the index */
+    uint8_t complete;
+} mlv_FrameTable;
 
 struct mlv_Index
 {
@@ -55,16 +110,61 @@ struct mlv_Index
     /* Is indexing complete */
     uint8_t indexing_is_complete;
 
+    /* The clip may still be growing (mlv_IndexSetTailMode) */
+    uint8_t tail_mode;
+
     /* Health. If not zero, do not allow operations */
     uint8_t health;
 
+    /* What order the entries are sorted in, one of INDEX_ORDER_... */
+    uint8_t sort_order;
+
+    /* How many chunks the clip has, for limiting frame table size */
+    int num_chunks;
+
     /* How many entries memory has been allocated for */
     uint64_t num_entries_memory;
-    /* How many entries there actually is */
+    /* How many entries there actually is (one per block) */
     uint64_t num_entries;
-    /* Index Entries */
-    mlv_IndexEntry * entries;
-    // mlv_IndexEntry entries2[];
+
+    /* Index entries, stored as columns so that searching by type or timestamp
+     * only has to go through the memory of that column */
+    uint32_t * block_type; /* As BLOCKTYPE_INT */
+    uint32_t * block_size;
+    uint64_t * block_timestamp;
+    uint64_t * block_location; /* BLOCK_LOCATION */
+    uint64_t * block_data_offset; /* Where the block's data is in block_data */
+
+    /* Block data (always excludes the first 16 bytes, as in the header), all
+     * of it for small blocks, BLOCK_START_BYTES for the rest */
+    uint8_t * block_data;
+    uint64_t block_data_size;
+    uint64_t block_data_memory;
+
+    /* Parts of the clip indexed ahead of indexed_up_to by mlv_IndexSeekFrame,
+     * from start to end of a chunk. Building skips them once it gets to one. */
+    struct {
+        uint64_t start;
+        uint64_t end;
+        int chunk;
+    } lazy_regions[MAX_LAZY_REGIONS];
+    int num_lazy_regions;
+
+    /* Seeking may have found frames too far ahead for the frame tables (see
+     * FRAME_TABLE_MAX_SLACK), so they are rebuilt once indexing is complete */
+    uint8_t has_seeked;
+
+    /* For finding frames by frame number without searching */
+    mlv_FrameTable video_frames;
+    mlv_FrameTable audio_frames;
+
+    /* Data read ahead while indexing (only allocated while indexing) */
+    struct {
+        uint8_t * data;
+        uint64_t pos;
+        uint64_t num_bytes;
+        int chunk;
+    } read_ahead;
 };
 
 typedef struct {
@@ -73,6 +173,17 @@ typedef struct {
     uint64_t timestamp;
 } mlv_block;
 
+/* Lets the same thing be done to all entry columns */
+#define NUM_ENTRY_COLUMNS 5
+static void get_entry_columns(mlv_Index * Index, void ** Columns[NUM_ENTRY_COLUMNS], uint64_t ElementSizes[NUM_ENTRY_COLUMNS])
+{
+    Columns[0] = (void **)&Index->block_type;        ElementSizes[0] = sizeof(uint32_t);
+    Columns[1] = (void **)&Index->block_size;        ElementSizes[1] = sizeof(uint32_t);
+    Columns[2] = (void **)&Index->block_timestamp;   ElementSizes[2] = sizeof(uint64_t);
+    Columns[3] = (void **)&Index->block_location;    ElementSizes[3] = sizeof(uint64_t);
+    Columns[4] = (void **)&Index->block_data_offset; ElementSizes[4] = sizeof(uint64_t);
+}
+
 mlv_Index * mlv_newIndex(mlv_Alloc Allocator, void * AllocatorUD)
 {
     mlv_Index * index = mlv_Malloc(Allocator, AllocatorUD, sizeof(mlv_Index));
@@ -82,47 +193,487 @@ mlv_Index * mlv_newIndex(mlv_Alloc Allocator, void * AllocatorUD)
     index->indexed_up_to.pos = 0;
     index->indexed_up_to.chunk = 0;
     index->indexing_is_complete = 0;
+    index->tail_mode = 0;
+    index->num_lazy_regions = 0;
+    index->has_seeked = 0;
     index->health = 0;
+    index->sort_order = INDEX_ORDER_FILE;
+    index->num_chunks = 1;
     index->num_entries_memory = 0;
     index->num_entries = 0;
-    index->entries = mlv_Malloc(Allocator, AllocatorUD, 0);
+
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(index, columns, element_sizes);
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c)
+    {
+        *columns[c] = mlv_Malloc(Allocator, AllocatorUD, 0);
+        if (*columns[c] == NULL) index->health = 1;
+    }
+
+    index->block_data = mlv_Malloc(Allocator, AllocatorUD, 0);
+    index->block_data_size = 0;
+    index->block_data_memory = 0;
+    if (index->block_data == NULL) index->health = 1;
+
+    index->read_ahead.data = NULL;
+    index->read_ahead.pos = 0;
+    index->read_ahead.num_bytes = 0;
+    index->read_ahead.chunk = 0;
+
+    index->video_frames = (mlv_FrameTable){0, mlv_Malloc(Allocator, AllocatorUD, 0), 1};
+    index->audio_frames = (mlv_FrameTable){0, mlv_Malloc(Allocator, AllocatorUD, 0), 1};
 
     return index;
 }
 
 void mlv_closeIndex(mlv_Index * Index)
 {
-    mlv_Free(Index->entries);
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c)
+        if (*columns[c] != NULL) mlv_Free(*columns[c]);
+
+    if (Index->block_data != NULL) mlv_Free(Index->block_data);
+    if (Index->read_ahead.data != NULL) mlv_Free(Index->read_ahead.data);
+    if (Index->video_frames.entries != NULL) mlv_Free(Index->video_frames.entries);
+    if (Index->audio_frames.entries != NULL) mlv_Free(Index->audio_frames.entries);
     mlv_Free(Index);
 }
 
-/* TODO: maybe re structure thhis fucntion.
- * Allocates an entry in the index, using memory allocation, if required. */
-static mlv_IndexEntry * new_entry(mlv_Index * Index)
+/* How many bytes of a block's data (after the header) are kept in the index */
+static inline uint32_t stored_data_size(uint32_t BlockSize)
+{
+    uint32_t data_size = BlockSize - sizeof(mlv_block);
+    return (data_size > MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX) ? BLOCK_START_BYTES : data_size;
+}
+
+/* Entries found by seeking from somewhere that was not really a block are
+ * removed by setting their type and size to zero, so that the IDs of other
+ * entries stay the same. Nothing matches them when searching. */
+static inline int entry_is_removed(mlv_Index * Index, uint64_t EntryID)
+{
+    return Index->block_size[EntryID] == 0;
+}
+
+/* Does the block have enough data in the index to have a frame number */
+static inline int entry_has_frame_number(mlv_Index * Index, uint64_t EntryID)
 {
-    if (Index->health != 0 || Index->entries == NULL)
+    return stored_data_size(Index->block_size[EntryID]) >= sizeof(uint32_t);
+}
+
+/* Frame number is first uint32 after the block header in both VIDF and AUDF */
+static inline uint32_t entry_frame_number(mlv_Index * Index, uint64_t EntryID)
+{
+    uint8_t * d = Index->block_data + Index->block_data_offset[EntryID];
+    return (uint32_t)d[0] | ((uint32_t)d[1] << 8) | ((uint32_t)d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+
+/* Returns frame table for a block type, or NULL if it isn't a frame block */
+static inline mlv_FrameTable * get_frame_table(mlv_Index * Index, uint32_t BlockType)
+{
+    if (BlockType == BLOCKTYPE_INT("VIDF")) return &Index->video_frames;
+    else if (BlockType == BLOCKTYPE_INT("AUDF")) return &Index->audio_frames;
+    else return NULL;
+}
+
+/* Records which entry a frame is in. Only the first entry for each frame
+ * number is kept, matching what searching the entries in order would find. */
+static void frame_table_add(mlv_Index * Index, mlv_FrameTable * Table, uint32_t FrameNumber, int64_t EntryID)
+{
+    if (FrameNumber >= Table->size)
     {
-        return NULL;
+        if (Table->entries == NULL || FrameNumber > (Index->num_entries + FRAME_TABLE_MAX_SLACK) * Index->num_chunks)
+        {
+            Table->complete = 0;
+            return;
+        }
+
+        uint64_t new_size = (Table->size != 0) ? Table->size : FRAME_TABLE_MIN_SIZE;
+        while (new_size <= FrameNumber) new_size *= 2;
+
+        int64_t * entries = mlv_Realloc(Table->entries, new_size * sizeof(int64_t));
+        if (entries == NULL)
+        {
+            /* Old memory is still valid, just can't fit this frame */
+            Table->complete = 0;
+            return;
+        }
+
+        for (uint64_t i = Table->size; i < new_size; ++i) entries[i] = -1;
+        Table->entries = entries;
+        Table->size = new_size;
+    }
+
+    if (Table->entries[FrameNumber] < 0) Table->entries[FrameNumber] = EntryID;
+}
+
+/* Adds entry to the frame tables if it is a frame block */
+static inline void add_entry_to_frame_tables(mlv_Index * Index, uint64_t EntryID)
+{
+    mlv_FrameTable * table = get_frame_table(Index, Index->block_type[EntryID]);
+    if (table != NULL && entry_has_frame_number(Index, EntryID))
+        frame_table_add(Index, table, entry_frame_number(Index, EntryID), EntryID);
+}
+
+/* Must be done after the entries have been moved around (sorted) */
+static void rebuild_frame_tables(mlv_Index * Index)
+{
+    mlv_FrameTable * tables[2] = {&Index->video_frames, &Index->audio_frames};
+    for (int t = 0; t < 2; ++t)
+    {
+        for (uint64_t i = 0; i < tables[t]->size; ++i) tables[t]->entries[i] = -1;
+        tables[t]->complete = 1;
+    }
+
+    for (uint64_t e = 0; e < Index->num_entries; ++e) add_entry_to_frame_tables(Index, e);
+}
+
+/* Resizes all entry columns to have memory for NumEntries. Returns zero if
+ * memory could not be allocated, in which case nothing is lost. */
+static int resize_entries(mlv_Index * Index, uint64_t NumEntries)
+{
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c)
+    {
+        void * column = mlv_Realloc(*columns[c], element_sizes[c] * NumEntries);
+        if (column == NULL) return 0;
+        *columns[c] = column;
+    }
+
+    Index->num_entries_memory = NumEntries;
+    return 1;
+}
+
+/* Resizes block data pool memory. Returns zero if it could not be allocated. */
+static int resize_block_data(mlv_Index * Index, uint64_t NumBytes)
+{
+    uint8_t * block_data = mlv_Realloc(Index->block_data, NumBytes);
+    if (block_data == NULL) return 0;
+    Index->block_data = block_data;
+    Index->block_data_memory = NumBytes;
+    return 1;
+}
+
+/* Makes space for NumBytes more in the block data pool. Returns pointer to
+ * where they go, or NULL if memory could not be allocated. */
+static uint8_t * new_block_data(mlv_Index * Index, uint32_t NumBytes)
+{
+    if (Index->block_data_size + NumBytes > Index->block_data_memory)
+    {
+        uint64_t new_memory = Index->block_data_memory * 2;
+        if (new_memory < MIN_ENTRY_ALLOCATION * BLOCK_START_BYTES) new_memory = MIN_ENTRY_ALLOCATION * BLOCK_START_BYTES;
+        if (new_memory < Index->block_data_size + NumBytes) new_memory = Index->block_data_size + NumBytes;
+
+        if (!resize_block_data(Index, new_memory)) return NULL;
+    }
+
+    uint8_t * data = Index->block_data + Index->block_data_size;
+    Index->block_data_size += NumBytes;
+    return data;
+}
+
+/* Allocates an entry in the index, using memory allocation, if required.
+ * Returns the new entry's ID, or negative if memory could not be allocated. */
+static int64_t new_entry(mlv_Index * Index)
+{
+    if (Index->health != 0)
+    {
+        return -1;
     }
 
     if (Index->num_entries == Index->num_entries_memory)
     {
-        Index->num_entries_memory += ENTRY_ALLOCATION_GRANULARITY;
-        Index->entries = mlv_Realloc(Index->entries, sizeof(mlv_IndexEntry) * Index->num_entries_memory);
-        
-        if (Index->entries == NULL)
+        uint64_t new_memory = Index->num_entries_memory * 2;
+        if (new_memory < MIN_ENTRY_ALLOCATION) new_memory = MIN_ENTRY_ALLOCATION;
+
+        if (!resize_entries(Index, new_memory))
+        {
+            return -1;
+        }
+    }
+
+    Index->num_entries++;
+    return Index->num_entries-1;
+}
+
+void mlv_IndexReserve(mlv_Index * Index, uint64_t NumEntries)
+{
+    if (Index->health != 0) return;
+
+    if (NumEntries > Index->num_entries_memory)
+        resize_entries(Index, NumEntries);
+
+    /* Most blocks are frames, which only have their first bytes stored */
+    uint64_t block_data_bytes = NumEntries * BLOCK_START_BYTES;
+    if (block_data_bytes > Index->block_data_memory)
+        resize_block_data(Index, block_data_bytes);
+}
+
+/* Returns pointer to Bytes of data from a chunk, from the read-ahead window.
+ * If they are not in it, ReadSize bytes from Pos are read in to it first.
+ * Returns NULL if Bytes could not be read. */
+static uint8_t * read_ahead(mlv_Index * Index,
+                            mlv_DataSource * DataSource,
+                            int Chunk,
+                            uint64_t Pos,
+                            uint64_t Bytes,
+                            uint64_t ReadSize)
+{
+    /* No need to read anything if the data is already in memory */
+    uint8_t * pointer = mlv_DataSourceGetDataPointer(DataSource, Chunk, Pos, Bytes);
+    if (pointer != NULL) return pointer;
+
+    if ( Index->read_ahead.data != NULL && Chunk == Index->read_ahead.chunk
+      && Pos >= Index->read_ahead.pos && (Pos + Bytes) <= (Index->read_ahead.pos + Index->read_ahead.num_bytes) )
+    {
+        return Index->read_ahead.data + (Pos - Index->read_ahead.pos);
+    }
+
+    if (Index->read_ahead.data == NULL)
+    {
+        Index->read_ahead.data = mlv_Malloc2(Index, READ_AHEAD_SIZE);
+        if (Index->read_ahead.data == NULL) return NULL;
+    }
+
+    uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, Chunk);
+    if (ReadSize < Bytes) ReadSize = Bytes;
+    if (ReadSize > READ_AHEAD_SIZE) ReadSize = READ_AHEAD_SIZE;
+    if (Pos + ReadSize > chunk_size) ReadSize = (Pos < chunk_size) ? (chunk_size - Pos) : 0;
+
+    Index->read_ahead.chunk = Chunk;
+    Index->read_ahead.pos = Pos;
+    Index->read_ahead.num_bytes = mlv_DataSourceGetData(DataSource, Chunk, Pos, ReadSize, Index->read_ahead.data);
+
+    if (Index->read_ahead.num_bytes < Bytes) return NULL;
+    return Index->read_ahead.data;
+}
+
+/* Frees read-ahead memory, for when indexing is done */
+static void free_read_ahead(mlv_Index * Index)
+{
+    if (Index->read_ahead.data != NULL) mlv_Free(Index->read_ahead.data);
+    Index->read_ahead.data = NULL;
+    Index->read_ahead.num_bytes = 0;
+}
+
+/* Removes entries of blocks from Start to End of a chunk (see
+ * entry_is_removed). Their block data is not reclaimed, it stays in the pool
+ * until the index is built again from nothing. */
+static void remove_entries(mlv_Index * Index, int Chunk, uint64_t Start, uint64_t End)
+{
+    for (uint64_t e = 0; e < Index->num_entries; ++e)
+    {
+        uint64_t location = Index->block_location[e];
+        if ( BLOCK_LOCATION_CHUNK(location) == Chunk
+          && BLOCK_LOCATION_POS(location) >= Start && BLOCK_LOCATION_POS(location) < End )
         {
-            return NULL;
+            Index->block_type[e] = 0;
+            Index->block_size[e] = 0;
+            Index->block_timestamp[e] = 0;
         }
     }
-    else if (Index->num_entries > Index->num_entries_memory)
+
+    rebuild_frame_tables(Index);
+}
+
+static void remove_lazy_region(mlv_Index * Index, int Region)
+{
+    Index->lazy_regions[Region] = Index->lazy_regions[--Index->num_lazy_regions];
+}
+
+/* If *Pos is the start of a part indexed by mlv_IndexSeekFrame, moves it to
+ * the end of that part, which is now joined up with what led to it */
+static void join_lazy_regions(mlv_Index * Index, int Chunk, uint64_t * Pos)
+{
+    for (int r = 0; r < Index->num_lazy_regions; ++r)
     {
-        /* This cannot and should not happen */
-        return NULL;
+        if (Index->lazy_regions[r].chunk == Chunk && Index->lazy_regions[r].start == *Pos)
+        {
+            *Pos = Index->lazy_regions[r].end;
+            remove_lazy_region(Index, r);
+            r = -1;
+        }
     }
+}
 
-    Index->num_entries++;
-    return Index->entries + (Index->num_entries-1);
+/* A part indexed by mlv_IndexSeekFrame that starts inside the block from Pos
+ * to End was started from something that only looked like a block, so its
+ * entries are removed, to be indexed properly */
+static void drop_false_lazy_regions(mlv_Index * Index, int Chunk, uint64_t Pos, uint64_t End)
+{
+    for (int r = 0; r < Index->num_lazy_regions; ++r)
+    {
+        if (Index->lazy_regions[r].chunk == Chunk && Index->lazy_regions[r].start > Pos && Index->lazy_regions[r].start < End)
+        {
+            remove_entries(Index, Chunk, Index->lazy_regions[r].start, Index->lazy_regions[r].end);
+            remove_lazy_region(Index, r);
+            r = -1;
+        }
+    }
+}
+
+/* Indexes blocks of one chunk, starting from *Pos, which is updated to where
+ * indexing got up to (chunk size once the whole chunk is done). Doesn't add
+ * entries to the frame tables. Returns how many blocks were indexed. */
+static uint64_t index_chunk(mlv_Index * Index,
+                            mlv_DataSource * DataSource,
+                            int Chunk,
+                            uint64_t * Pos,
+                            uint64_t MaxBlocks)
+{
+    uint64_t blocks_indexed = 0;
+    uint64_t pos = *Pos;
+    uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, Chunk);
+    uint64_t read_size = READ_AHEAD_SIZE;
+
+    /* In tail mode the last chunk may still be being written, so anything cut
+     * off at its end is left to be indexed once it has been */
+    int is_growing = Index->tail_mode && Chunk == mlv_DataSourceGetNumChunks(DataSource) - 1;
+
+    while (Index->health == 0 && blocks_indexed < MaxBlocks)
+    {
+        mlv_block block;
+        uint8_t * block_start;
+
+        if (Index->num_lazy_regions > 0) join_lazy_regions(Index, Chunk, &pos);
+
+        /* No space left for another block */
+        if ((pos + sizeof(mlv_block)) > chunk_size)
+        {
+            if (!is_growing) pos = chunk_size;
+            break;
+        }
+
+        /* Read the block header, making sure a whole header worth of bytes is read */
+        if ((block_start = read_ahead(Index, DataSource, Chunk, pos, sizeof(mlv_block), read_size)) == NULL)
+        {
+            /* Couldn't read enough data, skip the rest of this chunk */
+            if (!is_growing) pos = chunk_size;
+            break;
+        }
+        for (size_t i = 0; i < sizeof(mlv_block); ++i) ((uint8_t *)&block)[i] = block_start[i];
+
+        /************ Check stuff ************/
+
+        /* If the block claims to be smaller than possible, the file is fucked.
+         * TODO: decide if/when continuing to other chunks makes sense. A chunk
+         * that is still being written may just not have this block yet. */
+        if (block.size < sizeof(block))
+        {
+            if (!is_growing) pos = chunk_size;
+            break;
+        }
+
+        if (Index->num_lazy_regions > 0) drop_false_lazy_regions(Index, Chunk, pos, pos + block.size);
+
+        /* Handle blocks cut off at end of file. TODO: think about this */
+        if ((pos + block.size) > chunk_size)
+        {
+            if (is_growing) break;
+
+            /* (Temporary?) solution: reduce block's claimed size in index */
+            block.size -= ((pos + block.size) - chunk_size);
+        }
+
+        /* Exclude NULL blocks because they take up most of the index sometimes.
+         * Add any other exclusions to this if statement... */
+        int allow_nulls = 0;
+        if (allow_nulls || BLOCKTYPE_INT(block.type) != BLOCKTYPE_INT("NULL"))
+        {
+            /* How much of the block's data (excluding the header) will be in the index */
+            uint32_t data_size = stored_data_size(block.size);
+
+            int64_t entry = new_entry(Index);
+            uint8_t * data = (entry >= 0) ? new_block_data(Index, data_size) : NULL;
+
+            if (data == NULL)
+            {
+                // STOP!!! allocation error / memory error. Cannot continue at all.
+                if (entry >= 0) Index->num_entries--;
+                Index->health = 1;
+                break;
+            }
+
+            Index->block_type[entry] = BLOCKTYPE_INT(block.type);
+            Index->block_size[entry] = block.size;
+            Index->block_timestamp[entry] = block.timestamp;
+            Index->block_location[entry] = BLOCK_LOCATION(Chunk, pos);
+            Index->block_data_offset[entry] = data - Index->block_data;
+
+            /* Usually already read with the header */
+            uint8_t * block_data = read_ahead(Index, DataSource, Chunk, pos + sizeof(mlv_block), data_size, read_size);
+            if (block_data != NULL) for (uint32_t i = 0; i < data_size; ++i) data[i] = block_data[i];
+            else for (uint32_t i = 0; i < data_size; ++i) data[i] = 0;
+
+            /* New entries go on the end, so the index is not sorted any more */
+            Index->sort_order = INDEX_ORDER_FILE;
+
+            /* Only count a block if it has been added to the index to make MaxBlocks
+             * parameter more meaningful (there can be a lot of NULLS sometimes) */
+            ++blocks_indexed;
+        }
+
+        pos += block.size;
+
+        /* Reading a whole window is a waste if the next block is after it */
+        read_size = (block.size < READ_AHEAD_BIG_BLOCK_SIZE) ? READ_AHEAD_SIZE : READ_AHEAD_SMALL_SIZE;
+
+        // printf("Block %c%c%c%c, size %llu, pos %llu, timestamp %llu, %s\n",
+        //         block.type[0], block.type[1], block.type[2],
+        //         block.type[3], (uint64_t)block.size, pos, block.timestamp,
+        //         (data_size <= MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX) ? "Fully stored in index" : "");
+    }
+
+    *Pos = pos;
+    return blocks_indexed;
+}
+
+/* Records where indexing got up to, OutOfData is non-zero if it stopped
+ * because there was nothing more to index. In tail mode the end of the last
+ * chunk is not the end of the clip, so indexing stays there. */
+static void set_indexed_up_to(mlv_Index * Index,
+                              mlv_DataSource * DataSource,
+                              int Chunk,
+                              uint64_t Pos,
+                              int OutOfData)
+{
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+
+    if (Index->tail_mode)
+    {
+        Index->indexing_is_complete = (Index->health == 0 && (Chunk == num_chunks || OutOfData));
+
+        if (Chunk == num_chunks && num_chunks > 0)
+        {
+            Chunk = num_chunks - 1;
+            Pos = mlv_DataSourceGetChunkSize(DataSource, Chunk);
+        }
+    }
+    else
+    {
+        if (Chunk == num_chunks)
+        {
+            Index->indexing_is_complete = 1;
+            Pos = 0;
+        }
+    }
+
+    Index->indexed_up_to.chunk = Chunk;
+    Index->indexed_up_to.pos = Pos;
+    if (Index->indexing_is_complete || Index->health != 0) free_read_ahead(Index);
+
+    /* Anything indexed by seeking has been joined up with the rest by now */
+    if (Index->indexing_is_complete && !Index->tail_mode)
+    {
+        Index->num_lazy_regions = 0;
+        if (Index->has_seeked) rebuild_frame_tables(Index);
+        Index->has_seeked = 0;
+    }
 }
 
 void mlv_IndexBuild(mlv_Index * Index,
@@ -131,6 +682,7 @@ void mlv_IndexBuild(mlv_Index * Index,
 {
     /* Keep count for limiting */
     uint64_t blocks_indexed = 0;
+    uint64_t first_new_entry = Index->num_entries;
 
     /* If no limit was given, set limit to U64 max */
     if (MaxBlocks == 0) MaxBlocks = UINT64_MAX;
@@ -138,134 +690,633 @@ void mlv_IndexBuild(mlv_Index * Index,
     int chunk = Index->indexed_up_to.chunk;
     uint64_t pos = Index->indexed_up_to.pos;
     int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+    Index->num_chunks = num_chunks;
 
     /* Keep indexing while 'healthy' */
     while (Index->health == 0 && chunk < num_chunks && blocks_indexed < MaxBlocks)
     {
-        uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, chunk);
+        blocks_indexed += index_chunk(Index, DataSource, chunk, &pos, MaxBlocks - blocks_indexed);
 
-        while ((pos + sizeof(mlv_block)) < chunk_size && blocks_indexed < MaxBlocks)
+        /* Move on to next chunk once this one is finished */
+        if (pos >= mlv_DataSourceGetChunkSize(DataSource, chunk))
+        {
+            chunk++;
+            pos = 0;
+        }
+        else
         {
+            /* Stopped by MaxBlocks or an error, or in tail mode the rest has
+             * not been written yet */
+            break;
+        }
+    }
+
+    for (uint64_t e = first_new_entry; e < Index->num_entries; ++e)
+        add_entry_to_frame_tables(Index, e);
+
+    set_indexed_up_to(Index, DataSource, chunk, pos, blocks_indexed < MaxBlocks);
+}
+
+/**************** Parallel indexing ****************/
+
+#ifndef LIBMLV_NO_THREADS
+
+/* Passes allocations on to the real allocator one at a time, so that the user
+ * does not need to provide a thread-safe allocator */
+typedef struct {
+    pthread_mutex_t mutex;
+    mlv_Alloc allocator;
+    void * ud;
+} locked_allocator_t;
+
+static void * locked_alloc(void * ud, void * ptr, uint64_t osize, uint64_t nsize)
+{
+    locked_allocator_t * locked = ud;
+    pthread_mutex_lock(&locked->mutex);
+    void * result = locked->allocator(locked->ud, ptr, osize, nsize);
+    pthread_mutex_unlock(&locked->mutex);
+    return result;
+}
+
+/* Shared between indexing threads */
+typedef struct {
+    mlv_DataSource * data_source;
+    /* One index per chunk, entries get moved in to the main index afterwards */
+    mlv_Index ** chunk_indexes;
+    /* Where to start indexing each chunk from */
+    uint64_t first_chunk_pos;
+    int first_chunk;
+    int num_chunks;
+    /* Next chunk that needs a thread to index it */
+    int next_chunk;
+    pthread_mutex_t mutex;
+} parallel_build_t;
+
+static void * parallel_build_thread(void * Arg)
+{
+    parallel_build_t * build = Arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&build->mutex);
+        int chunk = build->next_chunk++;
+        pthread_mutex_unlock(&build->mutex);
+
+        if (chunk >= build->num_chunks) break;
+
+        mlv_Index * chunk_index = build->chunk_indexes[chunk];
+        if (chunk_index == NULL) continue;
+        uint64_t pos = (chunk == build->first_chunk) ? build->first_chunk_pos : 0;
+
+        index_chunk(chunk_index, build->data_source, chunk, &pos, UINT64_MAX);
+
+        chunk_index->indexed_up_to.chunk = chunk;
+        chunk_index->indexed_up_to.pos = pos;
+    }
+
+    return NULL;
+}
+
+/* Appends entries of a chunk's index to the end of the main index. Returns
+ * zero if memory could not be allocated. */
+static int append_chunk_index(mlv_Index * Index, mlv_Index * ChunkIndex)
+{
+    uint64_t num_entries = Index->num_entries + ChunkIndex->num_entries;
+    uint64_t block_data_size = Index->block_data_size + ChunkIndex->block_data_size;
+
+    if (num_entries > Index->num_entries_memory && !resize_entries(Index, num_entries)) return 0;
+    if (block_data_size > Index->block_data_memory && !resize_block_data(Index, block_data_size)) return 0;
+
+    for (uint64_t e = 0; e < ChunkIndex->num_entries; ++e)
+    {
+        uint64_t entry = Index->num_entries + e;
+        Index->block_type[entry] = ChunkIndex->block_type[e];
+        Index->block_size[entry] = ChunkIndex->block_size[e];
+        Index->block_timestamp[entry] = ChunkIndex->block_timestamp[e];
+        Index->block_location[entry] = ChunkIndex->block_location[e];
+        Index->block_data_offset[entry] = ChunkIndex->block_data_offset[e] + Index->block_data_size;
+    }
+
+    for (uint64_t i = 0; i < ChunkIndex->block_data_size; ++i)
+        Index->block_data[Index->block_data_size + i] = ChunkIndex->block_data[i];
+
+    if (ChunkIndex->num_entries > 0) Index->sort_order = INDEX_ORDER_FILE;
+    Index->num_entries = num_entries;
+    Index->block_data_size = block_data_size;
+    return 1;
+}
+
+#endif
+
+void mlv_IndexBuildParallel(mlv_Index * Index,
+                            mlv_DataSource * DataSource,
+                            int NumThreads)
+{
+#ifndef LIBMLV_NO_THREADS
+    int first_chunk = Index->indexed_up_to.chunk;
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+
+    if ( Index->health != 0 || NumThreads < 2 || (num_chunks - first_chunk) < 2
+      || !mlv_DataSourceIsThreadSafe(DataSource) || Index->num_lazy_regions > 0 )
+#else
+    (void)NumThreads;
+#endif
+    {
+        mlv_IndexBuild(Index, DataSource, 0);
+        return;
+    }
+
+#ifndef LIBMLV_NO_THREADS
+    parallel_build_t build = {
+        .data_source = DataSource,
+        .chunk_indexes = mlv_Malloc2(Index, sizeof(mlv_Index *) * num_chunks),
+        .first_chunk_pos = Index->indexed_up_to.pos,
+        .first_chunk = first_chunk,
+        .num_chunks = num_chunks,
+        .next_chunk = first_chunk
+    };
+
+    if (build.chunk_indexes == NULL)
+    {
+        Index->health = 1;
+        return;
+    }
+
+    locked_allocator_t allocator;
+    mlv_GetAllocator(Index, &allocator.allocator, &allocator.ud);
+    pthread_mutex_init(&allocator.mutex, NULL);
+    pthread_mutex_init(&build.mutex, NULL);
+
+    for (int c = first_chunk; c < num_chunks; ++c)
+    {
+        build.chunk_indexes[c] = mlv_newIndex(locked_alloc, &allocator);
+        if (build.chunk_indexes[c] != NULL) build.chunk_indexes[c]->tail_mode = Index->tail_mode;
+    }
+
+    /* This thread does some of the indexing too. If a thread could not be
+     * started, the ones that did start will do its share. */
+    if (NumThreads > num_chunks - first_chunk) NumThreads = num_chunks - first_chunk;
+    pthread_t threads[MLV_MAX_NUM_CHUNKS];
+    int num_started = 0;
+    for (int t = 1; t < NumThreads; ++t)
+        if (pthread_create(&threads[num_started], NULL, parallel_build_thread, &build) == 0)
+            ++num_started;
+
+    parallel_build_thread(&build);
+
+    for (int t = 0; t < num_started; ++t)
+        pthread_join(threads[t], NULL);
+
+    /* Put each chunk's entries in to the main index, in order. Stop at any
+     * chunk that could not be fully indexed, so it can be continued from
+     * there by mlv_IndexBuild. */
+    uint64_t first_new_entry = Index->num_entries;
+    int chunk = first_chunk;
+    uint64_t pos = build.first_chunk_pos;
+
+    int out_of_data = 1;
+
+    for (; chunk < num_chunks && Index->health == 0; ++chunk, pos = 0)
+    {
+        mlv_Index * chunk_index = build.chunk_indexes[chunk];
+        out_of_data = 0;
+        if (chunk_index == NULL) break;
+
+        if (!append_chunk_index(Index, chunk_index))
+        {
+            Index->health = 1;
+            break;
+        }
+
+        pos = chunk_index->indexed_up_to.pos;
+        if (chunk_index->health != 0) break;
+        out_of_data = 1;
+        if (pos < mlv_DataSourceGetChunkSize(DataSource, chunk)) break;
+    }
+
+    for (int c = first_chunk; c < num_chunks; ++c)
+        if (build.chunk_indexes[c] != NULL) mlv_closeIndex(build.chunk_indexes[c]);
+    mlv_Free(build.chunk_indexes);
+    pthread_mutex_destroy(&allocator.mutex);
+    pthread_mutex_destroy(&build.mutex);
+
+    Index->num_chunks = num_chunks;
+    for (uint64_t e = first_new_entry; e < Index->num_entries; ++e)
+        add_entry_to_frame_tables(Index, e);
+
+    set_indexed_up_to(Index, DataSource, chunk, pos, out_of_data);
+#endif
+}
+
+int mlv_IndexIsComplete(mlv_Index * Index)
+{
+    return Index->indexing_is_complete;
+}
+
+void mlv_IndexSetTailMode(mlv_Index * Index, int TailMode)
+{
+    Index->tail_mode = (TailMode != 0);
+}
+
+/**************** Seeking by frame ****************/
+
+static inline int is_block_type_char(uint8_t C)
+{
+    return (C >= 'A' && C <= 'Z') || (C >= '0' && C <= '9');
+}
+
+/* Block types are capital letters and digits */
+static inline int could_be_block(mlv_block * Block)
+{
+    return is_block_type_char(Block->type[0]) && is_block_type_char(Block->type[1])
+        && is_block_type_char(Block->type[2]) && is_block_type_char(Block->type[3])
+        && Block->size >= sizeof(mlv_block);
+}
+
+/* Checks that the blocks from Pos, each starting where the last one ends,
+ * look valid, for RESYNC_CHAIN_LENGTH blocks or ending exactly at the end of
+ * the chunk. Headers within Window (Bytes of the chunk from WindowPos) are
+ * taken from it, only ones after it are read. */
+static int is_block_chain(mlv_DataSource * DataSource,
+                          int Chunk,
+                          uint64_t Pos,
+                          uint8_t * Window,
+                          uint64_t WindowPos,
+                          uint64_t Bytes)
+{
+    uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, Chunk);
+
+    for (int b = 0; b < RESYNC_CHAIN_LENGTH; ++b)
+    {
+        if (Pos == chunk_size) return 1;
+
+        mlv_block block;
+        if (Pos >= WindowPos && Pos + sizeof(block) <= WindowPos + Bytes)
+        {
+            for (size_t i = 0; i < sizeof(block); ++i) ((uint8_t *)&block)[i] = Window[Pos - WindowPos + i];
+        }
+        else if (mlv_DataSourceGetData(DataSource, Chunk, Pos, sizeof(block), &block) != sizeof(block))
+        {
+            return 0;
+        }
+
+        if (!could_be_block(&block) || block.size > chunk_size - Pos) return 0;
+        Pos += block.size;
+    }
+
+    return 1;
+}
+
+/* Scans from Pos of a chunk for where a block starts, a read-ahead window at
+ * a time, returns Limit if no block starts before it */
+static uint64_t find_block_start(mlv_Index * Index,
+                                 mlv_DataSource * DataSource,
+                                 int Chunk,
+                                 uint64_t Pos,
+                                 uint64_t Limit)
+{
+    while (Pos + sizeof(mlv_block) <= Limit)
+    {
+        uint64_t window = Limit - Pos;
+        if (window > READ_AHEAD_SIZE) window = READ_AHEAD_SIZE;
+
+        uint8_t * data = read_ahead(Index, DataSource, Chunk, Pos, window, window);
+        if (data == NULL) break;
+
+        for (uint64_t i = 0; i + sizeof(mlv_block) <= window; ++i)
+        {
+            if (!is_block_type_char(data[i])) continue;
+
             mlv_block block;
+            for (size_t b = 0; b < sizeof(mlv_block); ++b) ((uint8_t *)&block)[b] = data[i + b];
+            if (could_be_block(&block) && is_block_chain(DataSource, Chunk, Pos + i, data, Pos, window))
+                return Pos + i;
+        }
+
+        /* Next window overlaps the end of this one, by less than a header */
+        Pos += window - sizeof(mlv_block) + 1;
+    }
+
+    return Limit;
+}
+
+/* Records a part of a chunk indexed by seeking, joined with any others it
+ * follows on from or leads to. There must be space for it. */
+static void add_lazy_region(mlv_Index * Index, int Chunk, uint64_t Start, uint64_t End)
+{
+    if (End <= Start) return;
+
+    int before = -1, after = -1;
+    for (int r = 0; r < Index->num_lazy_regions; ++r)
+    {
+        if (Index->lazy_regions[r].chunk != Chunk) continue;
+        if (Index->lazy_regions[r].end == Start) before = r;
+        if (Index->lazy_regions[r].start == End) after = r;
+    }
+
+    if (before >= 0 && after >= 0)
+    {
+        Index->lazy_regions[before].end = Index->lazy_regions[after].end;
+        remove_lazy_region(Index, after);
+    }
+    else if (before >= 0)
+    {
+        Index->lazy_regions[before].end = End;
+    }
+    else if (after >= 0)
+    {
+        Index->lazy_regions[after].start = Start;
+    }
+    else
+    {
+        int r = Index->num_lazy_regions++;
+        Index->lazy_regions[r].chunk = Chunk;
+        Index->lazy_regions[r].start = Start;
+        Index->lazy_regions[r].end = End;
+    }
+}
+
+/* A frame's position in the whole clip, as if the chunks were one file */
+typedef struct {
+    uint32_t frame_number;
+    uint64_t pos;
+    int known;
+} known_frame_t;
+
+int64_t mlv_IndexSeekFrame(mlv_Index * Index,
+                           mlv_DataSource * DataSource,
+                           uint8_t * BlockType,
+                           uint64_t FrameNumber)
+{
+    uint32_t block_type = BLOCKTYPE_INT(BlockType);
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+    if ( get_frame_table(Index, block_type) == NULL || num_chunks > MLV_MAX_NUM_CHUNKS
+      || FrameNumber > UINT32_MAX )
+        return -1;
+
+    /* Where each chunk starts in the whole clip */
+    uint64_t chunk_offsets[MLV_MAX_NUM_CHUNKS + 1];
+    chunk_offsets[0] = 0;
+    for (int c = 0; c < num_chunks; ++c)
+        chunk_offsets[c + 1] = chunk_offsets[c] + mlv_DataSourceGetChunkSize(DataSource, c);
 
-            /************ Check stuff ************/
+    for (int attempt = 0; attempt < SEEK_MAX_TRIES; ++attempt)
+    {
+        int64_t entry = mlv_IndexFindEntry(Index, 0, BlockType, 0,0,0, 0,0,0, 1, FrameNumber, 1);
+        if (entry >= 0) return entry;
+
+        if ( Index->health != 0 || Index->indexing_is_complete
+          || Index->num_lazy_regions == MAX_LAZY_REGIONS || Index->indexed_up_to.chunk >= num_chunks )
+            return -1;
+
+        /* Frames nearest either side of the one wanted, and the first and last */
+        known_frame_t below = {0}, above = {0}, first = {0}, last = {0};
+        for (uint64_t e = 0; e < Index->num_entries; ++e)
+        {
+            if (Index->block_type[e] != block_type || !entry_has_frame_number(Index, e)) continue;
+
+            uint64_t location = Index->block_location[e];
+            known_frame_t frame = {
+                entry_frame_number(Index, e),
+                chunk_offsets[BLOCK_LOCATION_CHUNK(location)] + BLOCK_LOCATION_POS(location),
+                1
+            };
+
+            if (!first.known || frame.frame_number < first.frame_number) first = frame;
+            if (!last.known || frame.frame_number > last.frame_number) last = frame;
+            if (frame.frame_number < FrameNumber && (!below.known || frame.frame_number > below.frame_number)) below = frame;
+            if (frame.frame_number > FrameNumber && (!above.known || frame.frame_number < above.frame_number)) above = frame;
+        }
+
+        /* Average size of a frame (with whatever other blocks are between) */
+        double frame_bytes = 0;
+        if (below.known && above.known && above.pos > below.pos)
+            frame_bytes = (double)(above.pos - below.pos) / (above.frame_number - below.frame_number);
+        else if (first.known && last.pos > first.pos)
+            frame_bytes = (double)(last.pos - first.pos) / (last.frame_number - first.frame_number);
+        if (frame_bytes <= 0) return -1;
+
+        /* Aim for half a frame before it, so as to find the block after */
+        known_frame_t * base = below.known ? &below : &above;
+        double estimate = base->pos + ((double)FrameNumber - base->frame_number - 0.5) * frame_bytes;
+
+        /* Near enough to where building is up to that building finds it as
+         * quickly */
+        uint64_t built_up_to = chunk_offsets[Index->indexed_up_to.chunk] + Index->indexed_up_to.pos;
+        if (estimate < built_up_to + SEEK_WALK_FRAMES * frame_bytes) return -1;
+        if (estimate >= chunk_offsets[num_chunks]) estimate = chunk_offsets[num_chunks] - 1;
+
+        int chunk = 0;
+        while (chunk_offsets[chunk + 1] <= (uint64_t)estimate) ++chunk;
+        uint64_t pos = (uint64_t)estimate - chunk_offsets[chunk];
+        uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, chunk);
+
+        /* Carry on from the end of anything already indexed there, otherwise
+         * find the next block, stopping at anything already indexed */
+        int is_block_start = (pos == 0);
+        uint64_t limit = (chunk_size - pos > RESYNC_MAX_SCAN) ? pos + RESYNC_MAX_SCAN : chunk_size;
+        for (int r = 0; r < Index->num_lazy_regions; ++r)
+        {
+            if (Index->lazy_regions[r].chunk != chunk) continue;
+            if (Index->lazy_regions[r].start <= pos && pos < Index->lazy_regions[r].end)
+            {
+                pos = Index->lazy_regions[r].end;
+                is_block_start = 1;
+                r = -1;
+            }
+        }
+        int limit_is_block_start = (limit == chunk_size);
+        for (int r = 0; r < Index->num_lazy_regions; ++r)
+        {
+            if (Index->lazy_regions[r].chunk == chunk && Index->lazy_regions[r].start > pos && Index->lazy_regions[r].start < limit)
+            {
+                limit = Index->lazy_regions[r].start;
+                limit_is_block_start = 1;
+            }
+        }
+
+        if (!is_block_start)
+        {
+            pos = find_block_start(Index, DataSource, chunk, pos, limit);
+            if (pos == limit && !limit_is_block_start) return -1;
+        }
+        if (pos >= chunk_size) return -1;
+
+        /* Index from there until the frame is found, or one after it (the
+         * estimate was too far), or one too far before it to walk to */
+        uint64_t start = pos;
+        uint64_t first_new_entry = Index->num_entries;
+        uint64_t blocks_indexed = 0;
+        int keep_going = 1;
+
+        while (keep_going && blocks_indexed < SEEK_MAX_WALK_BLOCKS && pos < chunk_size && Index->health == 0)
+        {
+            uint64_t last_pos = pos;
+            blocks_indexed += index_chunk(Index, DataSource, chunk, &pos, 1);
+
+            for (uint64_t e = first_new_entry; e < Index->num_entries; ++e)
+            {
+                add_entry_to_frame_tables(Index, e);
+
+                if (Index->block_type[e] != block_type || !entry_has_frame_number(Index, e)) continue;
+                uint32_t frame_number = entry_frame_number(Index, e);
+                if (frame_number >= FrameNumber) keep_going = 0;
+                else if (FrameNumber - frame_number > SEEK_WALK_FRAMES && attempt < SEEK_MAX_TRIES - 1) keep_going = 0;
+            }
+
+            first_new_entry = Index->num_entries;
+            if (pos == last_pos) break;
+        }
+
+        add_lazy_region(Index, chunk, start, pos);
+        Index->has_seeked = 1;
+    }
+
+    return mlv_IndexFindEntry(Index, 0, BlockType, 0,0,0, 0,0,0, 1, FrameNumber, 1);
+}
+
+/**************** Sorting ****************/
+
+/* What entries are sorted by. Sorting these and then moving the columns in to
+ * the same order is easier than sorting all of the columns together. */
+typedef struct {
+    uint32_t type;
+    uint64_t timestamp;
+    uint64_t location;
+    uint64_t entry;
+} entry_sort_key_t;
+
+static int entry_cmp_for_reading(const void * A, const void * B);
+static int entry_cmp_for_storage(const void * A, const void * B);
+
+static void sort_entries(mlv_Index * Index, int (* Compare)(const void *, const void *))
+{
+    uint64_t n = Index->num_entries;
+
+    entry_sort_key_t * keys = mlv_Malloc2(Index, n * sizeof(entry_sort_key_t));
+    uint64_t * temp = mlv_Malloc2(Index, n * sizeof(uint64_t));
+
+    if (keys != NULL && temp != NULL)
+    {
+        for (uint64_t e = 0; e < n; ++e)
+        {
+            keys[e] = (entry_sort_key_t){
+                .type = Index->block_type[e],
+                .timestamp = Index->block_timestamp[e],
+                .location = Index->block_location[e],
+                .entry = e
+            };
+        }
 
-            /* Handle blocks cut off at end of file. TODO: think about this */
-            if ((pos + block.size) > chunk_size)
-            {
-                /* (Temporary?) solution: reduce block's claimed size in index */
-                block.size -= ((pos + block.size) - chunk_size);
-            }
+        // TODO: dont use standard library (maybe make this an option)
+        qsort(keys, n, sizeof(entry_sort_key_t), Compare);
 
-            /* Read the block header, making sure a whole header worth of bytes is read */
-            if (sizeof(mlv_block) != mlv_DataSourceGetData(DataSource, chunk, pos, sizeof(mlv_block), &block))
-            {
-                // STOP!!! couldn't read enough data. Perhaps could still continue with other chunks
-            }
+        /* Put each column in the sorted order, using temp as space */
+        void ** columns[NUM_ENTRY_COLUMNS];
+        uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+        get_entry_columns(Index, columns, element_sizes);
 
-            /* If the block claims to be smaller than possible, the file is fucked */
-            if (block.size < sizeof(block))
+        for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c)
+        {
+            if (element_sizes[c] == sizeof(uint32_t))
             {
-                // STOP!!! TODO: decide if/when continuing to other chunks makes sense
+                uint32_t * column = *columns[c], * sorted = (uint32_t *)temp;
+                for (uint64_t e = 0; e < n; ++e) sorted[e] = column[keys[e].entry];
+                for (uint64_t e = 0; e < n; ++e) column[e] = sorted[e];
             }
-
-            /* Exclude NULL blocks because they take up most of the index sometimes.
-             * Add any other exclusions to this if statement... */
-            int allow_nulls = 0;
-            if (allow_nulls || BLOCKTYPE_INT(block.type) != BLOCKTYPE_INT("NULL"))
+            else
             {
-                /* Size of the block's data excluding the header part (16 bytes) */
-                int data_size = (block.size - sizeof(mlv_block));
-                /* How many parts in the index are needed to represent this (round up) */
-                int parts = (data_size - 1) / ENTRY_BYTES + 1;
-
-                /* If the block is huge, do not store all of it, so just use one entry */
-                if (data_size > MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX) parts = 1;
-
-                for (int part = 0; Index->health == 0 && part < parts; ++part)
-                {
-                    mlv_IndexEntry * entry = new_entry(Index);
-
-                    if (entry == NULL)
-                    {
-                        // STOP!!! allocation error / memory error. Cannot continue at all.
-                        Index->health = 1;
-                    }
-                    else
-                    {
-                        entry->block_chunk = chunk;
-                        entry->block_part = part;
-                        entry->block_pos = pos;
-                        entry->block_size = block.size;
-                        entry->block_timestamp = block.timestamp;
-                        for (int i = 0; i < 4; ++i) entry->block_type[i] = block.type[i];
-
-                        // TODO: check the return of this
-                        mlv_DataSourceGetData(DataSource, chunk, pos + sizeof(mlv_block) + ENTRY_BYTES * part, ENTRY_BYTES, entry->data);
-                    }
-                }
-
-                /* Only count a block if it has been added to the index to make MaxBlocks
-                 * parameter more meaningful (there can be a lot of NULLS sometimes) */
-                ++blocks_indexed;
+                uint64_t * column = *columns[c], * sorted = temp;
+                for (uint64_t e = 0; e < n; ++e) sorted[e] = column[keys[e].entry];
+                for (uint64_t e = 0; e < n; ++e) column[e] = sorted[e];
             }
-
-            pos += block.size;
-
-            // printf("Block %c%c%c%c, size %llu, pos %llu, timestamp %llu, %s\n",
-            //         block.type[0], block.type[1], block.type[2],
-            //         block.type[3], (uint64_t)block.size, pos, block.timestamp,
-            //         (data_size <= MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX) ? "Fully stored in index" : "");
         }
 
-        /* DONE????????? TODO: make these only increment IF the chunk has been finished.
-         * Currently this will go up every time this function is called which is
-         * incorrect */
-        if (pos >= chunk_size)
-        {
-            chunk++; /* DONE??? */
-            pos = 0;
-        }
+        rebuild_frame_tables(Index);
     }
 
-    Index->indexed_up_to.chunk = chunk;
-    Index->indexed_up_to.pos = pos;
-    if (chunk == num_chunks) Index->indexing_is_complete = 1;
-}
-
-int mlv_IndexIsComplete(mlv_Index * Index)
-{
-    return Index->indexing_is_complete;
+    if (keys != NULL) mlv_Free(keys);
+    if (temp != NULL) mlv_Free(temp);
 }
 
-static inline int entry_cmp_for_reading(mlv_IndexEntry * A, mlv_IndexEntry * B);
-
 void mlv_IndexOptimise(mlv_Index * Index)
 {
     // Sort the index for faster block finding.
-    // TODO: dont use standard library (maybe make this an option)
     if (Index->health == 0)
-        qsort(Index->entries, Index->num_entries, sizeof(mlv_IndexEntry), entry_cmp_for_reading);
+    {
+        sort_entries(Index, entry_cmp_for_reading);
+        Index->sort_order = INDEX_ORDER_READING;
+    }
 }
 
-static inline int entry_cmp_for_storage(mlv_IndexEntry * A, mlv_IndexEntry * B);
-
 void mlv_IndexOptimiseForStorage(mlv_Index * Index)
 {
     if (Index->health == 0)
-        qsort(Index->entries, Index->num_entries, sizeof(mlv_IndexEntry), entry_cmp_for_storage);
+    {
+        sort_entries(Index, entry_cmp_for_storage);
+        Index->sort_order = INDEX_ORDER_STORAGE;
+    }
+}
+
+/**************** Searching ****************/
+
+/* Binary search for when the index is sorted for reading. Returns the first
+ * entry that sorts after (BlockType, Timestamp), or if OrEqual is not set,
+ * the first entry that does not sort before it. */
+static uint64_t search_sorted_entries(mlv_Index * Index, uint32_t BlockType, uint64_t Timestamp, int OrEqual)
+{
+    uint64_t low = 0;
+    uint64_t high = Index->num_entries;
+
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        uint32_t type = Index->block_type[middle];
+        uint64_t timestamp = Index->block_timestamp[middle];
+
+        int before = (type < BlockType) || (type == BlockType && (timestamp < Timestamp
+                                                              || (OrEqual && timestamp == Timestamp)));
+        if (before) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+/* Returns the first entry from Entry of a type, or End if there isn't one.
+ * When the next few don't match, the type column is compared 8 entries at a
+ * time without branching, which compilers turn in to vector compares. */
+static inline uint64_t next_entry_of_type(uint32_t * Types, uint64_t Entry, uint64_t End, uint32_t Type)
+{
+    if (Entry >= End) return End;
+
+    /* Usually frames, which are every other entry or so */
+    for (uint64_t stop = (End - Entry > 8) ? Entry + 8 : End; Entry < stop; ++Entry)
+        if (Types[Entry] == Type) return Entry;
+
+    while (Entry + 8 <= End)
+    {
+        int any = 0;
+        for (int i = 0; i < 8; ++i) any |= (Types[Entry + i] == Type);
+        if (any) break;
+        Entry += 8;
+    }
+
+    while (Entry < End && Types[Entry] != Type) ++Entry;
+    return Entry;
 }
 
-static inline int does_entry_match(mlv_IndexEntry * Entry,
+static inline int does_entry_match(mlv_Index * Index, uint64_t EntryID,
                                    uint32_t BlockType,
                                    int UseBlockSize, uint32_t MinBlockSize, uint32_t MaxBlockSize,
                                    int UseTimeStamp, uint64_t MinTimestamp, uint64_t MaxTimestamp,
                                    int UseFrameNumber, uint32_t FrameNumber)
 {
-    return (!BlockType || (BLOCKTYPE_INT(Entry->block_type) == BlockType))
-        && (!UseBlockSize || (Entry->block_size >= MinBlockSize && Entry->block_size <= MaxBlockSize))
-        && (!UseTimeStamp || (Entry->block_timestamp >= MinTimestamp && Entry->block_timestamp <= MaxTimestamp))
-        && (!UseFrameNumber || *((uint32_t *)Entry->data) == FrameNumber); /* Frame number is first uint32 after the block header in both VIDF and AUDF */
+    return !entry_is_removed(Index, EntryID)
+        && (!BlockType || (Index->block_type[EntryID] == BlockType))
+        && (!UseBlockSize || (Index->block_size[EntryID] >= MinBlockSize && Index->block_size[EntryID] <= MaxBlockSize))
+        && (!UseTimeStamp || (Index->block_timestamp[EntryID] >= MinTimestamp && Index->block_timestamp[EntryID] <= MaxTimestamp))
+        && (!UseFrameNumber || (entry_has_frame_number(Index, EntryID) && entry_frame_number(Index, EntryID) == FrameNumber));
 }
 
 int64_t mlv_IndexFindEntry( mlv_Index * Index,
@@ -280,13 +1331,55 @@ int64_t mlv_IndexFindEntry( mlv_Index * Index,
     uint32_t block_type = 0;
     if (BlockType != NULL) block_type = BLOCKTYPE_INT(BlockType);
 
+    /* VIDF and AUDF can be found by frame number straight from the frame
+     * table, if it is the first match being asked for */
+    mlv_FrameTable * frame_table = get_frame_table(Index, block_type);
+    if (UseFrameNumber && frame_table != NULL && EntryNumber == 1)
+    {
+        int64_t frame_entry = (FrameNumber < frame_table->size) ? frame_table->entries[FrameNumber] : -1;
+
+        if (frame_entry >= 0 && (uint64_t)frame_entry >= StartPos
+         && does_entry_match(Index, frame_entry, block_type,
+                             UseBlockSize, MinBlockSize, MaxBlockSize,
+                             UseTimeStamp, MinTimestamp, MaxTimestamp,
+                             UseFrameNumber, FrameNumber))
+        {
+            return frame_entry;
+        }
+        else if (frame_entry < 0 && frame_table->complete)
+        {
+            return -1;
+        }
+
+        /* Otherwise there may be another block with the same frame number
+         * that does match, so search through entries */
+    }
+
     uint64_t entry = StartPos;
+    uint64_t end = Index->num_entries;
     uint64_t num_matches = 0;
     int64_t match_at = -1;
 
-    while (entry < Index->num_entries && num_matches != EntryNumber)
+    /* When sorted for reading, only the range of entries with the right type
+     * and timestamp needs to be searched, which can be found by bisection */
+    if (Index->sort_order == INDEX_ORDER_READING && block_type != 0)
+    {
+        uint64_t first = search_sorted_entries(Index, block_type, UseTimeStamp ? MinTimestamp : 0, 0);
+        end = search_sorted_entries(Index, block_type, UseTimeStamp ? MaxTimestamp : UINT64_MAX, 1);
+        if (first > entry) entry = first;
+    }
+
+    while (entry < end && num_matches != EntryNumber)
     {
-        if (does_entry_match(&Index->entries[entry], block_type,
+        /* Skip ahead through the type column, as that is all that's needed
+         * to rule out most entries */
+        if (block_type != 0)
+        {
+            entry = next_entry_of_type(Index->block_type, entry, end, block_type);
+            if (entry == end) break;
+        }
+
+        if (does_entry_match(Index, entry, block_type,
                              UseBlockSize, MinBlockSize, MaxBlockSize,
                              UseTimeStamp, MinTimestamp, MaxTimestamp,
                              UseFrameNumber, FrameNumber))
@@ -295,24 +1388,54 @@ int64_t mlv_IndexFindEntry( mlv_Index * Index,
             match_at = entry;
         }
 
-        /* Now skip to next block in entries, skipping any additional entries for the same block. */
-        do { ++entry; } while (entry < Index->num_entries && Index->entries[entry].block_part != 0);
+        ++entry;
     }
 
     return match_at;
 }
 
-int64_t mlv_IndexGetNextEntry(mlv_Index * Index, uint64_t EntryID)
+int64_t mlv_IndexFindEntryBefore(mlv_Index * Index,
+                                 uint8_t * BlockType,
+                                 uint64_t Timestamp)
 {
-    int64_t next = -1;
+    /* NULL for any type, as with mlv_IndexFindEntry */
+    uint32_t block_type = 0;
+    if (BlockType != NULL) block_type = BLOCKTYPE_INT(BlockType);
+    int64_t found = -1;
 
-    int64_t entry = EntryID;
-    do {
-        ++entry;
-    } while (entry < Index->num_entries && Index->entries[entry].block_part != 0);
+    /* Sorting groups entries by type, so any type has to be searched for */
+    if (Index->sort_order == INDEX_ORDER_READING && block_type != 0)
+    {
+        /* Last entry at or before the timestamp */
+        int64_t entry = (int64_t)search_sorted_entries(Index, block_type, Timestamp, 1) - 1;
+
+        if (entry >= 0 && Index->block_type[entry] == block_type)
+            found = entry;
+    }
+    else
+    {
+        for (uint64_t entry = 0; entry < Index->num_entries; ++entry)
+        {
+            if ( (block_type == 0 || Index->block_type[entry] == block_type)
+              && !entry_is_removed(Index, entry)
+              && Index->block_timestamp[entry] <= Timestamp
+              && (found < 0 || Index->block_timestamp[entry] >= Index->block_timestamp[found]) )
+            {
+                found = entry;
+            }
+        }
+    }
+
+    return found;
+}
+
+int64_t mlv_IndexGetNextEntry(mlv_Index * Index, uint64_t EntryID)
+{
+    uint64_t entry = EntryID + 1;
+    while (entry < Index->num_entries && entry_is_removed(Index, entry)) ++entry;
 
-    if (entry < Index->num_entries) next = entry;
-    return next;
+    if (entry < Index->num_entries) return entry;
+    else return -1;
 }
 
 /**************** mlv_IndexGetBlockData implementation ****************/
@@ -322,14 +1445,14 @@ typedef struct {
     uint32_t num_bytes;
 } data_fragment_t;
 
-/* Returns number of copied bytes. TODO: confirm this isn't broken. */
+/* Returns number of copied bytes. */
 static uint32_t copy_fragmented_data(data_fragment_t * Fragments, int NumFragments, uint32_t Offset, uint32_t BytesToCopy, uint8_t * Output)
 {
     int fragments_left = NumFragments;
     data_fragment_t * fragment = Fragments;
 
     /* Skip first fragments */
-    while (Offset > fragment->num_bytes && fragments_left > 0)
+    while (fragments_left > 0 && Offset >= fragment->num_bytes)
     {
         Offset -= fragment->num_bytes;
         fragment += 1;
@@ -345,7 +1468,7 @@ static uint32_t copy_fragmented_data(data_fragment_t * Fragments, int NumFragmen
         uint32_t bytes_this_fragment = fragment->num_bytes - Offset;
         if (bytes_left < bytes_this_fragment) bytes_this_fragment = bytes_left;
 
-        for (uint32_t i = 0; i < bytes_this_fragment; ++i) Output[i] = fragment->data[i];
+        for (uint32_t i = 0; i < bytes_this_fragment; ++i) Output[i] = fragment->data[Offset+i];
 
         Output += bytes_this_fragment;
         bytes_copied += bytes_this_fragment;
@@ -358,12 +1481,6 @@ static uint32_t copy_fragmented_data(data_fragment_t * Fragments, int NumFragmen
     return bytes_copied;
 }
 
-/* Checks if two entries are representing the same block */
-static inline int is_entry_same_block(mlv_IndexEntry * A, mlv_IndexEntry * B)
-{
-    return (A->block_chunk == B->block_chunk) && (A->block_pos == B->block_pos);
-}
-
 uint32_t mlv_IndexGetBlockData(mlv_Index * Index,
                                uint64_t EntryID,
                                uint32_t Offset,
@@ -371,55 +1488,36 @@ uint32_t mlv_IndexGetBlockData(mlv_Index * Index,
                                void * Out,
                                mlv_DataSource * DataSource)
 {
-    mlv_IndexEntry * entry = &Index->entries[EntryID];
-    uint8_t * t = entry->block_type;
+    uint8_t type[4];
+    mlv_IndexGetBlockType(Index, EntryID, type);
 
     /* Reconstruct the block's first 16 bytes */
     mlv_block block_header = {
-        .type = {t[0],t[1],t[2],t[3]},
-        .size = entry->block_size,
-        .timestamp = entry->block_timestamp
+        .type = {type[0],type[1],type[2],type[3]},
+        .size = Index->block_size[EntryID],
+        .timestamp = Index->block_timestamp[EntryID]
     };
 
-    /* This should be enough. Watch out! - It might stop being enough if
-     * MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX is significantly increased!!!! */
-#define MAX_FRAGMENTS 11
-    /* A nice error to help out... */
-#if MAX_FRAGMENTS < ((MAX_BLOCK_SIZE_TO_FULLY_STORE_IN_INDEX-16)/ENTRY_BYTES+1)
-#error Not enough fragments to represent data stored in index!\
- May cause unnecessary file reads and is wasteful. Increase the number of fragments.
-#endif
-
-    int num_fragments = 1;
-    data_fragment_t data_fragments[MAX_FRAGMENTS] = {
+    /* The header, then whatever of the block's data is in the index */
+    data_fragment_t data_fragments[2] = {
         {
-            .data = &block_header,
+            .data = (uint8_t *)&block_header,
             .num_bytes = sizeof(mlv_block)
-        }
-    };
-
-    /* Add all index entries as fragments... */
-    uint64_t entry_id = EntryID;
-    if (Offset+NumBytes > sizeof(mlv_block))
-    {
-        while (entry_id < Index->num_entries && is_entry_same_block(entry, &Index->entries[entry_id]) && num_fragments < MAX_FRAGMENTS)
+        },
         {
-            data_fragments[num_fragments] = (data_fragment_t){
-                .data = Index->entries[entry_id].data,
-                .num_bytes = sizeof(Index->entries[entry_id].data)
-            };
-            ++num_fragments;
-            ++entry_id;
+            .data = Index->block_data + Index->block_data_offset[EntryID],
+            .num_bytes = stored_data_size(block_header.size)
         }
-    }
+    };
 
-    uint64_t bytes_copied = copy_fragmented_data(data_fragments, num_fragments, Offset, NumBytes, Out);
+    uint64_t bytes_copied = copy_fragmented_data(data_fragments, 2, Offset, NumBytes, Out);
 
     if (bytes_copied != NumBytes && DataSource != NULL)
     {
         /* Read the rest from the file now. */
-        bytes_copied += mlv_DataSourceGetData(DataSource, entry->block_chunk,
-                                              entry->block_pos+Offset+bytes_copied,
+        uint64_t location = Index->block_location[EntryID];
+        bytes_copied += mlv_DataSourceGetData(DataSource, BLOCK_LOCATION_CHUNK(location),
+                                              BLOCK_LOCATION_POS(location)+Offset+bytes_copied,
                                               NumBytes-bytes_copied,
                                               ((uint8_t *)Out)+bytes_copied);
     }
@@ -430,7 +1528,7 @@ uint32_t mlv_IndexGetBlockData(mlv_Index * Index,
 uint32_t mlv_IndexGetBlockSize(mlv_Index * Index,
                                uint64_t EntryID)
 {
-    return Index->entries[EntryID].block_size;
+    return Index->block_size[EntryID];
 }
 
 void mlv_IndexGetBlockLocation(mlv_Index * Index,
@@ -438,48 +1536,59 @@ void mlv_IndexGetBlockLocation(mlv_Index * Index,
                                int * ChunkOut,
                                uint64_t * PosOut)
 {
-    *ChunkOut = Index->entries[EntryID].block_chunk;
-    *PosOut = Index->entries[EntryID].block_pos;
+    *ChunkOut = BLOCK_LOCATION_CHUNK(Index->block_location[EntryID]);
+    *PosOut = BLOCK_LOCATION_POS(Index->block_location[EntryID]);
 }
 
 uint64_t mlv_IndexGetBlockTimestamp(mlv_Index * Index,
                                     int64_t EntryID)
 {
-    return Index->entries[EntryID].block_timestamp;
+    return Index->block_timestamp[EntryID];
 }
 
 void mlv_IndexGetBlockType(mlv_Index * Index,
                            int64_t EntryID,
                            uint8_t * Out)
 {
-    for (int i = 0; i < 4; ++i) Out[i] = Index->entries[EntryID].block_type[i];
+    uint32_t type = Index->block_type[EntryID];
+    for (int i = 0; i < 4; ++i) Out[i] = type >> (24 - i*8);
 }
 
 uint64_t mlv_IndexGetSize(mlv_Index * Index)
 {
-    return (Index->num_entries*sizeof(mlv_IndexEntry)) + sizeof(mlv_Index);
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+
+    uint64_t entry_size = 0;
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c) entry_size += element_sizes[c];
+
+    return (Index->num_entries*entry_size) + Index->block_data_size + sizeof(mlv_Index)
+         + (Index->video_frames.size + Index->audio_frames.size) * sizeof(int64_t);
 }
 
 /* Comparison methods for sorting and searching the index */
 
-static inline int entry_cmp_for_reading(mlv_IndexEntry * A, mlv_IndexEntry * B)
+static int entry_cmp_for_reading(const void * KeyA, const void * KeyB)
 {
+    const entry_sort_key_t * A = KeyA;
+    const entry_sort_key_t * B = KeyB;
+
     /* Primarily sort by block type */
-    uint32_t type_of_a = BLOCKTYPE_INT(A->block_type);
-    uint32_t type_of_b = BLOCKTYPE_INT(B->block_type);
-    if (type_of_a > type_of_b) return 1;
-    else if (type_of_a < type_of_b) return -1;
+    if (A->type > B->type) return 1;
+    else if (A->type < B->type) return -1;
 
     /* Then sort by timestamp */
-    if (A->block_timestamp > B->block_timestamp) return 1;
-    else if (A->block_timestamp < B->block_timestamp) return -1;
+    if (A->timestamp > B->timestamp) return 1;
+    else if (A->timestamp < B->timestamp) return -1;
 
-    /* Then sort by which part of the entry */
-    if (A->block_part > B->block_part) return 1;
-    else if (A->block_part < B->block_part) return -1;
+    /* Then by location, so blocks with equal timestamps (such as the MLVI in
+     * each chunk) always end up in the same order */
+    if (A->location > B->location) return 1;
+    else if (A->location < B->location) return -1;
 
     /* If we've reached here, two entries are essentially are the same,
-     * and probably means an identical block was written to the MLV, or 
+     * and probably means an identical block was written to the MLV, or
      * something is very wrong */
     return 0;
 }
@@ -495,29 +1604,28 @@ static inline int is_MLVI(uint32_t type)
 }
 
 /* Optimal sort for storage */
-static inline int entry_cmp_for_storage(mlv_IndexEntry * A, mlv_IndexEntry * B)
+static int entry_cmp_for_storage(const void * KeyA, const void * KeyB)
 {
-    /* Primarily sort by block type */
-    uint32_t type_of_a = BLOCKTYPE_INT(A->block_type);
-    uint32_t type_of_b = BLOCKTYPE_INT(B->block_type);
+    const entry_sort_key_t * A = KeyA;
+    const entry_sort_key_t * B = KeyB;
 
     /* Puts everything before frame (audio and video) data, and MLVI first. */
-    type_of_a = is_frame(type_of_a) ? 2 : (is_MLVI(type_of_a) ? 0 : 1);
-    type_of_b = is_frame(type_of_b) ? 2 : (is_MLVI(type_of_b) ? 0 : 1);
+    uint32_t type_of_a = is_frame(A->type) ? 2 : (is_MLVI(A->type) ? 0 : 1);
+    uint32_t type_of_b = is_frame(B->type) ? 2 : (is_MLVI(B->type) ? 0 : 1);
 
     if (type_of_a > type_of_b) return 1;
     else if (type_of_a < type_of_b) return -1;
 
     /* Then sort by timestamp */
-    if (A->block_timestamp > B->block_timestamp) return 1;
-    else if (A->block_timestamp < B->block_timestamp) return -1;
+    if (A->timestamp > B->timestamp) return 1;
+    else if (A->timestamp < B->timestamp) return -1;
 
-    /* Then sort by which part of the entry */
-    if (A->block_part > B->block_part) return 1;
-    else if (A->block_part < B->block_part) return -1;
+    /* Then by location */
+    if (A->location > B->location) return 1;
+    else if (A->location < B->location) return -1;
 
     /* If we've reached here, two entries are essentially are the same,
-     * and probably means an identical block was written to the MLV, or 
+     * and probably means an identical block was written to the MLV, or
      * something is very wrong */
     return 0;
 }
@@ -532,29 +1640,526 @@ static inline int entry_cmp_for_storage(mlv_IndexEntry * A, mlv_IndexEntry * B)
 
 
 
+/**************** Reading many blocks ****************/
 
+/* Memory mlv_IndexReadBlocks reads in to if not told, and most reads it can
+ * keep going at once */
+#define READ_BLOCKS_BUFFER_SIZE (64*1024*1024)
+#define READ_BLOCKS_MAX_QUEUE_DEPTH 256
 
+/* Blocks are put in the buffer at multiples of this (in memory, not just from
+ * the start of the buffer) */
+#define READ_BLOCKS_ALIGNMENT 64
+#define ALIGN_READ(X) (((X) + READ_BLOCKS_ALIGNMENT - 1) & ~(uint64_t)(READ_BLOCKS_ALIGNMENT - 1))
 
+typedef struct
+{
+    uint64_t offset; /* In the buffer */
+    uint32_t size;
+    uint64_t bytes_read;
+    int done;
+} block_read_t;
+
+/* Reads First up to Next are in the buffer in order, wrapping round to the
+ * start when they get to the end, like a ring buffer. Returns where Size more
+ * bytes can go after them, or BufferSize if there is no space. */
+static uint64_t find_read_space(block_read_t * Reads, int QueueDepth,
+                                uint64_t First, uint64_t Next,
+                                uint64_t BufferSize, uint64_t Size)
+{
+    if (First == Next) return (Size <= BufferSize) ? 0 : BufferSize;
 
+    block_read_t * last = Reads + (Next - 1) % QueueDepth;
+    uint64_t start = Reads[First % QueueDepth].offset;
+    uint64_t end = ALIGN_READ(last->offset + last->size);
 
+    if (end > start)
+    {
+        if (end + Size <= BufferSize) return end;
+        if (Size <= start) return 0;
+    }
+    else if (end + Size <= start) return end;
 
+    return BufferSize;
+}
 
-void mlv_IndexPrint(mlv_Index * Index)
+uint64_t mlv_IndexReadBlocks(mlv_Index * Index,
+                             mlv_DataSource * DataSource,
+                             int64_t * EntryIDs,
+                             uint64_t NumEntries,
+                             int QueueDepth,
+                             uint64_t BufferSize,
+                             mlv_BlockCallback Callback,
+                             void * CallbackUD)
 {
-    for (uint64_t i = 0; i < Index->num_entries; ++i)
+    if (NumEntries == 0) return 0;
+
+    if (QueueDepth < 1) QueueDepth = 1;
+    if (QueueDepth > READ_BLOCKS_MAX_QUEUE_DEPTH) QueueDepth = READ_BLOCKS_MAX_QUEUE_DEPTH;
+    BufferSize = ALIGN_READ((BufferSize > 0) ? BufferSize : READ_BLOCKS_BUFFER_SIZE);
+
+    block_read_t * reads = mlv_Malloc2(Index, sizeof(block_read_t) * QueueDepth);
+    uint8_t * memory = mlv_Malloc2(Index, BufferSize + READ_BLOCKS_ALIGNMENT);
+    uint8_t * buffer = (uint8_t *)ALIGN_READ((uintptr_t)memory);
+    int failed = (reads == NULL || memory == NULL);
+
+    if (!failed) mlv_DataSourceRegisterReadBuffer(DataSource, buffer, BufferSize);
+
+    /* Blocks before first have been passed to the callback, and reads for
+     * blocks before next have been started */
+    uint64_t first = 0, next = 0;
+
+    while (first < NumEntries && !failed)
     {
-        mlv_IndexEntry entry = Index->entries[i];
-        if (entry.block_part != 0) printf(" | P%i", entry.block_part);
-        else
+        while (next < NumEntries && next - first < (uint64_t)QueueDepth)
+        {
+            int64_t entry = EntryIDs[next];
+            uint32_t size = Index->block_size[entry];
+            uint64_t offset = find_read_space(reads, QueueDepth, first, next, BufferSize, size);
+            if (offset == BufferSize) break;
+
+            block_read_t * read = reads + next % QueueDepth;
+            read->offset = offset;
+            read->size = size;
+            read->bytes_read = 0;
+            read->done = 0;
+
+            uint64_t location = Index->block_location[entry];
+            if (!mlv_DataSourceSubmitRead(DataSource, BLOCK_LOCATION_CHUNK(location), BLOCK_LOCATION_POS(location),
+                                          size, buffer + offset, next))
+            {
+                failed = 1;
+                break;
+            }
+
+            next++;
+        }
+
+        if (failed) break;
+
+        /* Nothing is being read, so the block is bigger than the buffer */
+        if (first == next)
+        {
+            uint64_t size = ALIGN_READ(Index->block_size[EntryIDs[next]]);
+            mlv_DataSourceRegisterReadBuffer(DataSource, NULL, 0);
+            uint8_t * bigger_memory = mlv_Realloc(memory, size + READ_BLOCKS_ALIGNMENT);
+            if (bigger_memory == NULL) break;
+            memory = bigger_memory;
+            buffer = (uint8_t *)ALIGN_READ((uintptr_t)memory);
+            BufferSize = size;
+            mlv_DataSourceRegisterReadBuffer(DataSource, buffer, BufferSize);
+            continue;
+        }
+
+        /* Blocks are passed on in order, as soon as they are read */
+        block_read_t * read = reads + first % QueueDepth;
+        if (read->done)
+        {
+            if ( read->bytes_read != read->size
+              || !Callback(CallbackUD, first, EntryIDs[first], buffer + read->offset, read->size) )
+                failed = 1;
+            else
+                first++;
+            continue;
+        }
+
+        uint64_t tags[READ_BLOCKS_MAX_QUEUE_DEPTH], bytes_read[READ_BLOCKS_MAX_QUEUE_DEPTH];
+        int num_reads = mlv_DataSourceCompleteReads(DataSource, 1, QueueDepth, tags, bytes_read);
+        if (num_reads <= 0) failed = 1;
+
+        for (int r = 0; r < num_reads; ++r)
+        {
+            reads[tags[r] % QueueDepth].done = 1;
+            reads[tags[r] % QueueDepth].bytes_read = bytes_read[r];
+        }
+    }
+
+    /* Reads still going must finish before their memory is freed */
+    while (mlv_DataSourceGetNumOutstandingReads(DataSource) > 0)
+    {
+        uint64_t tags[READ_BLOCKS_MAX_QUEUE_DEPTH], bytes_read[READ_BLOCKS_MAX_QUEUE_DEPTH];
+        if (mlv_DataSourceCompleteReads(DataSource, 1, READ_BLOCKS_MAX_QUEUE_DEPTH, tags, bytes_read) <= 0) break;
+    }
+
+    if (memory != NULL)
+    {
+        mlv_DataSourceRegisterReadBuffer(DataSource, NULL, 0);
+        mlv_Free(memory);
+    }
+    if (reads != NULL) mlv_Free(reads);
+
+    return first;
+}
+
+/**************** Saving and loading ****************/
+
+/* Index files are made of MLV blocks: the clip's MLVI block and an XREF block
+ * (so they are also valid Magic Lantern .IDX files), then a LIDX block with
+ * everything in mlv_Index, so it can be loaded without indexing again. */
+
+#define INDEX_FILE_VERSION 1
+
+/* The LIDX block's header, followed by an index_file_chunk_t for each chunk,
+ * the entry columns one after another, then block data */
+typedef struct {
+    uint8_t block_type[4];
+    uint32_t block_size;
+    uint64_t timestamp;
+    uint32_t version;
+    uint32_t num_chunks;
+    uint64_t num_entries;
+    uint64_t block_data_size;
+    uint64_t indexed_up_to_pos;
+    uint8_t indexed_up_to_chunk;
+    uint8_t indexing_is_complete;
+    uint8_t sort_order;
+    uint8_t reserved[5];
+} index_file_header_t;
+
+/* So that loading can tell if the clip has changed since it was saved */
+typedef struct {
+    uint64_t size;
+    uint64_t modification_time;
+} index_file_chunk_t;
+
+/* Keeps track of position and errors while writing the index file */
+typedef struct {
+    mlv_Writer writer;
+    void * ud;
+    uint64_t pos;
+    int error;
+} index_file_writer_t;
+
+static void write_index_file(index_file_writer_t * File, void * Data, uint64_t Bytes)
+{
+    if (!File->error && File->writer(File->ud, File->pos, Bytes, Data) != Bytes) File->error = 1;
+    File->pos += Bytes;
+}
+
+/* Size of the LIDX block for an index with this many chunks/entries/data */
+static uint64_t lidx_block_size(mlv_Index * Index, uint64_t NumChunks, uint64_t NumEntries, uint64_t BlockDataSize)
+{
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+
+    uint64_t entry_size = 0;
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c) entry_size += element_sizes[c];
+
+    return sizeof(index_file_header_t) + NumChunks * sizeof(index_file_chunk_t) + NumEntries * entry_size + BlockDataSize;
+}
+
+static int xref_cmp(const void * A, const void * B)
+{
+    const entry_sort_key_t * a = A;
+    const entry_sort_key_t * b = B;
+    if (a->timestamp > b->timestamp) return 1;
+    else if (a->timestamp < b->timestamp) return -1;
+    else if (a->location > b->location) return 1;
+    else if (a->location < b->location) return -1;
+    return 0;
+}
+
+/* Writes XREF block, with all VIDF and AUDF entries in order of timestamp */
+static void write_xref_block(mlv_Index * Index, index_file_writer_t * File)
+{
+    uint64_t num_frames = 0;
+    for (uint64_t e = 0; e < Index->num_entries; ++e)
+        if (is_frame(Index->block_type[e])) ++num_frames;
+
+    entry_sort_key_t * frames = mlv_Malloc2(Index, num_frames * sizeof(entry_sort_key_t));
+    if (frames == NULL)
+    {
+        File->error = 1;
+        return;
+    }
+
+    uint32_t frame_type = 0;
+    uint64_t f = 0;
+    for (uint64_t e = 0; e < Index->num_entries; ++e)
+    {
+        if (is_frame(Index->block_type[e]))
+        {
+            frames[f++] = (entry_sort_key_t){
+                .type = Index->block_type[e],
+                .timestamp = Index->block_timestamp[e],
+                .location = Index->block_location[e],
+                .entry = e
+            };
+            frame_type |= (Index->block_type[e] == BLOCKTYPE_INT("VIDF")) ? MLV_FRAME_VIDF : MLV_FRAME_AUDF;
+        }
+    }
+
+    qsort(frames, num_frames, sizeof(entry_sort_key_t), xref_cmp);
+
+    mlv_xref_hdr_t xref_header = {
+        .blockType = {'X','R','E','F'},
+        .blockSize = sizeof(mlv_xref_hdr_t) + num_frames * sizeof(mlv_xref_t),
+        .timestamp = 0,
+        .frameType = frame_type,
+        .entryCount = num_frames
+    };
+    write_index_file(File, &xref_header, sizeof(xref_header));
+
+    for (f = 0; f < num_frames; ++f)
+    {
+        mlv_xref_t xref = {
+            .fileNumber = BLOCK_LOCATION_CHUNK(frames[f].location),
+            .empty = 0,
+            .frameType = (frames[f].type == BLOCKTYPE_INT("VIDF")) ? MLV_FRAME_VIDF : MLV_FRAME_AUDF,
+            .frameOffset = BLOCK_LOCATION_POS(frames[f].location)
+        };
+        write_index_file(File, &xref, sizeof(xref));
+    }
+
+    mlv_Free(frames);
+}
+
+int mlv_IndexSave(mlv_Index * Index,
+                  mlv_DataSource * DataSource,
+                  mlv_Writer Writer,
+                  void * WriterUD)
+{
+    /* Parts indexed by seeking can't be saved, as building would not know to
+     * skip them after loading */
+    if (Index->health != 0 || Index->num_lazy_regions > 0) return 0;
+
+    index_file_writer_t file = {Writer, WriterUD, 0, 0};
+
+    /* MLVI block from the first chunk, always fully stored in the index */
+    int64_t mlvi_entry = -1;
+    for (uint64_t e = 0; e < Index->num_entries && mlvi_entry < 0; ++e)
+        if (is_MLVI(Index->block_type[e]) && BLOCK_LOCATION_CHUNK(Index->block_location[e]) == 0)
+            mlvi_entry = e;
+
+    if (mlvi_entry >= 0)
+    {
+        mlv_file_hdr_t mlvi;
+        if (mlv_IndexGetBlockData(Index, mlvi_entry, 0, sizeof(mlvi), &mlvi, NULL) == sizeof(mlvi))
+        {
+            mlvi.blockSize = sizeof(mlvi);
+            write_index_file(&file, &mlvi, sizeof(mlvi));
+        }
+    }
+
+    write_xref_block(Index, &file);
+
+    /* LIDX block */
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+    uint64_t block_size = lidx_block_size(Index, num_chunks, Index->num_entries, Index->block_data_size);
+    if (block_size > UINT32_MAX) return 0;
+
+    index_file_header_t header = {
+        .block_type = {'L','I','D','X'},
+        .block_size = block_size,
+        .timestamp = 0,
+        .version = INDEX_FILE_VERSION,
+        .num_chunks = num_chunks,
+        .num_entries = Index->num_entries,
+        .block_data_size = Index->block_data_size,
+        .indexed_up_to_pos = Index->indexed_up_to.pos,
+        .indexed_up_to_chunk = Index->indexed_up_to.chunk,
+        .indexing_is_complete = Index->indexing_is_complete,
+        .sort_order = Index->sort_order
+    };
+    write_index_file(&file, &header, sizeof(header));
+
+    for (int c = 0; c < num_chunks; ++c)
+    {
+        index_file_chunk_t chunk = {
+            .size = mlv_DataSourceGetChunkSize(DataSource, c),
+            .modification_time = mlv_DataSourceGetChunkModificationTime(DataSource, c)
+        };
+        write_index_file(&file, &chunk, sizeof(chunk));
+    }
+
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+    for (int c = 0; c < NUM_ENTRY_COLUMNS; ++c)
+        write_index_file(&file, *columns[c], Index->num_entries * element_sizes[c]);
+
+    write_index_file(&file, Index->block_data, Index->block_data_size);
+
+    return !file.error;
+}
+
+/* Checks that loaded entries all point to somewhere that exists */
+static int are_loaded_entries_valid(mlv_Index * Index, mlv_DataSource * DataSource)
+{
+    for (uint64_t e = 0; e < Index->num_entries; ++e)
+    {
+        uint64_t location = Index->block_location[e];
+        int chunk = BLOCK_LOCATION_CHUNK(location);
+        uint32_t block_size = Index->block_size[e];
+
+        /* Removed entries don't point anywhere */
+        if (entry_is_removed(Index, e))
         {
-            int use_mb = entry.block_size >= (1024*1024*0.2);
-            char size_string[100];
-            if (use_mb) sprintf(size_string, "%.1lf MiB", (double)entry.block_size/(1024.0*1024.0));
-            else sprintf(size_string, "%llu bytes", (uint64_t)entry.block_size);
-            printf("\nBlock %c%c%c%c, size %s, pos %llu, timestamp %llu",
-                    entry.block_type[0], entry.block_type[1], entry.block_type[2],
-                    entry.block_type[3], size_string, entry.block_pos, entry.block_timestamp);
+            if (Index->block_type[e] != 0) return 0;
+            continue;
         }
+
+        if (chunk >= mlv_DataSourceGetNumChunks(DataSource) || block_size < sizeof(mlv_block)) return 0;
+
+        /* Written so that nothing in a bad file can make them wrap round */
+        uint64_t pos = BLOCK_LOCATION_POS(location);
+        uint64_t chunk_size = mlv_DataSourceGetChunkSize(DataSource, chunk);
+        uint64_t data_offset = Index->block_data_offset[e];
+        if ( pos > chunk_size || block_size > chunk_size - pos
+          || data_offset > Index->block_data_size
+          || stored_data_size(block_size) > Index->block_data_size - data_offset )
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Checks that loaded entries really are in the order the file says they are
+ * sorted in, as searching relies on it */
+static int is_loaded_sort_order_valid(mlv_Index * Index, int SortOrder)
+{
+    int (* compare)(const void *, const void *) = NULL;
+    if (SortOrder == INDEX_ORDER_READING) compare = entry_cmp_for_reading;
+    else if (SortOrder == INDEX_ORDER_STORAGE) compare = entry_cmp_for_storage;
+    else return 1;
+
+    for (uint64_t e = 1; e < Index->num_entries; ++e)
+    {
+        entry_sort_key_t a = {Index->block_type[e-1], Index->block_timestamp[e-1], Index->block_location[e-1], e-1};
+        entry_sort_key_t b = {Index->block_type[e], Index->block_timestamp[e], Index->block_location[e], e};
+        if (compare(&a, &b) > 0) return 0;
+    }
+
+    return 1;
+}
+
+/* Empties the index, as if it had just been made */
+static void reset_index(mlv_Index * Index)
+{
+    Index->num_entries = 0;
+    Index->num_blocks_indexed = 0;
+    Index->block_data_size = 0;
+    Index->indexed_up_to.chunk = 0;
+    Index->indexed_up_to.pos = 0;
+    Index->indexing_is_complete = 0;
+    Index->sort_order = INDEX_ORDER_FILE;
+    Index->num_lazy_regions = 0;
+    Index->has_seeked = 0;
+    free_read_ahead(Index);
+    rebuild_frame_tables(Index);
+}
+
+int mlv_IndexLoad(mlv_Index * Index,
+                  mlv_DataSource * DataSource,
+                  mlv_Reader Reader,
+                  void * ReaderUD)
+{
+    if (Index->health != 0) return 0;
+
+    /* Whatever was in the index is replaced, or if loading fails, gone */
+    reset_index(Index);
+
+    /* Skip through blocks until the LIDX one */
+    uint64_t pos = 0;
+    index_file_header_t header;
+    while (1)
+    {
+        if (Reader(ReaderUD, pos, sizeof(header), &header) != sizeof(header)) return 0;
+        if (BLOCKTYPE_INT(header.block_type) == BLOCKTYPE_INT("LIDX")) break;
+        if (header.block_size < sizeof(mlv_block)) return 0;
+        pos += header.block_size;
+    }
+    pos += sizeof(header);
+
+    int num_chunks = mlv_DataSourceGetNumChunks(DataSource);
+    if ( num_chunks < 0
+      || header.version != INDEX_FILE_VERSION
+      || header.num_chunks != (uint32_t)num_chunks
+      || header.indexed_up_to_chunk > num_chunks
+      || ( header.indexed_up_to_chunk < num_chunks
+        && header.indexed_up_to_pos > mlv_DataSourceGetChunkSize(DataSource, header.indexed_up_to_chunk) )
+      || header.sort_order > INDEX_ORDER_STORAGE
+      || header.num_entries > UINT32_MAX
+      || header.block_data_size > UINT32_MAX
+      || header.block_size != lidx_block_size(Index, num_chunks, header.num_entries, header.block_data_size) )
+        return 0;
+
+    /* Make sure the clip is the same as when the index was saved */
+    for (int c = 0; c < num_chunks; ++c)
+    {
+        index_file_chunk_t chunk;
+        if (Reader(ReaderUD, pos, sizeof(chunk), &chunk) != sizeof(chunk)) return 0;
+        if ( chunk.size != mlv_DataSourceGetChunkSize(DataSource, c)
+          || chunk.modification_time != mlv_DataSourceGetChunkModificationTime(DataSource, c) )
+            return 0;
+        pos += sizeof(chunk);
+    }
+
+    /* Read straight in to the index's memory */
+    if ( (header.num_entries > Index->num_entries_memory && !resize_entries(Index, header.num_entries))
+      || (header.block_data_size > Index->block_data_memory && !resize_block_data(Index, header.block_data_size)) )
+        return 0;
+
+    void ** columns[NUM_ENTRY_COLUMNS];
+    uint64_t element_sizes[NUM_ENTRY_COLUMNS];
+    get_entry_columns(Index, columns, element_sizes);
+
+    int ok = 1;
+    for (int c = 0; c < NUM_ENTRY_COLUMNS && ok; ++c)
+    {
+        uint64_t bytes = header.num_entries * element_sizes[c];
+        ok = (Reader(ReaderUD, pos, bytes, *columns[c]) == bytes);
+        pos += bytes;
+    }
+    ok = ok && (Reader(ReaderUD, pos, header.block_data_size, Index->block_data) == header.block_data_size);
+
+    Index->num_entries = header.num_entries;
+    Index->block_data_size = header.block_data_size;
+
+    if ( !ok || !are_loaded_entries_valid(Index, DataSource)
+      || !is_loaded_sort_order_valid(Index, header.sort_order) )
+    {
+        reset_index(Index);
+        return 0;
+    }
+
+    Index->indexed_up_to.chunk = header.indexed_up_to_chunk;
+    Index->indexed_up_to.pos = header.indexed_up_to_pos;
+    Index->indexing_is_complete = (header.indexing_is_complete != 0);
+    Index->sort_order = header.sort_order;
+    Index->num_chunks = num_chunks;
+    rebuild_frame_tables(Index);
+
+    return 1;
+}
+
+
+
+
+
+
+
+
+void mlv_IndexPrint(mlv_Index * Index)
+{
+    for (uint64_t i = 0; i < Index->num_entries; ++i)
+    {
+        if (entry_is_removed(Index, i)) continue;
+
+        uint8_t type[4];
+        mlv_IndexGetBlockType(Index, i, type);
+        uint32_t block_size = Index->block_size[i];
+
+        int use_mb = block_size >= (1024*1024*0.2);
+        char size_string[100];
+        if (use_mb) sprintf(size_string, "%.1lf MiB", (double)block_size/(1024.0*1024.0));
+        else sprintf(size_string, "%llu bytes", (unsigned long long)block_size);
+        printf("\nBlock %c%c%c%c, size %s, chunk %i, pos %llu, timestamp %llu",
+                type[0], type[1], type[2], type[3], size_string,
+                BLOCK_LOCATION_CHUNK(Index->block_location[i]),
+                (unsigned long long)BLOCK_LOCATION_POS(Index->block_location[i]),
+                (unsigned long long)Index->block_timestamp[i]);
     }
     puts("");
-}
\ No newline at end of file
+}
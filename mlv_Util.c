@@ -16,8 +16,10 @@ mlv_AllocationInfo;
 void * mlv_Malloc(mlv_Alloc Allocator, void * AllocatorUD, uint64_t Size)
 {
     mlv_AllocationInfo * info = Allocator(AllocatorUD, NULL, 0, Size + sizeof(mlv_AllocationInfo));
+    if (info == NULL) return NULL;
     info->allocator = Allocator;
     info->ud = AllocatorUD;
+    info->size = Size;
     return info + 1;
 }
 
@@ -27,6 +29,13 @@ void * mlv_Malloc2(void * UseAllocatorFrom, uint64_t Size)
     return mlv_Malloc(info->allocator, info->ud, Size);
 }
 
+void mlv_GetAllocator(void * Pointer, mlv_Alloc * AllocatorOut, void ** AllocatorUDOut)
+{
+    mlv_AllocationInfo * info = ((mlv_AllocationInfo *)Pointer) - 1;
+    *AllocatorOut = info->allocator;
+    *AllocatorUDOut = info->ud;
+}
+
 void mlv_Free(void * Pointer)
 {
     mlv_AllocationInfo * info = ((mlv_AllocationInfo *)Pointer) - 1;
@@ -37,6 +46,7 @@ void * mlv_Realloc(void * Pointer, uint64_t NewSize)
 {
     mlv_AllocationInfo * info = ((mlv_AllocationInfo *)Pointer) - 1;
     info = info->allocator(info->ud, info, info->size, NewSize+sizeof(mlv_AllocationInfo));
+    if (info == NULL) return NULL;
     info->size = NewSize;
     return info + 1;
 }
\ No newline at end of file
@@ -38,6 +38,9 @@
 /* Functions for bit packing/unpacking and compressing */
 #include "MLVFrameUtils.h"
 
+/* Compressing many frames at once on multiple threads */
+#include "MLVCompressor.h"
+
 /* MLV file block structures */
 #include <stdint.h>
 #include "mlv_structs.h"
@@ -0,0 +1,81 @@
+/* 
+ * MIT License
+ *
+ * Copyright (C) 2019 Ilia Sibiryakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _MLVCompressor_h_
+#define _MLVCompressor_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Compresses frames to LJ92 on a pool of threads, either batches of frames or
+ * one frame in slices. Every thread keeps its own encoder, so once frames of a
+ * size have been compressed no more memory gets allocated for them */
+typedef struct MLVCompressor MLVCompressor_t;
+
+/* Most threads a compressor can have */
+#define MLV_COMPRESSOR_MAX_THREADS 64
+
+/******************************* Initialisation *******************************/
+
+/* Returns amount of memory you need to allocate for an MLV compressor */
+size_t sizeof_MLVCompressor();
+
+/* Starts NumThreads threads (1 to MLV_COMPRESSOR_MAX_THREADS). Returns zero on
+ * failure, then the compressor must not be used or uninitialised */
+int init_MLVCompressor(MLVCompressor_t * Compressor, int NumThreads);
+
+void uninit_MLVCompressor(MLVCompressor_t * Compressor);
+
+/******************************** Compressing *********************************/
+
+/* Compresses NumFrames frames of the same size at once, from Data[i] to Out[i],
+ * which each have room for OutSize bytes. Data must already be at Bitdepth.
+ * Compressed sizes are returned to ResultSizes, zero for frames that failed or
+ * did not fit. Returns how many frames were compressed successfully. Only one
+ * thing can be compressed at a time. */
+int MLVCompressorCompressFrames( MLVCompressor_t * Compressor,
+                                 uint16_t ** Data,
+                                 int NumFrames,
+                                 int Width,
+                                 int Height,
+                                 int Bitdepth,
+                                 void ** Out,
+                                 size_t OutSize,
+                                 size_t * ResultSizes );
+
+/* Compresses one frame, split in slices that are compressed on all of the
+ * threads, so a single big frame gets done sooner. The slices are restart
+ * intervals, which decoders that know about them can also decode in parallel.
+ * Returns zero on failure, otherwise compressed size goes to ResultSize. */
+int MLVCompressorCompressFrame( MLVCompressor_t * Compressor,
+                                uint16_t * Data,
+                                int Width,
+                                int Height,
+                                int Bitdepth,
+                                void * Out,
+                                size_t OutSize,
+                                size_t * ResultSize );
+
+#endif
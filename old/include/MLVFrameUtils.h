@@ -26,25 +26,43 @@
 #define _libmlv_tools_h_
 
 #include <stdint.h>
+#include <stddef.h>
 
 /* Packing fucntions for 14, 12 and 10 bit, output memory size should be
- * bitdepth/16 the original size */
+ * bitdepth/16 the original size, uses SIMD if available */
 void MLVPackFrame14(uint16_t * Data, uint32_t Elements, void * Out);
 void MLVPackFrame12(uint16_t * Data, uint32_t Elements, void * Out);
 void MLVPackFrame10(uint16_t * Data, uint32_t Elements, void * Out);
 
-/* Unpacking */
+/* Shifts pixels from SourceBitdepth to Bitdepth (10, 12, 14 or 16) and packs
+ * them in the same pass, Data is not modified. For 16 bit it only shifts, Out
+ * may then be the same as Data. Returns zero if a bitdepth is not supported. */
+int MLVPackFrame(uint16_t * Data, uint32_t Elements, int SourceBitdepth, int Bitdepth, void * Out);
+
+/* Unpacking, uses SIMD if available */
 void MLVUnpackFrame14(uint16_t * Data, uint32_t Elements, uint16_t * Out);
 void MLVUnpackFrame12(uint16_t * Data, uint32_t Elements, uint16_t * Out);
 void MLVUnpackFrame10(uint16_t * Data, uint32_t Elements, uint16_t * Out);
 
+/* Which SIMD instructions get used. The best one the CPU supports is chosen
+ * automatically, MLVSetSIMD is for testing and benchmarking (returns zero if
+ * that level is not supported). */
+#define MLV_SIMD_NONE 0
+#define MLV_SIMD_GENERIC 1 /* Compiler vector extensions (NEON, etc.) */
+#define MLV_SIMD_SSE2 2
+#define MLV_SIMD_AVX2 3
+int MLVGetSIMD();
+int MLVSetSIMD(int Level);
+
 /* Compress LJ92, Out memory should be same size as data, resulting compressed
- * size is returned to ResultSize */
-void MLVCompressFrameLJ92( uint16_t * Data,
-                           int Width,
-                           int Height,
-                           int Bitdepth,
-                           void * Out,
-                           size_t * ResultSize );
+ * size is returned to ResultSize. Data must already be at Bitdepth. Returns
+ * zero if compression failed or the result would not fit in Out. To compress
+ * many frames, MLVCompressor is faster. */
+int MLVCompressFrameLJ92( uint16_t * Data,
+                          int Width,
+                          int Height,
+                          int Bitdepth,
+                          void * Out,
+                          size_t * ResultSize );
 
 #endif
\ No newline at end of file
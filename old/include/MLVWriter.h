@@ -71,7 +71,8 @@ size_t MLVWriterGetHeaderSize(MLVWriter_t * Writer);
 size_t MLVWriterGetFrameHeaderSize(MLVWriter_t * Writer);
 
 /* Returns frame header data for a frame of index FrameIndex. You must write
- * this to a file, followed by the actual frame data */
+ * this to a file, followed by the actual frame data. FrameDataSize can be
+ * different for every frame, as it is for LJ92 compressed frames */
 void MLVWriterGetFrameHeaderData( MLVWriter_t * Writer,
                                   uint64_t FrameIndex,
                                   size_t FrameDataSize,
@@ -0,0 +1,270 @@
+/* Benchmarks frame packing and unpacking with every SIMD level the CPU has,
+ * against memcpy of the same amount of data as a memory bandwidth reference,
+ * LJ92 encoding and LJ92 decoding. Give it an LJ92 compressed MLV to decode
+ * real frames, otherwise a generated frame is used. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../include/MLVFrameUtils.h"
+#include "../../include/MLVCompressor.h"
+#include "../../src/liblj92/lj92.h"
+#include "../../../libmlv.h"
+#include "../../../libmlvaux.h"
+
+/* A 5.2K frame, much bigger than any cache */
+#define FRAME_WIDTH 5184
+#define FRAME_HEIGHT 3456
+#define FRAME_PIXELS (FRAME_WIDTH * FRAME_HEIGHT)
+#define REPEATS 20
+
+/* Most frames of a clip to decode */
+#define MAX_LJ92_FRAMES 100
+
+/* Size of generated LJ92 frames */
+#define LJ92_WIDTH 1920
+#define LJ92_HEIGHT 1080
+
+/* Frames encoded at once by the compressor */
+#define ENCODE_BATCH 8
+
+static const char * simd_names[] = { "none", "generic", "sse2", "avx2" };
+
+static double get_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Prints speed in gigapixels and gigabytes (read + written) per second */
+static void print_result(const char * Name, double Seconds, double BytesPerPixel)
+{
+    double pixels = (double)FRAME_PIXELS * REPEATS;
+    double bytes = pixels * BytesPerPixel;
+    printf("  %-24s %6.2f Gpix/s %6.2f GB/s\n", Name, pixels / Seconds / 1e9, bytes / Seconds / 1e9);
+}
+
+static void benchmark_packing()
+{
+    uint16_t * image = malloc(FRAME_PIXELS * sizeof(uint16_t));
+    uint16_t * unpacked = malloc(FRAME_PIXELS * sizeof(uint16_t));
+    uint16_t * packed = malloc(FRAME_PIXELS * sizeof(uint16_t));
+
+    for (int i = 0; i < FRAME_PIXELS; ++i) image[i] = rand();
+
+    /* Reference, packing can not go faster than this */
+    double start = get_time();
+    for (int r = 0; r < REPEATS; ++r)
+        memcpy(unpacked, image, FRAME_PIXELS * sizeof(uint16_t));
+    print_result("memcpy 16 bit", get_time() - start, 4.0);
+
+    for (int level = MLV_SIMD_NONE; level <= MLV_SIMD_AVX2; ++level)
+    {
+        if (!MLVSetSIMD(level)) continue;
+        printf("SIMD: %s\n", simd_names[level]);
+
+        for (int bitdepth = 10; bitdepth <= 14; bitdepth += 2)
+        {
+            char name[64];
+
+            /* From 16 bit source, as raw2mlv does for DNGs */
+            start = get_time();
+            for (int r = 0; r < REPEATS; ++r)
+                MLVPackFrame(image, FRAME_PIXELS, 16, bitdepth, packed);
+            snprintf(name, sizeof(name), "pack 16 -> %i bit", bitdepth);
+            print_result(name, get_time() - start, 2.0 + bitdepth / 8.0);
+
+            start = get_time();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                if (bitdepth == 14) MLVUnpackFrame14(packed, FRAME_PIXELS, unpacked);
+                else if (bitdepth == 12) MLVUnpackFrame12(packed, FRAME_PIXELS, unpacked);
+                else MLVUnpackFrame10(packed, FRAME_PIXELS, unpacked);
+            }
+            snprintf(name, sizeof(name), "unpack %i bit", bitdepth);
+            print_result(name, get_time() - start, 2.0 + bitdepth / 8.0);
+        }
+    }
+
+    free(image);
+    free(unpacked);
+    free(packed);
+}
+
+/* Generates an image that compresses roughly like a real one, some noise on
+ * top of a smooth image */
+static uint16_t * generate_image()
+{
+    uint16_t * image = malloc(LJ92_WIDTH * LJ92_HEIGHT * sizeof(uint16_t));
+
+    for (int y = 0; y < LJ92_HEIGHT; ++y)
+        for (int x = 0; x < LJ92_WIDTH; ++x)
+            image[y*LJ92_WIDTH+x] = 2048 + x*3 + y*5 + (rand() % 64);
+
+    return image;
+}
+
+static void generate_lj92_frame(uint8_t ** DataOut, int * NumBytesOut)
+{
+    uint16_t * image = generate_image();
+    lj92_encode(image, LJ92_WIDTH, LJ92_HEIGHT, 14, LJ92_WIDTH*LJ92_HEIGHT, 0, NULL, 0, DataOut, NumBytesOut);
+    free(image);
+}
+
+static void print_encode_result(const char * Name, double Seconds, int Frames)
+{
+    double pixels = (double)LJ92_WIDTH * LJ92_HEIGHT * Frames;
+    printf("  %-24s %6.2f ns/pixel %7.1f Mpix/s %6.1f frames/s\n", Name,
+           Seconds * 1e9 / pixels, pixels / Seconds / 1e6, Frames / Seconds);
+}
+
+static void benchmark_lj92_encode()
+{
+    uint16_t * images[ENCODE_BATCH];
+    void * out[ENCODE_BATCH];
+    size_t out_sizes[ENCODE_BATCH];
+    size_t out_space = LJ92_WIDTH * LJ92_HEIGHT * sizeof(uint16_t);
+    int batches = REPEATS / ENCODE_BATCH + 1;
+
+    for (int i = 0; i < ENCODE_BATCH; ++i)
+    {
+        images[i] = generate_image();
+        out[i] = malloc(out_space);
+    }
+
+    printf("LJ92 encode (generated frame, %ix%i, 14 bit):\n", LJ92_WIDTH, LJ92_HEIGHT);
+
+    /* Allocates and frees everything for every frame */
+    double start = get_time();
+    for (int b = 0; b < batches; ++b)
+    {
+        for (int i = 0; i < ENCODE_BATCH; ++i)
+        {
+            uint8_t * encoded; int encoded_size;
+            lj92_encode(images[i], LJ92_WIDTH, LJ92_HEIGHT, 14, LJ92_WIDTH*LJ92_HEIGHT, 0, NULL, 0, &encoded, &encoded_size);
+            free(encoded);
+        }
+    }
+    print_encode_result("lj92_encode", get_time() - start, batches * ENCODE_BATCH);
+
+    /* Compressor with different numbers of threads */
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        MLVCompressor_t * compressor = malloc(sizeof_MLVCompressor());
+        if (!init_MLVCompressor(compressor, threads)) break;
+
+        /* First batch allocates the encoders' memory */
+        MLVCompressorCompressFrames(compressor, images, ENCODE_BATCH, LJ92_WIDTH, LJ92_HEIGHT, 14, out, out_space, out_sizes);
+
+        start = get_time();
+        for (int b = 0; b < batches; ++b)
+            MLVCompressorCompressFrames(compressor, images, ENCODE_BATCH, LJ92_WIDTH, LJ92_HEIGHT, 14, out, out_space, out_sizes);
+        double seconds = get_time() - start;
+
+        char name[64];
+        sprintf(name, "MLVCompressor %i thread%s", threads, (threads > 1) ? "s" : "");
+        print_encode_result(name, seconds, batches * ENCODE_BATCH);
+
+        /* One frame at a time, in slices */
+        start = get_time();
+        for (int b = 0; b < batches; ++b)
+            for (int i = 0; i < ENCODE_BATCH; ++i)
+                MLVCompressorCompressFrame(compressor, images[i], LJ92_WIDTH, LJ92_HEIGHT, 14, out[i], out_space, &out_sizes[i]);
+        seconds = get_time() - start;
+
+        sprintf(name, "  %i slice%s", threads, (threads > 1) ? "s" : "");
+        print_encode_result(name, seconds, batches * ENCODE_BATCH);
+
+        uninit_MLVCompressor(compressor);
+        free(compressor);
+    }
+
+    for (int i = 0; i < ENCODE_BATCH; ++i)
+    {
+        free(images[i]);
+        free(out[i]);
+    }
+}
+
+static void benchmark_lj92(char * ClipPath)
+{
+    uint8_t * frames[MAX_LJ92_FRAMES];
+    int frame_sizes[MAX_LJ92_FRAMES];
+    int num_frames = 0;
+
+    if (ClipPath != NULL)
+    {
+        /* Copy LJ92 data of the clip's frames, so reading is not timed */
+        mlv_DataSource * data_source = mlvL_newDataSource(ClipPath, 1);
+        mlv_Index * index = mlvL_newIndex();
+        mlv_FrameExtractor * frame_extractor = mlvL_newFrameExtractor();
+        mlv_IndexBuild(index, data_source, 0);
+
+        for (; num_frames < MAX_LJ92_FRAMES; ++num_frames)
+        {
+            uint64_t num_bytes;
+            void * data = mlv_FrameExtractorGetFrameData(frame_extractor, index, data_source, num_frames, &num_bytes, 0);
+            if (data == NULL) break;
+            frames[num_frames] = malloc(num_bytes);
+            memcpy(frames[num_frames], data, num_bytes);
+            frame_sizes[num_frames] = num_bytes;
+        }
+
+        mlv_closeFrameExtractor(frame_extractor);
+        mlv_closeIndex(index);
+        mlv_closeDataSource(data_source);
+    }
+    else
+    {
+        generate_lj92_frame(&frames[0], &frame_sizes[0]);
+        num_frames = 1;
+    }
+
+    lj92 decoder = NULL;
+    int width, height, bitdepth, components;
+    if (num_frames == 0 || lj92_open(&decoder, frames[0], frame_sizes[0], &width, &height, &bitdepth, &components) != LJ92_ERROR_NONE)
+    {
+        printf("LJ92: no frames to decode\n");
+        return;
+    }
+
+    uint64_t frame_pixels = (uint64_t)width * height * components;
+    uint16_t * image = malloc(frame_pixels * sizeof(uint16_t));
+    int repeats = (num_frames < REPEATS) ? REPEATS / num_frames : 1;
+    uint64_t total_pixels = 0, total_bytes = 0;
+
+    double start = get_time();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (int f = 0; f < num_frames; ++f)
+        {
+            if (lj92_reopen(decoder, frames[f], frame_sizes[f], &width, &height, &bitdepth, &components) != LJ92_ERROR_NONE) continue;
+            if ((uint64_t)width * height * components > frame_pixels) continue;
+            lj92_decode(decoder, image, width * height * components, 0, NULL, 0);
+            total_pixels += (uint64_t)width * height * components;
+            total_bytes += frame_sizes[f];
+        }
+    }
+    double seconds = get_time() - start;
+
+    printf("LJ92 decode (%s, %ix%i, %i bit, %.2f bits/pixel):\n", (ClipPath != NULL) ? ClipPath : "generated frame",
+           width * components, height, bitdepth, total_bytes * 8.0 / total_pixels);
+    printf("  %6.2f ns/pixel %7.1f Mpix/s %6.1f frames/s\n", seconds * 1e9 / total_pixels,
+           total_pixels / seconds / 1e6, total_pixels / seconds / frame_pixels);
+
+    lj92_close(decoder);
+    free(image);
+    for (int f = 0; f < num_frames; ++f) free(frames[f]);
+}
+
+int main(int argc, char ** argv)
+{
+    benchmark_packing();
+    benchmark_lj92_encode();
+    benchmark_lj92((argc > 1) ? argv[1] : NULL);
+    return 0;
+}
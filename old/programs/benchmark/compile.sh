@@ -0,0 +1,3 @@
+gcc -c -O3 benchmark.c ../../src/MLVFrameUtils.c ../../src/MLVCompressor.c ../../src/liblj92/lj92.c ../../../mlv_*.c ../../../libmlvaux.c -Wall -Wextra
+
+gcc *.o -o benchmark -lpthread
@@ -58,8 +58,9 @@ void print_help()
 " -h, --help                      Print help\n"
 " -o <output filename>            Output file name\n"
 " -b, --bitdepth <bitdepth>       Output bitdepth, 8 to 16, even numbers\n"
-// " --compression <0/1>             Output compression, 0=none, 1=LJ92\n"
+" --compression <0/1>             Output compression, 0=none, 1=LJ92\n"
 " -f, --framerate <top> <bottom>  Framerate as a fraction, ex: -f 24000 1001\n"
+" -t, --threads <threads>         Threads to compress with, default 4\n"
 // " --crop <left>              Crop\n"
 "Example:\n"
 #ifdef WIN32
@@ -106,6 +107,27 @@ void do_binning(uint16_t * unbinned_image, uint16_t * binned_image, int binning_
     }
 }
 
+/* Writes frame header followed by frame data */
+void write_frame(MLVWriter_t * writer, FILE * mlv_file, uint64_t frame_index, void * frame_data, size_t frame_size)
+{
+    /* Get frame header size, telling MLVWriter how big the frame is */
+    size_t frame_header_size = MLVWriterGetFrameHeaderSize(writer);
+
+    /* Create memory for frame header */
+    void * frame_header_data = malloc(frame_header_size);
+
+    /* Get frame header */
+    MLVWriterGetFrameHeaderData(writer,frame_index,frame_size,frame_header_data);
+
+    /* Write it */
+    fwrite(frame_header_data, frame_header_size, 1, mlv_file);
+
+    free(frame_header_data);
+
+    /* Now write actual frame data */
+    fwrite(frame_data, frame_size, 1, mlv_file);
+}
+
 int main(int argc, char ** argv)
 {
     /* Output parameters */
@@ -119,13 +141,13 @@ int main(int argc, char ** argv)
     int output_fps_top = 24000;
     int output_fps_bottom = 1001;
     int binning = 1;
+    int num_threads = 4;
     char * camera_name = NULL;
     char * camera_make = NULL;
     char * camera_model = NULL;
 
     /* Source data info */
     int source_bitdepth = 14; /* Will be figured out later */
-    int shift_bits = 0; /* How many bits to shift to get to output bitdepth */
 
     /* Count how many frames have been written */
     int written_frames = 0;
@@ -150,8 +172,8 @@ int main(int argc, char ** argv)
             ++i;
         } else if (!strcmp(argv[i], "--compression")) {
             output_compression = atoi(argv[i+1]);
-            char * compression = (output_compression) ? "none" : "LJ92";
-            printf("Compression set to %i (none)\n", output_compression);
+            char * compression = (output_compression) ? "LJ92" : "none";
+            printf("Compression set to %i (%s)\n", output_compression, compression);
             ++i;
         } else if (!strcmp(argv[i], "--camera-name")) {
             camera_name = malloc(strlen(argv[i+1]) + strlen(argv[i+2]) + 10);
@@ -165,6 +187,14 @@ int main(int argc, char ** argv)
             output_fps_bottom = atoi(argv[i+2]);
             printf("FPS set to %.3f\n",(float)output_fps_top/output_fps_bottom);
             i += 2;
+        } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--threads")) {
+            num_threads = atoi(argv[i+1]);
+            if (num_threads < 1 || num_threads > MLV_COMPRESSOR_MAX_THREADS) {
+                printf("Threads must be 1 to %i.\n", MLV_COMPRESSOR_MAX_THREADS);
+                exit(1);
+            }
+            printf("Threads set to %i\n", num_threads);
+            ++i;
         } else if (!strcmp(argv[i], "--binning")) { /* Secret bonus option */
             binning = atoi(argv[i+1]);
             /* if (binning != 3 && binning != 1 && binning != 5) binning = 1;
@@ -184,6 +214,24 @@ int main(int argc, char ** argv)
     FILE * mlv_file = fopen(output_name, "wb");
     uint8_t * packed_frame_data = NULL;
 
+    /* Compressed frames are done in batches, one frame per thread */
+    MLVCompressor_t * compressor = NULL;
+    uint16_t ** batch_images = malloc(num_threads * sizeof(uint16_t *));
+    char ** batch_files = malloc(num_threads * sizeof(char *));
+    void ** batch_out = calloc(num_threads, sizeof(void *));
+    size_t * batch_sizes = malloc(num_threads * sizeof(size_t));
+    int batch_size = 0;
+
+    if (output_compression)
+    {
+        compressor = malloc(sizeof_MLVCompressor());
+        if (!init_MLVCompressor(compressor, num_threads))
+        {
+            puts("Could not start compression threads.");
+            exit(1);
+        }
+    }
+
     /* Write each frame */
     for (int f = 0; f < num_input_files; ++f)
     {
@@ -200,8 +248,6 @@ int main(int argc, char ** argv)
             source_bitdepth = (int)ceil(log2(MAX(RawGetMaxPixelValue(raw), RawGetWhiteLevel(raw)))/2) * 2;
             /* Set output bitdepth to be same as input if user has not specified anything */
             if (output_bits == 0) output_bits = source_bitdepth;
-            shift_bits = source_bitdepth - output_bits;
-            if (shift_bits < 0) shift_bits = -shift_bits;
             float lscale = pow(2.0, output_bits - source_bitdepth);
 
             printf("Detected source bitdepth: %i\n", source_bitdepth);
@@ -211,7 +257,13 @@ int main(int argc, char ** argv)
             width = limit_multiple_of_8(RawGetWidth(raw) / binning);
             height = RawGetHeight(raw) / binning;
 
-            packed_frame_data = malloc((width * height * output_bits) / 8);
+            /* Compressed frames get the uncompressed 16 bit size, in case
+             * the image does not compress well */
+            if (output_compression)
+                for (int i = 0; i < num_threads; ++i)
+                    batch_out[i] = malloc(width * height * sizeof(uint16_t));
+            else
+                packed_frame_data = malloc((width * height * output_bits) / 8);
 
             /********************* Initialise MLV writer **********************/
 
@@ -259,49 +311,53 @@ int main(int argc, char ** argv)
             }
         }
 
-        /* Calculate frame size, TODO: compressed frames will be different */
-        size_t frame_size = (width * height * output_bits) / 8;
-
-        /*************************** Write the frame **************************/
-
-        /* Get frame header size, telling MLVWriter how big the frame is */
-        size_t frame_header_size = MLVWriterGetFrameHeaderSize(writer);
-
-        /* Create memory for frame header */
-        void * frame_header_data = malloc(frame_header_size);
-
-        /* Get frame header */
-        MLVWriterGetFrameHeaderData(writer,f,frame_size,frame_header_data);
-
-        /* Write it */
-        fwrite(frame_header_data, frame_header_size, 1, mlv_file);
-
-        free(frame_header_data);
-
-        /* Now write actual frame data */
+        /* Now get the frame data */
         uint16_t * unbinned_image = RawGetImageData(raw);
 
         uint16_t * bayerimage = malloc(width * height * sizeof(uint16_t));
 
         do_binning(unbinned_image, bayerimage, binning, binning, RawGetWidth(raw), RawGetHeight(raw));
 
-        if (output_bits < source_bitdepth)
-            for (int i = 0; i < width*height; ++i) bayerimage[i] >>= shift_bits;
-        else
-            for (int i = 0; i < width*height; ++i) bayerimage[i] <<= shift_bits;
+        if (output_compression)
+        {
+            /* Shift to output bitdepth, then add to the batch */
+            if (output_bits > source_bitdepth)
+                for (int i = 0; i < width*height; ++i) bayerimage[i] <<= (output_bits - source_bitdepth);
+            else if (output_bits < source_bitdepth)
+                for (int i = 0; i < width*height; ++i) bayerimage[i] >>= (source_bitdepth - output_bits);
+
+            batch_images[batch_size] = bayerimage;
+            batch_files[batch_size] = input_files[f];
+            ++batch_size;
+
+            /* Compress and write the batch when full or at the last frame */
+            if (batch_size == num_threads || f == num_input_files - 1)
+            {
+                MLVCompressorCompressFrames( compressor, batch_images, batch_size,
+                                             width, height, output_bits, batch_out,
+                                             width * height * sizeof(uint16_t), batch_sizes );
+
+                for (int i = 0; i < batch_size; ++i)
+                {
+                    if (batch_sizes[i] != 0)
+                        write_frame(writer, mlv_file, written_frames++, batch_out[i], batch_sizes[i]);
+                    else
+                        printf("Failed to compress file %s\n", batch_files[i]);
 
-        if (output_bits == 16)
-            packed_frame_data = (void *)bayerimage;
-        else if (output_bits == 14)
-            MLVPackFrame14(bayerimage, width*height, packed_frame_data);
-        else if (output_bits == 12)
-            MLVPackFrame12(bayerimage, width*height, packed_frame_data);
-        else if (output_bits == 10)
-            MLVPackFrame10(bayerimage, width*height, packed_frame_data);
+                    free(batch_images[i]);
+                }
 
-        fwrite(packed_frame_data, frame_size, 1, mlv_file);
+                batch_size = 0;
+            }
+        }
+        else
+        {
+            /* Shift to output bitdepth and pack in one go */
+            MLVPackFrame(bayerimage, width*height, source_bitdepth, output_bits, packed_frame_data);
+            free(bayerimage);
 
-        written_frames++;
+            write_frame(writer, mlv_file, written_frames++, packed_frame_data, (width * height * output_bits) / 8);
+        }
 
         uninit_RawReader(raw);
     }
@@ -327,6 +383,16 @@ int main(int argc, char ** argv)
     /********************************** DONE **********************************/
 
     if (packed_frame_data != NULL) free(packed_frame_data);
+    if (compressor != NULL)
+    {
+        uninit_MLVCompressor(compressor);
+        free(compressor);
+    }
+    for (int i = 0; i < num_threads; ++i) free(batch_out[i]);
+    free(batch_images);
+    free(batch_files);
+    free(batch_out);
+    free(batch_sizes);
     fclose(mlv_file);
     uninit_MLVWriter(writer);
     free(writer);
@@ -0,0 +1,302 @@
+/* 
+ * MIT License
+ *
+ * Copyright (C) 2019 Ilia Sibiryakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "../include/MLVCompressor.h"
+#include "liblj92/lj92.h"
+
+/* No pthreads on MSVC, everything is compressed on the calling thread there */
+#if defined(_MSC_VER) && !defined(LIBMLV_NO_THREADS)
+#define LIBMLV_NO_THREADS
+#endif
+
+#ifndef LIBMLV_NO_THREADS
+#include <pthread.h>
+
+typedef struct {
+    MLVCompressor_t * compressor;
+    int index; /* Of the thread's encoder */
+    pthread_t thread;
+} compressor_thread_t;
+#endif
+
+/* Threads run a job for every index of it, given their own thread index */
+typedef void (*compressor_job_t)(MLVCompressor_t * Compressor, int Thread, int Index);
+
+struct MLVCompressor
+{
+    int num_threads;
+    lj92_encoder encoders[MLV_COMPRESSOR_MAX_THREADS];
+
+    /* Encodes single frames in slices, one per thread */
+    lj92_encoder slice_encoder;
+
+    /* Current batch of frames */
+    uint16_t ** data;
+    void ** out;
+    size_t * result_sizes;
+    size_t out_size;
+    int width;
+    int height;
+    int bitdepth;
+
+    /* Current slices, from slice_encoder */
+    void (*slice_func)(void *, int);
+    void * slice_arg;
+
+    /* Current job */
+    compressor_job_t job;
+    int job_count;
+    int next_index; /* Next index for a thread to take */
+    int indices_done;
+
+#ifndef LIBMLV_NO_THREADS
+    compressor_thread_t threads[MLV_COMPRESSOR_MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond; /* Signalled when a job starts, or to quit */
+    pthread_cond_t done_cond; /* Signalled when a job has been done */
+    int quit;
+#endif
+};
+
+size_t sizeof_MLVCompressor()
+{
+    return sizeof(MLVCompressor_t);
+}
+
+#ifndef LIBMLV_NO_THREADS
+static void * compressor_thread(void * Thread)
+{
+    MLVCompressor_t * compressor = ((compressor_thread_t *)Thread)->compressor;
+    int thread_index = ((compressor_thread_t *)Thread)->index;
+
+    pthread_mutex_lock(&compressor->mutex);
+    while (1)
+    {
+        while (!compressor->quit && compressor->next_index >= compressor->job_count)
+            pthread_cond_wait(&compressor->start_cond, &compressor->mutex);
+        if (compressor->quit) break;
+
+        int index = compressor->next_index++;
+
+        pthread_mutex_unlock(&compressor->mutex);
+        compressor->job(compressor, thread_index, index);
+        pthread_mutex_lock(&compressor->mutex);
+
+        if (++compressor->indices_done == compressor->job_count)
+            pthread_cond_signal(&compressor->done_cond);
+    }
+    pthread_mutex_unlock(&compressor->mutex);
+
+    return NULL;
+}
+#endif
+
+/* Runs Job for every index up to Count on the threads, returns when done */
+static void run_job(MLVCompressor_t * Compressor, compressor_job_t Job, int Count)
+{
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_lock(&Compressor->mutex);
+    Compressor->job = Job;
+    Compressor->next_index = 0;
+    Compressor->indices_done = 0;
+    Compressor->job_count = Count;
+
+    pthread_cond_broadcast(&Compressor->start_cond);
+    while (Compressor->indices_done < Count)
+        pthread_cond_wait(&Compressor->done_cond, &Compressor->mutex);
+
+    Compressor->job_count = 0;
+    pthread_mutex_unlock(&Compressor->mutex);
+#else
+    for (int i = 0; i < Count; ++i) Job(Compressor, 0, i);
+#endif
+}
+
+/* Compresses one frame of the current batch */
+static void compress_frame(MLVCompressor_t * Compressor, int Thread, int Frame)
+{
+    int width = Compressor->width, height = Compressor->height;
+    int space = (Compressor->out_size > INT_MAX) ? INT_MAX : (int)Compressor->out_size;
+    int size = 0;
+
+    int result = lj92_encoder_encode( Compressor->encoders[Thread], Compressor->data[Frame],
+                                      width, height, Compressor->bitdepth,
+                                      width * height, 0, NULL, 0,
+                                      Compressor->out[Frame], space, &size );
+
+    Compressor->result_sizes[Frame] = (result == LJ92_ERROR_NONE) ? size : 0;
+}
+
+/* Slices don't need per-thread state, the slice encoder has it per slice */
+static void compress_slice(MLVCompressor_t * Compressor, int Thread, int Slice)
+{
+    (void)Thread;
+    Compressor->slice_func(Compressor->slice_arg, Slice);
+}
+
+/* For slice_encoder to run its slices on the threads */
+static void run_slices(void * Compressor, int Count, void (*Func)(void *, int), void * Arg)
+{
+    MLVCompressor_t * compressor = Compressor;
+    compressor->slice_func = Func;
+    compressor->slice_arg = Arg;
+    run_job(compressor, compress_slice, Count);
+}
+
+static void close_encoders(MLVCompressor_t * Compressor)
+{
+    for (int i = 0; i < MLV_COMPRESSOR_MAX_THREADS; ++i)
+    {
+        if (Compressor->encoders[i] != NULL) lj92_encoder_destroy(Compressor->encoders[i]);
+        Compressor->encoders[i] = NULL;
+    }
+    if (Compressor->slice_encoder != NULL) lj92_encoder_destroy(Compressor->slice_encoder);
+    Compressor->slice_encoder = NULL;
+}
+
+int init_MLVCompressor(MLVCompressor_t * Compressor, int NumThreads)
+{
+    for (uint64_t i = 0; i < sizeof(MLVCompressor_t); ++i) ((uint8_t *)Compressor)[i] = 0;
+
+    if (NumThreads < 1 || NumThreads > MLV_COMPRESSOR_MAX_THREADS) return 0;
+
+#ifdef LIBMLV_NO_THREADS
+    NumThreads = 1;
+#endif
+
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        if (lj92_encoder_create(&Compressor->encoders[i], NULL, NULL) != LJ92_ERROR_NONE)
+        {
+            close_encoders(Compressor);
+            return 0;
+        }
+    }
+
+    /* Slices are only worth it when there are threads to run them on */
+    if ( lj92_encoder_create(&Compressor->slice_encoder, NULL, NULL) != LJ92_ERROR_NONE
+      || lj92_encoder_set_slices(Compressor->slice_encoder, NumThreads, run_slices, Compressor) != LJ92_ERROR_NONE )
+    {
+        close_encoders(Compressor);
+        return 0;
+    }
+
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_init(&Compressor->mutex, NULL);
+    pthread_cond_init(&Compressor->start_cond, NULL);
+    pthread_cond_init(&Compressor->done_cond, NULL);
+
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        Compressor->threads[i].compressor = Compressor;
+        Compressor->threads[i].index = i;
+
+        if (pthread_create(&Compressor->threads[i].thread, NULL, compressor_thread, &Compressor->threads[i]) != 0)
+        {
+            /* Stop the ones that did start */
+            Compressor->num_threads = i;
+            uninit_MLVCompressor(Compressor);
+            return 0;
+        }
+    }
+#endif
+
+    Compressor->num_threads = NumThreads;
+    return 1;
+}
+
+void uninit_MLVCompressor(MLVCompressor_t * Compressor)
+{
+#ifndef LIBMLV_NO_THREADS
+    pthread_mutex_lock(&Compressor->mutex);
+    Compressor->quit = 1;
+    pthread_cond_broadcast(&Compressor->start_cond);
+    pthread_mutex_unlock(&Compressor->mutex);
+
+    for (int i = 0; i < Compressor->num_threads; ++i)
+        pthread_join(Compressor->threads[i].thread, NULL);
+
+    pthread_cond_destroy(&Compressor->done_cond);
+    pthread_cond_destroy(&Compressor->start_cond);
+    pthread_mutex_destroy(&Compressor->mutex);
+#endif
+
+    close_encoders(Compressor);
+    Compressor->num_threads = 0;
+}
+
+int MLVCompressorCompressFrames( MLVCompressor_t * Compressor,
+                                 uint16_t ** Data,
+                                 int NumFrames,
+                                 int Width,
+                                 int Height,
+                                 int Bitdepth,
+                                 void ** Out,
+                                 size_t OutSize,
+                                 size_t * ResultSizes )
+{
+    if (NumFrames <= 0) return 0;
+
+    Compressor->data = Data;
+    Compressor->out = Out;
+    Compressor->result_sizes = ResultSizes;
+    Compressor->out_size = OutSize;
+    Compressor->width = Width;
+    Compressor->height = Height;
+    Compressor->bitdepth = Bitdepth;
+
+    run_job(Compressor, compress_frame, NumFrames);
+
+    int frames_compressed = 0;
+    for (int i = 0; i < NumFrames; ++i)
+        if (ResultSizes[i] != 0) ++frames_compressed;
+
+    return frames_compressed;
+}
+
+int MLVCompressorCompressFrame( MLVCompressor_t * Compressor,
+                                uint16_t * Data,
+                                int Width,
+                                int Height,
+                                int Bitdepth,
+                                void * Out,
+                                size_t OutSize,
+                                size_t * ResultSize )
+{
+    int space = (OutSize > INT_MAX) ? INT_MAX : (int)OutSize;
+    int size = 0;
+
+    int result = lj92_encoder_encode( Compressor->slice_encoder, Data,
+                                      Width, Height, Bitdepth,
+                                      Width * Height, 0, NULL, 0,
+                                      Out, space, &size );
+
+    *ResultSize = (result == LJ92_ERROR_NONE) ? size : 0;
+    return (result == LJ92_ERROR_NONE);
+}
@@ -24,25 +24,33 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 
 #include "../include/MLVFrameUtils.h"
+#include "liblj92/lj92.h"
 
 /* Packing probably only works on little endian (just needs an extra swap at the
  * end to fix this, does not matter right now) */
 
-void MLVPackFrame14(uint16_t * Data, uint32_t Elements, void * Out)
+/* Every pack function first shifts pixels right and then left by these, so
+ * they can go from any source bitdepth to the output one in the same pass */
+#define SHIFT_PIXEL(Pixel, RightShift, LeftShift) \
+    ((uint16_t)(((Pixel) >> (RightShift)) << (LeftShift)))
+
+static void pack_frame14_scalar(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
 {
     uint16_t * output = Out;
     for (int i = 0; i < Elements; i += 8)
     {
-        uint16_t pix_a = Data[ i ] & 0x3FFF;
-        uint16_t pix_b = Data[i+1] & 0x3FFF;
-        uint16_t pix_c = Data[i+2] & 0x3FFF;
-        uint16_t pix_d = Data[i+3] & 0x3FFF;
-        uint16_t pix_e = Data[i+4] & 0x3FFF;
-        uint16_t pix_f = Data[i+5] & 0x3FFF;
-        uint16_t pix_g = Data[i+6] & 0x3FFF;
-        uint16_t pix_h = Data[i+7] & 0x3FFF;
+        uint16_t pix_a = SHIFT_PIXEL(Data[ i ], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_b = SHIFT_PIXEL(Data[i+1], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_c = SHIFT_PIXEL(Data[i+2], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_d = SHIFT_PIXEL(Data[i+3], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_e = SHIFT_PIXEL(Data[i+4], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_f = SHIFT_PIXEL(Data[i+5], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_g = SHIFT_PIXEL(Data[i+6], RightShift, LeftShift) & 0x3FFF;
+        uint16_t pix_h = SHIFT_PIXEL(Data[i+7], RightShift, LeftShift) & 0x3FFF;
 
         output[0] = (pix_a << 2) | (pix_b >> 12);
         output[1] = (pix_b << 4) | (pix_c >> 10);
@@ -56,15 +64,15 @@ void MLVPackFrame14(uint16_t * Data, uint32_t Elements, void * Out)
     }
 }
 
-void MLVPackFrame12(uint16_t * Data, uint32_t Elements, void * Out)
+static void pack_frame12_scalar(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
 {
     uint16_t * output = Out;
     for (int i = 0; i < Elements; i += 4)
     {
-        uint16_t pix_a = Data[ i ] & 0x0FFF;
-        uint16_t pix_b = Data[i+1] & 0x0FFF;
-        uint16_t pix_c = Data[i+2] & 0x0FFF;
-        uint16_t pix_d = Data[i+3] & 0x0FFF;
+        uint16_t pix_a = SHIFT_PIXEL(Data[ i ], RightShift, LeftShift) & 0x0FFF;
+        uint16_t pix_b = SHIFT_PIXEL(Data[i+1], RightShift, LeftShift) & 0x0FFF;
+        uint16_t pix_c = SHIFT_PIXEL(Data[i+2], RightShift, LeftShift) & 0x0FFF;
+        uint16_t pix_d = SHIFT_PIXEL(Data[i+3], RightShift, LeftShift) & 0x0FFF;
 
         output[0] = (pix_a << 4) | (pix_b >> 8);
         output[1] = (pix_b << 8) | (pix_c >> 4);
@@ -74,19 +82,19 @@ void MLVPackFrame12(uint16_t * Data, uint32_t Elements, void * Out)
     }
 }
 
-void MLVPackFrame10(uint16_t * Data, uint32_t Elements, void * Out)
+static void pack_frame10_scalar(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
 {
     uint16_t * output = Out;
     for (int i = 0; i < Elements; i += 8)
     {
-        uint16_t pix_a = Data[ i ] & 0x03FF;
-        uint16_t pix_b = Data[i+1] & 0x03FF;
-        uint16_t pix_c = Data[i+2] & 0x03FF;
-        uint16_t pix_d = Data[i+3] & 0x03FF;
-        uint16_t pix_e = Data[i+4] & 0x03FF;
-        uint16_t pix_f = Data[i+5] & 0x03FF;
-        uint16_t pix_g = Data[i+6] & 0x03FF;
-        uint16_t pix_h = Data[i+7] & 0x03FF;
+        uint16_t pix_a = SHIFT_PIXEL(Data[ i ], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_b = SHIFT_PIXEL(Data[i+1], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_c = SHIFT_PIXEL(Data[i+2], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_d = SHIFT_PIXEL(Data[i+3], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_e = SHIFT_PIXEL(Data[i+4], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_f = SHIFT_PIXEL(Data[i+5], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_g = SHIFT_PIXEL(Data[i+6], RightShift, LeftShift) & 0x03FF;
+        uint16_t pix_h = SHIFT_PIXEL(Data[i+7], RightShift, LeftShift) & 0x03FF;
 
         output[0] = (pix_a << 6) | (pix_b >> 4);
         output[1] = (pix_b << 12) | (pix_c << 2) | (pix_d >> 8);
@@ -98,7 +106,19 @@ void MLVPackFrame10(uint16_t * Data, uint32_t Elements, void * Out)
     }
 }
 
-void MLVUnpackFrame14(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+static void pack_frame16_scalar(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    if (RightShift == 0 && LeftShift == 0)
+    {
+        if (Out != Data) memmove(Out, Data, Elements * sizeof(uint16_t));
+        return;
+    }
+
+    for (uint32_t i = 0; i < Elements; ++i)
+        Out[i] = SHIFT_PIXEL(Data[i], RightShift, LeftShift);
+}
+
+static void unpack_frame14_scalar(uint16_t * Data, uint32_t Elements, uint16_t * Out)
 {
     uint16_t * out_end = Out + Elements;
     for (;Out < out_end; Out += 8)
@@ -124,7 +144,7 @@ void MLVUnpackFrame14(uint16_t * Data, uint32_t Elements, uint16_t * Out)
     }
 }
 
-void MLVUnpackFrame12(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+static void unpack_frame12_scalar(uint16_t * Data, uint32_t Elements, uint16_t * Out)
 {
     uint16_t * out_end = Out + Elements;
     for (;Out < out_end; Out += 4)
@@ -135,14 +155,14 @@ void MLVUnpackFrame12(uint16_t * Data, uint32_t Elements, uint16_t * Out)
 
         Out[0] = word_a >> 4;
         Out[1] = ((word_a << 8) | (word_b >>  8)) & 0x0FFF;
-        Out[2] = ((word_b << 4) | (word_b >> 12)) & 0x0FFF;
+        Out[2] = ((word_b << 4) | (word_c >> 12)) & 0x0FFF;
         Out[3] = word_c & 0x0FFF;
 
         Data += 3;
     }
 }
 
-void MLVUnpackFrame10(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+static void unpack_frame10_scalar(uint16_t * Data, uint32_t Elements, uint16_t * Out)
 {
     uint16_t * out_end = Out + Elements;
     for (;Out < out_end; Out += 8)
@@ -157,7 +177,7 @@ void MLVUnpackFrame10(uint16_t * Data, uint32_t Elements, uint16_t * Out)
         Out[1] = ((word_a << 4) | (word_b >> 12)) & 0x03FF;
         Out[2] = (word_b >> 2) & 0x03FF;
         Out[3] = ((word_b << 8) | (word_c >> 8)) & 0x03FF;
-        Out[4] = (word_c << 2) & 0x03FF;
+        Out[4] = ((word_c << 2) | (word_d >> 14)) & 0x03FF;
         Out[5] = ((word_c << 12) | (word_d >> 4)) & 0x03FF;
         Out[6] = ((word_d << 6) | (word_e >> 10)) & 0x03FF;
         Out[7] = word_e & 0x03FF;
@@ -166,12 +186,672 @@ void MLVUnpackFrame10(uint16_t * Data, uint32_t Elements, uint16_t * Out)
     }
 }
 
-void MLVCompressFrameLJ92( uint16_t * Data,
-                           int Width,
-                           int Height,
-                           int Bitdepth,
-                           void * Out,
-                           size_t * ResultSize )
+/* SIMD unpacking. Each pixel is made from two neighbouring 16 bit words of the
+ * packed data, hi and lo, as ((hi << (16-s)) | (lo >> s)) & mask, with s from
+ * 1 to 16 depending on where in the group of pixels it is. For a whole group,
+ * lo is a shuffle of the packed words, and hi is lo moved along by one word
+ * (where that gives the wrong word, those bits get masked off anyway).
+ *
+ * The x86 versions shift using multiplication by 2^(16-s) (mullo for hi, mulhi
+ * for lo) as SSE2 and AVX2 can't shift each element by a different amount.
+ * Vector kernels read a little past each group, so they stop before the last
+ * group and leave the rest to the scalar versions. They return how many pixels
+ * they did. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MLV_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MLV_HAVE_GENERIC_SIMD
+#endif
+
+#ifdef MLV_HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static uint32_t unpack_frame14_sse2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m128i mult = _mm_setr_epi16(1<<14, 1<<12, 1<<10, 1<<8, 1<<6, 1<<4, 1<<2, 1);
+    const __m128i mask = _mm_set1_epi16(0x3FFF);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128((__m128i *)Data);
+        __m128i hi = _mm_slli_si128(lo, 2);
+        __m128i pixels = _mm_or_si128(_mm_mullo_epi16(hi, mult), _mm_mulhi_epu16(lo, mult));
+        _mm_storeu_si128((__m128i *)(Out + i), _mm_and_si128(pixels, mask));
+        Data += 7;
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t unpack_frame12_sse2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m128i mult = _mm_setr_epi16(1<<12, 1<<8, 1<<4, 1, 1<<12, 1<<8, 1<<4, 1);
+    const __m128i mask = _mm_set1_epi16(0x0FFF);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        __m128i words = _mm_loadu_si128((__m128i *)Data);
+        __m128i lo = _mm_unpacklo_epi64(words, _mm_srli_si128(words, 6));
+        __m128i hi = _mm_slli_si128(lo, 2);
+        __m128i pixels = _mm_or_si128(_mm_mullo_epi16(hi, mult), _mm_mulhi_epu16(lo, mult));
+        _mm_storeu_si128((__m128i *)(Out + i), _mm_and_si128(pixels, mask));
+        Data += 6;
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t unpack_frame10_sse2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m128i mult = _mm_setr_epi16(1<<10, 1<<4, 1<<14, 1<<8, 1<<2, 1<<12, 1<<6, 1);
+    const __m128i mask = _mm_set1_epi16(0x03FF);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        __m128i words = _mm_loadu_si128((__m128i *)Data);
+        __m128i lo = _mm_unpacklo_epi64(_mm_shufflelo_epi16(words, _MM_SHUFFLE(2,1,1,0)),
+                                        _mm_shufflelo_epi16(_mm_srli_si128(words, 6), _MM_SHUFFLE(1,1,0,0)));
+        __m128i hi = _mm_slli_si128(lo, 2);
+        __m128i pixels = _mm_or_si128(_mm_mullo_epi16(hi, mult), _mm_mulhi_epu16(lo, mult));
+        _mm_storeu_si128((__m128i *)(Out + i), _mm_and_si128(pixels, mask));
+        Data += 5;
+    }
+
+    return i;
+}
+
+/* AVX2 versions do two groups at once, one in each 128 bit lane */
+#define LOAD_TWO_GROUPS(Data, GroupWords) \
+    _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *)(Data))), \
+                            _mm_loadu_si128((__m128i *)((Data) + (GroupWords))), 1)
+
+__attribute__((target("avx2")))
+static uint32_t unpack_frame14_avx2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m256i mult = _mm256_setr_epi16(1<<14, 1<<12, 1<<10, 1<<8, 1<<6, 1<<4, 1<<2, 1,
+                                           1<<14, 1<<12, 1<<10, 1<<8, 1<<6, 1<<4, 1<<2, 1);
+    const __m256i mask = _mm256_set1_epi16(0x3FFF);
+    uint32_t i = 0;
+
+    for (; i + 24 <= Elements; i += 16)
+    {
+        __m256i lo = LOAD_TWO_GROUPS(Data, 7);
+        __m256i hi = _mm256_slli_si256(lo, 2);
+        __m256i pixels = _mm256_or_si256(_mm256_mullo_epi16(hi, mult), _mm256_mulhi_epu16(lo, mult));
+        _mm256_storeu_si256((__m256i *)(Out + i), _mm256_and_si256(pixels, mask));
+        Data += 14;
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack_frame12_avx2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m256i mult = _mm256_setr_epi16(1<<12, 1<<8, 1<<4, 1, 1<<12, 1<<8, 1<<4, 1,
+                                           1<<12, 1<<8, 1<<4, 1, 1<<12, 1<<8, 1<<4, 1);
+    const __m256i mask = _mm256_set1_epi16(0x0FFF);
+    uint32_t i = 0;
+
+    for (; i + 24 <= Elements; i += 16)
+    {
+        __m256i words = LOAD_TWO_GROUPS(Data, 6);
+        __m256i lo = _mm256_unpacklo_epi64(words, _mm256_srli_si256(words, 6));
+        __m256i hi = _mm256_slli_si256(lo, 2);
+        __m256i pixels = _mm256_or_si256(_mm256_mullo_epi16(hi, mult), _mm256_mulhi_epu16(lo, mult));
+        _mm256_storeu_si256((__m256i *)(Out + i), _mm256_and_si256(pixels, mask));
+        Data += 12;
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack_frame10_avx2(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const __m256i mult = _mm256_setr_epi16(1<<10, 1<<4, 1<<14, 1<<8, 1<<2, 1<<12, 1<<6, 1,
+                                           1<<10, 1<<4, 1<<14, 1<<8, 1<<2, 1<<12, 1<<6, 1);
+    const __m256i mask = _mm256_set1_epi16(0x03FF);
+    uint32_t i = 0;
+
+    for (; i + 24 <= Elements; i += 16)
+    {
+        __m256i words = LOAD_TWO_GROUPS(Data, 5);
+        __m256i lo = _mm256_unpacklo_epi64(_mm256_shufflelo_epi16(words, _MM_SHUFFLE(2,1,1,0)),
+                                           _mm256_shufflelo_epi16(_mm256_srli_si256(words, 6), _MM_SHUFFLE(1,1,0,0)));
+        __m256i hi = _mm256_slli_si256(lo, 2);
+        __m256i pixels = _mm256_or_si256(_mm256_mullo_epi16(hi, mult), _mm256_mulhi_epu16(lo, mult));
+        _mm256_storeu_si256((__m256i *)(Out + i), _mm256_and_si256(pixels, mask));
+        Data += 10;
+    }
+
+    return i;
+}
+
+/* SIMD packing is unpacking backwards: each packed word is made from up to
+ * three neighbouring pixels, hi, mid and lo, as (hi << l) | (mid << m) | (lo >> r).
+ * Shifts use multiplication again, with a multiplier of zero wherever a word
+ * does not take a pixel from that position (words with r = 0 get lo as mid).
+ * Each group of 8 pixels is stored with a full 16 byte write, the extra bytes
+ * get overwritten by the next group, so the kernels stop a group early. */
+
+__attribute__((target("sse2")))
+static inline __m128i load_pixels_sse2(uint16_t * Data, __m128i RightShift, __m128i LeftShift, __m128i Mask)
+{
+    __m128i pixels = _mm_loadu_si128((__m128i *)Data);
+    return _mm_and_si128(_mm_sll_epi16(_mm_srl_epi16(pixels, RightShift), LeftShift), Mask);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i Mask, __m128i A, __m128i B)
+{
+    return _mm_or_si128(_mm_and_si128(Mask, A), _mm_andnot_si128(Mask, B));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pack_words_sse2(__m128i Hi, __m128i Mid, __m128i Lo, __m128i HiMult, __m128i MidMult, __m128i LoMult)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_mullo_epi16(Hi, HiMult), _mm_mullo_epi16(Mid, MidMult)),
+                        _mm_mulhi_epu16(Lo, LoMult));
+}
+
+#define PACK14_MULTIPLIERS \
+    hi_mult = _mm_setr_epi16(1<<2, 1<<4, 1<<6, 1<<8, 1<<10, 1<<12, 1<<14, 0), \
+    mid_mult = _mm_setr_epi16(0, 0, 0, 0, 0, 0, 1, 0), \
+    lo_mult = _mm_setr_epi16(1<<4, 1<<6, 1<<8, 1<<10, 1<<12, 1<<14, 0, 0)
+
+#define PACK12_MULTIPLIERS \
+    hi_mult = _mm_setr_epi16(1<<4, 1<<8, 1<<12, 1<<4, 1<<8, 1<<12, 0, 0), \
+    mid_mult = _mm_setr_epi16(0, 0, 1, 0, 0, 1, 0, 0), \
+    lo_mult = _mm_setr_epi16(1<<8, 1<<12, 0, 1<<8, 1<<12, 0, 0, 0)
+
+#define PACK10_MULTIPLIERS \
+    hi_mult = _mm_setr_epi16(1<<6, 1<<12, 1<<8, 1<<14, 1<<10, 0, 0, 0), \
+    mid_mult = _mm_setr_epi16(0, 1<<2, 0, 1<<4, 1, 0, 0, 0), \
+    lo_mult = _mm_setr_epi16(1<<12, 1<<8, 1<<14, 1<<10, 0, 0, 0, 0)
+
+__attribute__((target("sse2")))
+static uint32_t pack_frame14_sse2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK14_MULTIPLIERS, mask = _mm_set1_epi16(0x3FFF);
+    const __m128i right = _mm_cvtsi32_si128(RightShift), left = _mm_cvtsi32_si128(LeftShift);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        __m128i hi = load_pixels_sse2(Data + i, right, left, mask);
+        __m128i lo = _mm_srli_si128(hi, 2);
+        _mm_storeu_si128((__m128i *)Out, pack_words_sse2(hi, lo, lo, hi_mult, mid_mult, lo_mult));
+        Out += 7;
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t pack_frame12_sse2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK12_MULTIPLIERS, mask = _mm_set1_epi16(0x0FFF);
+    const __m128i right = _mm_cvtsi32_si128(RightShift), left = _mm_cvtsi32_si128(LeftShift);
+    const __m128i first_three = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        /* Pixels a-h, hi = a b c e f g, lo = b c d f g h */
+        __m128i pixels = load_pixels_sse2(Data + i, right, left, mask);
+        __m128i next = _mm_srli_si128(pixels, 2);
+        __m128i hi = blend_sse2(first_three, pixels, next);
+        __m128i lo = blend_sse2(first_three, next, _mm_srli_si128(next, 2));
+        _mm_storeu_si128((__m128i *)Out, pack_words_sse2(hi, lo, lo, hi_mult, mid_mult, lo_mult));
+        Out += 6;
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t pack_frame10_sse2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK10_MULTIPLIERS, mask = _mm_set1_epi16(0x03FF);
+    const __m128i right = _mm_cvtsi32_si128(RightShift), left = _mm_cvtsi32_si128(LeftShift);
+    const __m128i first_two = _mm_setr_epi16(-1, -1, 0, 0, 0, 0, 0, 0);
+    const __m128i first_three = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        /* Pixels a-h, hi = a b d e g, mid = - c - f h, lo = b d e g */
+        __m128i pixels = load_pixels_sse2(Data + i, right, left, mask);
+        __m128i e_g = _mm_shufflehi_epi16(pixels, _MM_SHUFFLE(3,3,2,0));
+        __m128i f_h = _mm_shufflehi_epi16(pixels, _MM_SHUFFLE(3,3,3,1));
+        __m128i hi = blend_sse2(first_three, _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3,3,1,0)), _mm_srli_si128(e_g, 2));
+        __m128i mid = blend_sse2(first_three, _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(2,2,2,2)), _mm_srli_si128(f_h, 2));
+        __m128i lo = blend_sse2(first_two, _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3,3,3,1)), _mm_srli_si128(e_g, 4));
+        _mm_storeu_si128((__m128i *)Out, pack_words_sse2(hi, mid, lo, hi_mult, mid_mult, lo_mult));
+        Out += 5;
+    }
+
+    return i;
+}
+
+/* AVX2 versions pick out hi, mid and lo with byte shuffles (-1 gives zero),
+ * and store the two groups separately as they pack to less than 16 bytes */
+#define SHUFFLE_WORDS(W0, W1, W2, W3, W4, W5, W6, W7) \
+    _mm256_broadcastsi128_si256(_mm_setr_epi8(SHUFFLE_WORD(W0), SHUFFLE_WORD(W1), SHUFFLE_WORD(W2), SHUFFLE_WORD(W3), \
+                                              SHUFFLE_WORD(W4), SHUFFLE_WORD(W5), SHUFFLE_WORD(W6), SHUFFLE_WORD(W7)))
+#define SHUFFLE_WORD(W) ((W) < 0 ? -1 : (W)*2), ((W) < 0 ? -1 : (W)*2+1)
+
+__attribute__((target("avx2")))
+static inline uint32_t pack_frame_avx2( uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift,
+                                        uint16_t Mask, int GroupWords, __m256i HiShuffle, __m256i MidShuffle,
+                                        __m256i LoShuffle, __m128i HiMult, __m128i MidMult, __m128i LoMult,
+                                        uint16_t * Out )
+{
+    const __m256i hi_mult = _mm256_broadcastsi128_si256(HiMult);
+    const __m256i mid_mult = _mm256_broadcastsi128_si256(MidMult);
+    const __m256i lo_mult = _mm256_broadcastsi128_si256(LoMult);
+    const __m256i mask = _mm256_set1_epi16(Mask);
+    const __m128i right = _mm_cvtsi32_si128(RightShift), left = _mm_cvtsi32_si128(LeftShift);
+    uint32_t i = 0;
+
+    for (; i + 24 <= Elements; i += 16)
+    {
+        __m256i pixels = _mm256_loadu_si256((__m256i *)(Data + i));
+        pixels = _mm256_and_si256(_mm256_sll_epi16(_mm256_srl_epi16(pixels, right), left), mask);
+        __m256i hi = _mm256_mullo_epi16(_mm256_shuffle_epi8(pixels, HiShuffle), hi_mult);
+        __m256i mid = _mm256_mullo_epi16(_mm256_shuffle_epi8(pixels, MidShuffle), mid_mult);
+        __m256i lo = _mm256_mulhi_epu16(_mm256_shuffle_epi8(pixels, LoShuffle), lo_mult);
+        __m256i words = _mm256_or_si256(_mm256_or_si256(hi, mid), lo);
+        _mm_storeu_si128((__m128i *)Out, _mm256_castsi256_si128(words));
+        _mm_storeu_si128((__m128i *)(Out + GroupWords), _mm256_extracti128_si256(words, 1));
+        Out += GroupWords * 2;
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t pack_frame14_avx2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK14_MULTIPLIERS;
+    return pack_frame_avx2( Data, Elements, RightShift, LeftShift, 0x3FFF, 7,
+                            SHUFFLE_WORDS(0, 1, 2, 3, 4, 5, 6, -1),
+                            SHUFFLE_WORDS(-1, -1, -1, -1, -1, -1, 7, -1),
+                            SHUFFLE_WORDS(1, 2, 3, 4, 5, 6, -1, -1),
+                            hi_mult, mid_mult, lo_mult, Out );
+}
+
+__attribute__((target("avx2")))
+static uint32_t pack_frame12_avx2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK12_MULTIPLIERS;
+    return pack_frame_avx2( Data, Elements, RightShift, LeftShift, 0x0FFF, 6,
+                            SHUFFLE_WORDS(0, 1, 2, 4, 5, 6, -1, -1),
+                            SHUFFLE_WORDS(-1, -1, 3, -1, -1, 7, -1, -1),
+                            SHUFFLE_WORDS(1, 2, -1, 5, 6, -1, -1, -1),
+                            hi_mult, mid_mult, lo_mult, Out );
+}
+
+__attribute__((target("avx2")))
+static uint32_t pack_frame10_avx2(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const __m128i PACK10_MULTIPLIERS;
+    return pack_frame_avx2( Data, Elements, RightShift, LeftShift, 0x03FF, 5,
+                            SHUFFLE_WORDS(0, 1, 3, 4, 6, -1, -1, -1),
+                            SHUFFLE_WORDS(-1, 2, -1, 5, 7, -1, -1, -1),
+                            SHUFFLE_WORDS(1, 3, 4, 6, -1, -1, -1, -1),
+                            hi_mult, mid_mult, lo_mult, Out );
+}
+
+#endif
+
+#ifdef MLV_HAVE_GENERIC_SIMD
+
+/* Compiler vector extensions, for other processors (such as NEON on ARM).
+ * These can shift each element differently, so no multiplication is needed.
+ * Element 8 in shuffles is zero, for pixels that only need one word. */
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+
+#ifdef __clang__
+#define SHUFFLE_U16X8(A, B, I0, I1, I2, I3, I4, I5, I6, I7) \
+    __builtin_shufflevector(A, B, I0, I1, I2, I3, I4, I5, I6, I7)
+#else
+#define SHUFFLE_U16X8(A, B, I0, I1, I2, I3, I4, I5, I6, I7) \
+    __builtin_shuffle(A, B, (u16x8){I0, I1, I2, I3, I4, I5, I6, I7})
+#endif
+
+static inline u16x8 load_u16x8(uint16_t * Data)
+{
+    u16x8 v;
+    memcpy(&v, Data, sizeof(v));
+    return v;
+}
+
+static uint32_t unpack_frame14_generic(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const u16x8 zero = {0}, mask = zero + 0x3FFF;
+    const u16x8 hi_shift = {14, 12, 10, 8, 6, 4, 2, 0};
+    const u16x8 lo_shift = {2, 4, 6, 8, 10, 12, 14, 15};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 words = load_u16x8(Data);
+        u16x8 lo = SHUFFLE_U16X8(words, zero, 0, 1, 2, 3, 4, 5, 6, 8);
+        u16x8 hi = SHUFFLE_U16X8(words, zero, 8, 0, 1, 2, 3, 4, 5, 6);
+        u16x8 pixels = ((hi << hi_shift) | (lo >> lo_shift)) & mask;
+        memcpy(Out + i, &pixels, sizeof(pixels));
+        Data += 7;
+    }
+
+    return i;
+}
+
+static uint32_t unpack_frame12_generic(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const u16x8 zero = {0}, mask = zero + 0x0FFF;
+    const u16x8 hi_shift = {12, 8, 4, 0, 12, 8, 4, 0};
+    const u16x8 lo_shift = {4, 8, 12, 15, 4, 8, 12, 15};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 words = load_u16x8(Data);
+        u16x8 lo = SHUFFLE_U16X8(words, zero, 0, 1, 2, 8, 3, 4, 5, 8);
+        u16x8 hi = SHUFFLE_U16X8(words, zero, 8, 0, 1, 2, 8, 3, 4, 5);
+        u16x8 pixels = ((hi << hi_shift) | (lo >> lo_shift)) & mask;
+        memcpy(Out + i, &pixels, sizeof(pixels));
+        Data += 6;
+    }
+
+    return i;
+}
+
+static uint32_t unpack_frame10_generic(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    const u16x8 zero = {0}, mask = zero + 0x03FF;
+    const u16x8 hi_shift = {10, 4, 14, 8, 2, 12, 6, 0};
+    const u16x8 lo_shift = {6, 12, 2, 8, 14, 4, 10, 15};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 words = load_u16x8(Data);
+        u16x8 lo = SHUFFLE_U16X8(words, zero, 0, 1, 1, 2, 3, 3, 4, 8);
+        u16x8 hi = SHUFFLE_U16X8(words, zero, 8, 0, 8, 1, 2, 8, 3, 4);
+        u16x8 pixels = ((hi << hi_shift) | (lo >> lo_shift)) & mask;
+        memcpy(Out + i, &pixels, sizeof(pixels));
+        Data += 5;
+    }
+
+    return i;
+}
+
+/* Packing, element 8 in shuffles is zero again */
+static inline u16x8 load_pixels_u16x8(uint16_t * Data, int RightShift, int LeftShift, uint16_t Mask)
+{
+    return ((load_u16x8(Data) >> (uint16_t)RightShift) << (uint16_t)LeftShift) & Mask;
+}
+
+static uint32_t pack_frame14_generic(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const u16x8 zero = {0};
+    const u16x8 hi_shift = {2, 4, 6, 8, 10, 12, 14, 0};
+    const u16x8 lo_shift = {12, 10, 8, 6, 4, 2, 0, 0};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 pixels = load_pixels_u16x8(Data + i, RightShift, LeftShift, 0x3FFF);
+        u16x8 hi = SHUFFLE_U16X8(pixels, zero, 0, 1, 2, 3, 4, 5, 6, 8);
+        u16x8 lo = SHUFFLE_U16X8(pixels, zero, 1, 2, 3, 4, 5, 6, 7, 8);
+        u16x8 words = (hi << hi_shift) | (lo >> lo_shift);
+        memcpy(Out, &words, sizeof(words));
+        Out += 7;
+    }
+
+    return i;
+}
+
+static uint32_t pack_frame12_generic(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const u16x8 zero = {0};
+    const u16x8 hi_shift = {4, 8, 12, 4, 8, 12, 0, 0};
+    const u16x8 lo_shift = {8, 4, 0, 8, 4, 0, 0, 0};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 pixels = load_pixels_u16x8(Data + i, RightShift, LeftShift, 0x0FFF);
+        u16x8 hi = SHUFFLE_U16X8(pixels, zero, 0, 1, 2, 4, 5, 6, 8, 8);
+        u16x8 lo = SHUFFLE_U16X8(pixels, zero, 1, 2, 3, 5, 6, 7, 8, 8);
+        u16x8 words = (hi << hi_shift) | (lo >> lo_shift);
+        memcpy(Out, &words, sizeof(words));
+        Out += 6;
+    }
+
+    return i;
+}
+
+static uint32_t pack_frame10_generic(uint16_t * Data, uint32_t Elements, int RightShift, int LeftShift, uint16_t * Out)
+{
+    const u16x8 zero = {0};
+    const u16x8 hi_shift = {6, 12, 8, 14, 10, 0, 0, 0};
+    const u16x8 mid_shift = {0, 2, 0, 4, 0, 0, 0, 0};
+    const u16x8 lo_shift = {4, 8, 2, 6, 0, 0, 0, 0};
+    uint32_t i = 0;
+
+    for (; i + 16 <= Elements; i += 8)
+    {
+        u16x8 pixels = load_pixels_u16x8(Data + i, RightShift, LeftShift, 0x03FF);
+        u16x8 hi = SHUFFLE_U16X8(pixels, zero, 0, 1, 3, 4, 6, 8, 8, 8);
+        u16x8 mid = SHUFFLE_U16X8(pixels, zero, 8, 2, 8, 5, 8, 8, 8, 8);
+        u16x8 lo = SHUFFLE_U16X8(pixels, zero, 1, 3, 4, 6, 7, 8, 8, 8);
+        u16x8 words = (hi << hi_shift) | (mid << mid_shift) | (lo >> lo_shift);
+        memcpy(Out, &words, sizeof(words));
+        Out += 5;
+    }
+
+    return i;
+}
+
+#endif
+
+/* Runtime selection of SIMD kernels */
+
+static int simd_level = -1;
+
+static int is_simd_supported(int Level)
+{
+    switch (Level)
+    {
+        case MLV_SIMD_NONE:
+            return 1;
+#ifdef MLV_HAVE_GENERIC_SIMD
+        case MLV_SIMD_GENERIC:
+            return 1;
+#endif
+#ifdef MLV_HAVE_X86_SIMD
+        case MLV_SIMD_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case MLV_SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return 0;
+    }
+}
+
+int MLVGetSIMD()
 {
-    return;
-}
\ No newline at end of file
+    if (simd_level < 0)
+    {
+        int best = MLV_SIMD_NONE;
+        for (int level = MLV_SIMD_GENERIC; level <= MLV_SIMD_AVX2; ++level)
+            if (is_simd_supported(level)) best = level;
+        simd_level = best;
+    }
+
+    return simd_level;
+}
+
+int MLVSetSIMD(int Level)
+{
+    if (!is_simd_supported(Level)) return 0;
+    simd_level = Level;
+    return 1;
+}
+
+/* Unpacks with the selected kernel, then finishes off with the scalar one */
+#define UNPACK_WITH_BEST_KERNEL(Bits, Data, Elements, Out)                        \
+    do {                                                                          \
+        uint32_t done = 0;                                                        \
+        switch (MLVGetSIMD())                                                     \
+        {                                                                         \
+            UNPACK_CASES_X86(Bits, Data, Elements, Out)                           \
+            UNPACK_CASES_GENERIC(Bits, Data, Elements, Out)                       \
+            default: break;                                                       \
+        }                                                                         \
+        unpack_frame##Bits##_scalar((uint16_t *)((uint8_t *)(Data) + (uint64_t)done * (Bits) / 8), \
+                                    (Elements) - done, (Out) + done);             \
+    } while (0)
+
+#ifdef MLV_HAVE_X86_SIMD
+#define UNPACK_CASES_X86(Bits, Data, Elements, Out) \
+    case MLV_SIMD_SSE2: done = unpack_frame##Bits##_sse2(Data, Elements, Out); break; \
+    case MLV_SIMD_AVX2: done = unpack_frame##Bits##_avx2(Data, Elements, Out); break;
+#else
+#define UNPACK_CASES_X86(Bits, Data, Elements, Out)
+#endif
+
+#ifdef MLV_HAVE_GENERIC_SIMD
+#define UNPACK_CASES_GENERIC(Bits, Data, Elements, Out) \
+    case MLV_SIMD_GENERIC: done = unpack_frame##Bits##_generic(Data, Elements, Out); break;
+#else
+#define UNPACK_CASES_GENERIC(Bits, Data, Elements, Out)
+#endif
+
+void MLVUnpackFrame14(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    UNPACK_WITH_BEST_KERNEL(14, Data, Elements, Out);
+}
+
+void MLVUnpackFrame12(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    UNPACK_WITH_BEST_KERNEL(12, Data, Elements, Out);
+}
+
+void MLVUnpackFrame10(uint16_t * Data, uint32_t Elements, uint16_t * Out)
+{
+    UNPACK_WITH_BEST_KERNEL(10, Data, Elements, Out);
+}
+
+/* Same for packing */
+#define PACK_WITH_BEST_KERNEL(Bits, Data, Elements, RightShift, LeftShift, Out)     \
+    do {                                                                          \
+        uint32_t done = 0;                                                        \
+        switch (MLVGetSIMD())                                                     \
+        {                                                                         \
+            PACK_CASES_X86(Bits, Data, Elements, RightShift, LeftShift, Out)      \
+            PACK_CASES_GENERIC(Bits, Data, Elements, RightShift, LeftShift, Out)  \
+            default: break;                                                       \
+        }                                                                         \
+        pack_frame##Bits##_scalar((Data) + done, (Elements) - done, RightShift, LeftShift, \
+                                  (uint16_t *)((uint8_t *)(Out) + (uint64_t)done * (Bits) / 8)); \
+    } while (0)
+
+#ifdef MLV_HAVE_X86_SIMD
+#define PACK_CASES_X86(Bits, Data, Elements, RightShift, LeftShift, Out) \
+    case MLV_SIMD_SSE2: done = pack_frame##Bits##_sse2(Data, Elements, RightShift, LeftShift, Out); break; \
+    case MLV_SIMD_AVX2: done = pack_frame##Bits##_avx2(Data, Elements, RightShift, LeftShift, Out); break;
+#else
+#define PACK_CASES_X86(Bits, Data, Elements, RightShift, LeftShift, Out)
+#endif
+
+#ifdef MLV_HAVE_GENERIC_SIMD
+#define PACK_CASES_GENERIC(Bits, Data, Elements, RightShift, LeftShift, Out) \
+    case MLV_SIMD_GENERIC: done = pack_frame##Bits##_generic(Data, Elements, RightShift, LeftShift, Out); break;
+#else
+#define PACK_CASES_GENERIC(Bits, Data, Elements, RightShift, LeftShift, Out)
+#endif
+
+int MLVPackFrame(uint16_t * Data, uint32_t Elements, int SourceBitdepth, int Bitdepth, void * Out)
+{
+    if (SourceBitdepth < 1 || SourceBitdepth > 16) return 0;
+
+    int right_shift = (Bitdepth < SourceBitdepth) ? SourceBitdepth - Bitdepth : 0;
+    int left_shift = (Bitdepth > SourceBitdepth) ? Bitdepth - SourceBitdepth : 0;
+
+    switch (Bitdepth)
+    {
+        case 16:
+            pack_frame16_scalar(Data, Elements, right_shift, left_shift, Out);
+            return 1;
+        case 14:
+            PACK_WITH_BEST_KERNEL(14, Data, Elements, right_shift, left_shift, Out);
+            return 1;
+        case 12:
+            PACK_WITH_BEST_KERNEL(12, Data, Elements, right_shift, left_shift, Out);
+            return 1;
+        case 10:
+            PACK_WITH_BEST_KERNEL(10, Data, Elements, right_shift, left_shift, Out);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void MLVPackFrame14(uint16_t * Data, uint32_t Elements, void * Out)
+{
+    MLVPackFrame(Data, Elements, 14, 14, Out);
+}
+
+void MLVPackFrame12(uint16_t * Data, uint32_t Elements, void * Out)
+{
+    MLVPackFrame(Data, Elements, 12, 12, Out);
+}
+
+void MLVPackFrame10(uint16_t * Data, uint32_t Elements, void * Out)
+{
+    MLVPackFrame(Data, Elements, 10, 10, Out);
+}
+
+int MLVCompressFrameLJ92( uint16_t * Data,
+                          int Width,
+                          int Height,
+                          int Bitdepth,
+                          void * Out,
+                          size_t * ResultSize )
+{
+    lj92_encoder encoder;
+    int encoded_size = 0;
+    size_t max_size = (size_t)Width * Height * sizeof(uint16_t);
+
+    *ResultSize = 0;
+
+    if (lj92_encoder_create(&encoder, NULL, NULL) != LJ92_ERROR_NONE) return 0;
+
+    /* Encoded straight to Out, fails if it would not fit */
+    int result = lj92_encoder_encode( encoder, Data, Width, Height, Bitdepth,
+                                      Width*Height, 0, NULL, 0,
+                                      Out, (max_size > INT_MAX) ? INT_MAX : (int)max_size,
+                                      &encoded_size );
+    lj92_encoder_destroy(encoder);
+
+    if (result != LJ92_ERROR_NONE) return 0;
+
+    *ResultSize = encoded_size;
+    return 1;
+}
@@ -31,10 +31,14 @@ SOFTWARE.
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 //#define SLOW_HUFF
 //#define DEBUG
 
+// Most parts an image is split in to for decoding or encoding in parallel
+#define MAX_PARTS LJ92_MAX_SLICES
+
 typedef struct _ljp {
     u8* data;
     u8* dataend;
@@ -49,7 +53,9 @@ typedef struct _ljp {
     int skiplen; // Skip this many values after each row
     u16* linearize; // Linearization table
     int linlen;
+#ifdef DEBUG
     int sssshist[16];
+#endif
 
     // Huffman table - only one supported, and probably needed
 #ifdef SLOW_HUFF
@@ -64,13 +70,55 @@ typedef struct _ljp {
     int huffbits;
 #endif
     // Parse state
-    int cnt;
-    u32 b;
+    int cnt; // Bits in b
+    u64 b;
+    int ffix; // Next 0xFF byte in the scan data, bytes before it can be loaded at once
+    int pad; // Zero bytes put in b after the end of the scan data
     u16* image;
     u16* rowcache;
     u16* outrow[2];
+    int firstwrite; // Values written before the first skip
+
+    // Restart intervals, each can be decoded on its own
+    int restart; // Restart interval in MCUs, 0 if none
+    int intervalrows; // Rows in each interval
+    int intervals;
+    int* intervalstart; // Where each interval's data starts
+    int intervalstartlen;
+    int pred;
+    int parts; // Intervals are decoded in this many parts
+    int* partret; // Result of each part, not in ljp as parts copy it
+    int partretlen;
+    lj92_parallel parallel;
+    void* parallel_ud;
+
+    // Memory, kept between lj92_reopen calls when big enough
+    lj92_alloc alloc;
+    void* alloc_ud;
+    int hufflutlen; // Entries allocated in hufflut
+    int rowcachelen; // Entries allocated in rowcache
+    int opened; // Set when open succeeded, so decode can be refused otherwise
 } ljp;
 
+static void* default_alloc(void* ud, void* ptr, uint64_t osize, uint64_t nsize) {
+    (void)ud; (void)osize;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+// Makes sure a buffer has room for len elements, only ever grows
+static int reserve(lj92_alloc alloc, void* alloc_ud, void** buffer, int* bufferlen, int len, size_t elementsize) {
+    if (*buffer != NULL && *bufferlen >= len) return 1;
+    void* mem = alloc(alloc_ud, *buffer, (uint64_t)*bufferlen * elementsize, (uint64_t)len * elementsize);
+    if (mem == NULL) return 0;
+    *buffer = mem;
+    *bufferlen = len;
+    return 1;
+}
+
 static int find(ljp* self) {
     int ix = self->ix;
     u8* data = self->data;
@@ -88,8 +136,9 @@ static int find(ljp* self) {
 static int parseHuff(ljp* self) {
     int ret = LJ92_ERROR_CORRUPT;
     u8* huffhead = &self->data[self->ix]; // xstruct.unpack('>HB16B',self.data[self.ix:self.ix+19])
-    u8* bits = &huffhead[2];
+    u8 bits[17]; // Copied, so that the input data is never written to
     bits[0] = 0; // Because table starts from 1
+    for (int b = 1; b < 17; b++) bits[b] = huffhead[2+b];
     int hufflen = BEH(huffhead[0]);
     if ((self->ix + hufflen) >= self->datalen) return ret;
 #ifdef SLOW_HUFF
@@ -224,9 +273,9 @@ static int parseHuff(ljp* self) {
     }
     self->huffbits = maxbits;
     /* Now fill the lut */
-    u16* hufflut = malloc((1<<maxbits) * sizeof(u16));
-    if (hufflut == NULL) return LJ92_ERROR_NO_MEMORY;
-    self->hufflut = hufflut;
+    if (!reserve(self->alloc, self->alloc_ud, (void**)&self->hufflut, &self->hufflutlen, 1<<maxbits, sizeof(u16)))
+        return LJ92_ERROR_NO_MEMORY;
+    u16* hufflut = self->hufflut;
     int i = 0;
     int hv = 0;
     int rv = 0;
@@ -255,11 +304,13 @@ static int parseHuff(ljp* self) {
             continue;
         }
         hcode = huffvals[hv];
+        if (hcode > 16) return LJ92_ERROR_CORRUPT;
         hufflut[i] = hcode<<8 | bitsused;
         //printf("%d %d %d\n",i,bitsused,hcode);
         i++;
         rv++;
     }
+    while (i<1<<maxbits) hufflut[i++] = 0; // Invalid codes
     ret = LJ92_ERROR_NONE;
 #endif
     return ret;
@@ -275,6 +326,13 @@ static int parseSof3(ljp* self) {
     return LJ92_ERROR_NONE;
 }
 
+static int parseDri(ljp* self) {
+    if (self->ix+3 >= self->datalen) return LJ92_ERROR_CORRUPT;
+    self->restart = BEH(self->data[self->ix+2]);
+    self->ix += BEH(self->data[self->ix]);
+    return LJ92_ERROR_NONE;
+}
+
 static int parseBlock(ljp* self) {
     self->ix += BEH(self->data[self->ix]);
     if (self->ix >= self->datalen) return LJ92_ERROR_CORRUPT;
@@ -334,76 +392,102 @@ static int extend(ljp* self,int v,int t) {
 }
 #endif
 
+#ifndef SLOW_HUFF
+// Position of the next 0xFF byte from ix in the scan data (datalen if none)
+static int findff(ljp* self, int ix) {
+    u8* ff = memchr(&self->data[ix], 0xFF, self->datalen - ix);
+    return (ff != NULL) ? (int)(ff - self->data) : self->datalen;
+}
+
+// Fills b up to at least 57 bits. Up to the next 0xFF, 8 bytes are loaded at
+// once. A 0xFF is followed by a stuffed 0x00 that gets skipped, anything else
+// is a marker, which ends the scan data. After the end, zeros are put in.
+static void refill(ljp* self) {
+    u64 b = self->b;
+    int cnt = self->cnt;
+    int ix = self->ix;
+    if (ix + 8 <= self->ffix) {
+        u8* p = &self->data[ix];
+        u64 next = (u64)p[0]<<56 | (u64)p[1]<<48 | (u64)p[2]<<40 | (u64)p[3]<<32
+                 | (u64)p[4]<<24 | (u64)p[5]<<16 | (u64)p[6]<<8 | (u64)p[7];
+        int bytes = (63 - cnt) >> 3;
+        b = (b << (bytes*8)) | (next >> (64 - bytes*8));
+        cnt += bytes*8;
+        ix += bytes;
+    } else {
+        while (cnt <= 56) {
+            u8 byte = 0;
+            if (ix != self->ffix) {
+                byte = self->data[ix++];
+            } else if (ix+1 < self->datalen && self->data[ix+1] == 0x00) {
+                byte = 0xFF;
+                ix += 2;
+                self->ffix = findff(self, ix);
+            } else {
+                self->pad++; // Marker or end of data, stay here
+            }
+            b = (b << 8) | byte;
+            cnt += 8;
+        }
+    }
+    self->b = b;
+    self->cnt = cnt;
+    self->ix = ix;
+}
+#endif
+
 inline static int nextdiff(ljp* self) {
 #ifdef SLOW_HUFF
     int t = decode(self);
     int diff = receive(self,t);
     diff = extend(self,diff,t);
 #else
-    u32 b = self->b;
+    // A code and its extra bits are at most 32 bits
+    if (self->cnt < 32) refill(self);
+    u64 b = self->b;
     int cnt = self->cnt;
     int huffbits = self->huffbits;
-    int ix = self->ix;
-    int next;
-    while (cnt < huffbits) {
-        next = *(u16*)&self->data[ix];
-        int one = next&0xFF;
-        int two = next>>8;
-        b = (b<<16)|(one<<8)|two;
-        cnt += 16;
-        ix += 2;
-        if (one==0xFF) {
-            //printf("%x %x %x %x %d\n",one,two,b,b>>8,cnt);
-            b >>= 8;
-            cnt -= 8;
-        } else if (two==0xFF) ix++;
-    }
-    int index = b >> (cnt - huffbits);
+    int index = (b >> (cnt - huffbits)) & ((1 << huffbits) - 1);
     u16 ssssused = self->hufflut[index];
     int usedbits = ssssused&0xFF;
     int t = ssssused>>8;
-    self->sssshist[t]++;
-    cnt -= usedbits;
-    int keepbitsmask = (1 << cnt)-1;
-    b &= keepbitsmask;
-    while (cnt < t) {
-        next = *(u16*)&self->data[ix];
-        int one = next&0xFF;
-        int two = next>>8;
-        b = (b<<16)|(one<<8)|two;
-        cnt += 16;
-        ix += 2;
-        if (one==0xFF) {
-            b >>= 8;
-            cnt -= 8;
-        } else if (two==0xFF) ix++;
-    }
-    cnt -= t;
-    int diff = b >> cnt;
-    int vt = 1<<(t-1);
-    if (diff < vt) {
-        vt = (-1 << t) + 1;
-        diff += vt;
-    }
-    keepbitsmask = (1 << cnt)-1;
-    self->b = b & keepbitsmask;
-    self->cnt = cnt;
-    self->ix = ix;
-    //printf("%d %d\n",t,diff);
 #ifdef DEBUG
+    self->sssshist[t]++;
 #endif
+    cnt -= usedbits + t;
+    self->cnt = cnt;
+    if (t == 0) return 0;
+    int diff = (b >> cnt) & ((1 << t) - 1);
+    if (diff < (1 << (t-1))) diff -= (1 << t) - 1;
 #endif
     return diff;
 }
 
-static int parsePred6(ljp* self) {
-    int ret = LJ92_ERROR_CORRUPT;
-    self->ix = self->scanstart;
-    //int compcount = self->data[self->ix+2];
-    self->ix += BEH(self->data[self->ix]);
+// Start reading scan data from ix
+static void startbits(ljp* self) {
     self->cnt = 0;
     self->b = 0;
-    int write = self->writelen;
+#ifndef SLOW_HUFF
+    if (self->ix > self->datalen) self->ix = self->datalen;
+    self->pad = 0;
+    self->ffix = findff(self, self->ix);
+#endif
+}
+
+// Set if decoding has gone past the end of the scan data
+static int ranout(ljp* self) {
+#ifdef SLOW_HUFF
+    return self->ix >= self->datalen;
+#else
+    return self->cnt < self->pad*8;
+#endif
+}
+
+// Decodes self->y rows to self->image, from scan data at self->ix
+static int parsePred6(ljp* self) {
+    int ret = LJ92_ERROR_CORRUPT;
+    startbits(self);
+    int write = self->firstwrite;
     // Now need to decode huffman coded values
     int c = 0;
     int pixels = self->y * self->x;
@@ -431,8 +515,11 @@ static int parsePred6(ljp* self) {
         linear = left;
     thisrow[col++] = left;
     out[c++] = linear;
-    if (self->ix >= self->datalen) return ret;
-    --write;
+    if (ranout(self)) return ret;
+    if (--write==0) {
+        out += self->skiplen;
+        write = self->writelen;
+    }
     int rowcount = self->x-1;
     while (rowcount--) {
         diff = nextdiff(self);
@@ -446,7 +533,7 @@ static int parsePred6(ljp* self) {
         thisrow[col++] = left;
         out[c++] = linear;
         //printf("%d %d %d %d %x\n",col-1,diff,left,thisrow[col-1],&thisrow[col-1]);
-        if (self->ix >= self->datalen) return ret;
+        if (ranout(self)) return ret;
         if (--write==0) {
             out += self->skiplen;
             write = self->writelen;
@@ -471,7 +558,7 @@ static int parsePred6(ljp* self) {
         thisrow[col++] = left;
         //printf("%d %d %d %d\n",col,diff,left,lastrow[col]);
         out[c++] = linear;
-        if (self->ix >= self->datalen) break;
+        if (ranout(self)) break;
         rowcount = self->x-1;
         if (--write==0) {
             out += self->skiplen;
@@ -498,23 +585,17 @@ static int parsePred6(ljp* self) {
         temprow = lastrow;
         lastrow = thisrow;
         thisrow = temprow;
-        if (self->ix >= self->datalen) break;
+        if (ranout(self)) break;
     }
     if (c >= pixels) ret = LJ92_ERROR_NONE;
     return ret;
 }
 
-static int parseScan(ljp* self) {
+// Same as parsePred6, for any predictor
+static int parseRows(ljp* self) {
     int ret = LJ92_ERROR_CORRUPT;
-    memset(self->sssshist,0,sizeof(self->sssshist));
-    self->ix = self->scanstart;
-    int compcount = self->data[self->ix+2];
-    int pred = self->data[self->ix+3+2*compcount];
-    if (pred<0 || pred>7) return ret;
-    if (pred==6) return parsePred6(self); // Fast path
-    self->ix += BEH(self->data[self->ix]);
-    self->cnt = 0;
-    self->b = 0;
+    int pred = self->pred;
+    startbits(self);
     u16* out = self->image;
     u16* thisrow = self->outrow[0];
     u16* lastrow = self->outrow[1];
@@ -592,6 +673,103 @@ static int parseScan(ljp* self) {
     return ret;
 }
 
+// Finds where each restart interval starts. An interval ends with a RSTn
+// marker, n counting up from 0 modulo 8. Intervals must be whole rows.
+static int findIntervals(ljp* self, int datastart) {
+    self->intervalrows = self->y;
+    self->intervals = 1;
+    if (self->restart > 0) {
+        if (self->restart % self->x != 0) return LJ92_ERROR_CORRUPT;
+        self->intervalrows = self->restart / self->x;
+        self->intervals = (self->y + self->intervalrows - 1) / self->intervalrows;
+    }
+    if (!reserve(self->alloc, self->alloc_ud, (void**)&self->intervalstart, &self->intervalstartlen, self->intervals, sizeof(int)))
+        return LJ92_ERROR_NO_MEMORY;
+    self->intervalstart[0] = datastart;
+    int ix = datastart;
+    for (int i = 1; i < self->intervals; i++) {
+        while (1) {
+            u8* ff = memchr(&self->data[ix], 0xFF, self->datalen - ix);
+            if (ff == NULL || ff + 1 >= self->dataend) return LJ92_ERROR_CORRUPT;
+            ix = (int)(ff - self->data) + 1;
+            if (*(ff+1) == 0xFF) continue; // Fill byte
+            ix++;
+            if (*(ff+1) == 0x00) continue; // Stuffed
+            if (*(ff+1) != (0xD0 | (i-1)%8)) return LJ92_ERROR_CORRUPT;
+            break;
+        }
+        self->intervalstart[i] = ix;
+    }
+    return LJ92_ERROR_NONE;
+}
+
+// Decodes part of the intervals. Intervals start predicting from scratch like
+// at the top of the image, so parts only need their own row cache.
+static void decodePart(void* arg, int part) {
+    ljp* self = arg;
+    int rowlen = self->x * self->components;
+    int first = part * self->intervals / self->parts;
+    int last = (part+1) * self->intervals / self->parts;
+    int ret = LJ92_ERROR_NONE;
+    for (int i = first; i < last && ret == LJ92_ERROR_NONE; i++) {
+        ljp s = *self;
+        int row = i * self->intervalrows;
+        s.y = (self->y - row < self->intervalrows) ? self->y - row : self->intervalrows;
+        s.ix = self->intervalstart[i];
+        s.outrow[0] = &self->rowcache[part * rowlen * 2];
+        s.outrow[1] = &self->rowcache[part * rowlen * 2 + rowlen];
+        if (self->pred == 6) {
+            // Same position parsePred6 would have got to
+            int c = row * self->x;
+            s.image = self->image + c + (c / self->writelen) * self->skiplen;
+            s.firstwrite = self->writelen - c % self->writelen;
+            ret = parsePred6(&s);
+        } else {
+            s.image = self->image + row * (rowlen + self->skiplen);
+            ret = parseRows(&s);
+        }
+    }
+    self->partret[part] = ret;
+}
+
+static void runParts(lj92_parallel parallel, void* parallel_ud, int count, void (*func)(void* arg, int index), void* arg) {
+    if (parallel != NULL && count > 1)
+        parallel(parallel_ud, count, func, arg);
+    else
+        for (int i = 0; i < count; i++) func(arg, i);
+}
+
+static int parseScan(ljp* self) {
+    int ret = LJ92_ERROR_CORRUPT;
+#ifdef DEBUG
+    memset(self->sssshist,0,sizeof(self->sssshist));
+#endif
+    int ix = self->scanstart;
+    int compcount = self->data[ix+2];
+    int pred = self->data[ix+3+2*compcount];
+    if (pred<0 || pred>7) return ret;
+#ifndef SLOW_HUFF
+    if (self->hufflut == NULL) return ret;
+#endif
+    if (self->writelen <= 0 || self->x <= 0) return ret;
+    ix += BEH(self->data[ix]);
+    if (ix > self->datalen) return ret;
+    self->pred = pred;
+    ret = findIntervals(self, ix);
+    if (ret != LJ92_ERROR_NONE) return ret;
+    self->parts = 1;
+    if (self->parallel != NULL)
+        self->parts = (self->intervals < MAX_PARTS) ? self->intervals : MAX_PARTS;
+    int rowlen = self->x * self->components;
+    if (!reserve(self->alloc, self->alloc_ud, (void**)&self->rowcache, &self->rowcachelen, rowlen * 2 * self->parts, sizeof(u16))
+     || !reserve(self->alloc, self->alloc_ud, (void**)&self->partret, &self->partretlen, self->parts, sizeof(int)))
+        return LJ92_ERROR_NO_MEMORY;
+    runParts(self->parallel, self->parallel_ud, self->parts, decodePart, self);
+    for (int i = 0; i < self->parts; i++)
+        if (self->partret[i] != LJ92_ERROR_NONE) return self->partret[i];
+    return LJ92_ERROR_NONE;
+}
+
 static int parseImage(ljp* self) {
     int ret = LJ92_ERROR_NONE;
     while (1) {
@@ -602,6 +780,8 @@ static int parseImage(ljp* self) {
             ret = parseSof3(self);
         else if (nextMarker == 0xfe)// Comment
             ret = parseBlock(self);
+        else if (nextMarker == 0xdd) // Restart interval
+            ret = parseDri(self);
         else if (nextMarker == 0xd9) // End of image
             break;
         else if (nextMarker == 0xda) {
@@ -640,18 +820,44 @@ static void free_memory(ljp* self) {
     free(self->huffcode);
     self->huffcode = NULL;
 #else
-    free(self->hufflut);
+    if (self->hufflut) self->alloc(self->alloc_ud, self->hufflut, self->hufflutlen * sizeof(u16), 0);
     self->hufflut = NULL;
+    self->hufflutlen = 0;
 #endif
-    free(self->rowcache);
+    if (self->rowcache) self->alloc(self->alloc_ud, self->rowcache, self->rowcachelen * sizeof(u16), 0);
     self->rowcache = NULL;
+    self->rowcachelen = 0;
+    if (self->intervalstart) self->alloc(self->alloc_ud, self->intervalstart, self->intervalstartlen * sizeof(int), 0);
+    self->intervalstart = NULL;
+    self->intervalstartlen = 0;
+    if (self->partret) self->alloc(self->alloc_ud, self->partret, self->partretlen * sizeof(int), 0);
+    self->partret = NULL;
+    self->partretlen = 0;
 }
 
-int lj92_open(lj92* lj,
-              uint8_t* data, int datalen,
-              int* width,int* height, int* bitdepth, int* components) {
-    ljp* self = (ljp*)calloc(sizeof(ljp),1);
-    if (self==NULL) return LJ92_ERROR_NO_MEMORY;
+// Parses new data, keeping whatever memory the decoder already has
+static int open_data(ljp* self,
+                     uint8_t* data, int datalen,
+                     int* width,int* height, int* bitdepth, int* components) {
+#ifdef SLOW_HUFF
+    free_memory(self);
+#endif
+    ljp keep = *self;
+    memset(self, 0, sizeof(ljp));
+    self->alloc = keep.alloc;
+    self->alloc_ud = keep.alloc_ud;
+#ifndef SLOW_HUFF
+    self->hufflut = keep.hufflut;
+    self->hufflutlen = keep.hufflutlen;
+#endif
+    self->rowcache = keep.rowcache;
+    self->rowcachelen = keep.rowcachelen;
+    self->intervalstart = keep.intervalstart;
+    self->intervalstartlen = keep.intervalstartlen;
+    self->partret = keep.partret;
+    self->partretlen = keep.partretlen;
+    self->parallel = keep.parallel;
+    self->parallel_ud = keep.parallel_ud;
 
     self->data = (u8*)data;
     self->dataend = self->data + datalen;
@@ -660,37 +866,64 @@ int lj92_open(lj92* lj,
     int ret = findSoI(self);
 
     if (ret == LJ92_ERROR_NONE) {
-        u16* rowcache = (u16*)calloc(self->x * self->components * 2, sizeof(u16));
-        if (rowcache == NULL) ret = LJ92_ERROR_NO_MEMORY;
-        else {
-            self->rowcache = rowcache;
-            self->outrow[0] = rowcache;
-            self->outrow[1] = &rowcache[self->x];
-        }
+        int rowlen = self->x * self->components;
+        if (!reserve(self->alloc, self->alloc_ud, (void**)&self->rowcache, &self->rowcachelen, rowlen * 2, sizeof(u16)))
+            ret = LJ92_ERROR_NO_MEMORY;
     }
 
-    if (ret != LJ92_ERROR_NONE) { // Failed, clean up
-        *lj = NULL;
-        free_memory(self);
-        free(self);
-    } else {
+    if (ret == LJ92_ERROR_NONE) {
         *width = self->x;
         *height = self->y;
         *bitdepth = self->bits;
         *components = self->components;
+        self->opened = 1;
+    }
+    return ret;
+}
+
+int lj92_open_with_allocator(lj92* lj,
+                             uint8_t* data, int datalen,
+                             int* width,int* height, int* bitdepth, int* components,
+                             lj92_alloc alloc, void* alloc_ud) {
+    ljp* self = (ljp*)alloc(alloc_ud, NULL, 0, sizeof(ljp));
+    if (self==NULL) return LJ92_ERROR_NO_MEMORY;
+    memset(self, 0, sizeof(ljp));
+    self->alloc = alloc;
+    self->alloc_ud = alloc_ud;
+
+    int ret = open_data(self, data, datalen, width, height, bitdepth, components);
+
+    if (ret != LJ92_ERROR_NONE) { // Failed, clean up
+        *lj = NULL;
+        lj92_close(self);
+    } else {
         *lj = self;
     }
     return ret;
 }
 
+int lj92_open(lj92* lj,
+              uint8_t* data, int datalen,
+              int* width,int* height, int* bitdepth, int* components) {
+    return lj92_open_with_allocator(lj, data, datalen, width, height, bitdepth, components, default_alloc, NULL);
+}
+
+int lj92_reopen(lj92 lj,
+                uint8_t* data, int datalen,
+                int* width,int* height, int* bitdepth, int* components) {
+    if (lj == NULL) return LJ92_ERROR_BAD_HANDLE;
+    return open_data(lj, data, datalen, width, height, bitdepth, components);
+}
+
 int lj92_decode(lj92 lj,
                 uint16_t* target,int writeLength, int skipLength,
                 uint16_t* linearize,int linearizeLength) {
     int ret = LJ92_ERROR_NONE;
     ljp* self = lj;
-    if (self == NULL) return LJ92_ERROR_BAD_HANDLE;
+    if (self == NULL || !self->opened) return LJ92_ERROR_BAD_HANDLE;
     self->image = target;
     self->writelen = writeLength;
+    self->firstwrite = writeLength;
     self->skiplen = skipLength;
     self->linearize = linearize;
     self->linlen = linearizeLength;
@@ -698,11 +931,19 @@ int lj92_decode(lj92 lj,
     return ret;
 }
 
+void lj92_set_parallel(lj92 lj, lj92_parallel parallel, void* parallel_ud) {
+    ljp* self = lj;
+    if (self == NULL) return;
+    self->parallel = parallel;
+    self->parallel_ud = parallel_ud;
+}
+
 void lj92_close(lj92 lj) {
     ljp* self = lj;
-    if (self != NULL)
+    if (self != NULL) {
         free_memory(self);
-    free(self);
+        self->alloc(self->alloc_ud, self, sizeof(ljp), 0);
+    }
 }
 
 /* Encoder implementation */
@@ -725,10 +966,32 @@ typedef struct _lje {
     u16 huffenc[18];
     u16 huffbits[18];
     int huffsym[18];
+
+    // Memory, kept between images
+    lj92_alloc alloc;
+    void* alloc_ud;
+    u16* rowcache;
+    int rowcachelen;
+    int16_t* diffs; // Difference from the prediction for every pixel
+    int diffslen;
+
+    // Slices, made of whole restart intervals
+    int slices;
+    int intervalrows; // Rows in each restart interval
+    int intervals;
+    lj92_parallel parallel;
+    void* parallel_ud;
+    struct {
+        int hist[18];
+        u8* encoded; // Encoded intervals of the slice, with RSTn markers
+        int encodedlen;
+        int written;
+        int ret;
+    } slice[MAX_PARTS];
 } lje;
 
 #if defined(__GNUC__)
-#define count_leading_zeros(x) __builtin_clz((x));
+#define count_leading_zeros(x) __builtin_clz((x))
 #elif defined(_MSC_VER)
 #define count_leading_zeros(x) __lzcnt((x))
 #else
@@ -744,51 +1007,61 @@ static int count_leading_zeros(int x) {
 }
 #endif
 
-int frequencyScan(lje* self) {
-    // Scan through the tile using the standard type 6 prediction
-    // Need to cache the previous 2 row in target coordinates because of tiling
-    uint16_t* pixel = self->image;
-    int pixcount = self->width*self->height;
-    int scan = self->readLength;
-    uint16_t* rowcache = (uint16_t*)calloc(1,self->width*4);
+static int ssssof(int diff) {
+    return (diff==0) ? 0 : 32 - count_leading_zeros(abs(diff));
+}
+
+// First row of a slice
+static int sliceRow(lje* self, int slice) {
+    int row = (slice * self->intervals / self->slices) * self->intervalrows;
+    return (row < self->height) ? row : self->height;
+}
+
+// Scan through the tile using the standard type 6 prediction, keeping the
+// differences for writeBody and counting their ssss in the same pass
+// Need to cache the previous 2 row in target coordinates because of tiling
+// The first row of each restart interval is predicted like the top row
+static void predictSlice(void* arg, int slice) {
+    lje* self = arg;
+    int row = sliceRow(self, slice);
+    int start = row*self->width;
+    uint16_t* pixel = self->image + start + (start/self->readLength)*self->skipLength;
+    int pixcount = (sliceRow(self, slice+1) - row)*self->width;
+    int scan = self->readLength - start%self->readLength;
+    int16_t* diffs = self->diffs + start;
+    int* hist = self->slice[slice].hist;
     uint16_t* rows[2];
-    rows[0] = rowcache;
-    rows[1] = &rowcache[self->width];
+    rows[0] = &self->rowcache[slice*self->width*2];
+    rows[1] = &self->rowcache[slice*self->width*2 + self->width];
+    memset(hist,0,sizeof(self->slice[slice].hist));
+    self->slice[slice].ret = LJ92_ERROR_NONE;
 
     int col = 0;
-    int row = 0;
+    int top = 1;
     int Px = 0;
-    int32_t diff = 0;
-    int maxval = (1 << self->bitdepth);
     while (pixcount--) {
         uint16_t p = *pixel;
-        /* if (self->delinearize) {
+        if (self->delinearize) {
             if (p>=self->delinearizeLength) {
-                free(rowcache);
-                return LJ92_ERROR_TOO_WIDE;
+                self->slice[slice].ret = LJ92_ERROR_TOO_WIDE;
+                return;
             }
             p = self->delinearize[p];
         }
-        if (p>=maxval) {
-            free(rowcache);
-            return LJ92_ERROR_TOO_WIDE;
-        } */
         rows[1][col] = p;
 
-        if ((row == 0)&&(col == 0))
+        if ((top)&&(col == 0))
             Px = 1 << (self->bitdepth-1);
-        else if (row == 0)
+        else if (top)
             Px = rows[1][col-1];
         else if (col == 0)
             Px = rows[0][col];
         else
             Px = rows[0][col] + ((rows[1][col-1] - rows[0][col-1])>>1);
-        diff = rows[1][col] - Px;
-        diff = diff%65536;
-        int ssss = 32 - count_leading_zeros(abs(diff));
-        if (diff==0) ssss=0;
-        self->hist[ssss]++;
-        //printf("%d %d %d %d %d %d\n",col,row,p,Px,diff,ssss);
+        // Modulo 2^16, as the decoder adds it to the prediction in 16 bits
+        int16_t diff = (int16_t)(u16)(p - Px);
+        *diffs++ = diff;
+        hist[ssssof(diff)]++;
         pixel++;
         scan--;
         col++;
@@ -799,20 +1072,12 @@ int frequencyScan(lje* self) {
             rows[0] = tmprow;
             col=0;
             row++;
+            top = (row % self->intervalrows) == 0;
         }
     }
-#ifdef DEBUG
-    int sort[17];
-    for (int h=0;h<17;h++) {
-        sort[h] = h;
-        printf("%d:%d\n",h,self->hist[h]);
-    }
-#endif
-    free(rowcache);
-    return LJ92_ERROR_NONE;
 }
 
-void createEncodeTable(lje* self) {
+static void createEncodeTable(lje* self) {
     float freq[18];
     int codesize[18];
     int others[18];
@@ -993,7 +1258,7 @@ for (int i=0;i<18;i++) {
 #endif
 }
 
-void writeHeader(lje* self) {
+static void writeHeader(lje* self) {
     int w = self->encodedWritten;
     uint8_t* e = self->encoded;
     e[w++] = 0xff; e[w++] = 0xd8; //SOI
@@ -1021,6 +1286,12 @@ void writeHeader(lje* self) {
         e[w++] = 0; // Component ID
         e[w++] = 0x11; // Component X/Y
         e[w++] = 0; // Unused (Quantisation)
+    if (self->intervals > 1) {
+        int restart = self->intervalrows * self->width;
+        e[w++] = 0xff; e[w++] = 0xdd; //DRI
+        e[w++] = 0x0; e[w++] = 4; //Lr, restart interval header length
+        e[w++] = restart>>8; e[w++] = restart&0xFF;
+    }
     e[w++] = 0xff; e[w++] = 0xda; //SCAN
     // Write SCAN
         e[w++] = 0x0; e[w++] = 8; //Ls, scan header length
@@ -1033,151 +1304,139 @@ void writeHeader(lje* self) {
     self->encodedWritten = w;
 }
 
-void writePost(lje* self) {
+static void writePost(lje* self) {
     int w = self->encodedWritten;
     uint8_t* e = self->encoded;
     e[w++] = 0xff; e[w++] = 0xd9; //EOI
     self->encodedWritten = w;
 }
 
-int writeBody(lje* self) {
-    // Scan through the tile using the standard type 6 prediction
-    // Need to cache the previous 2 row in target coordinates because of tiling
-    uint16_t* pixel = self->image;
-    int pixcount = self->width*self->height;
-    int scan = self->readLength;
-    uint16_t* rowcache = (uint16_t*)calloc(1,self->width*4);
-    uint16_t* rows[2];
-    rows[0] = rowcache;
-    rows[1] = &rowcache[self->width];
-
-    int col = 0;
-    int row = 0;
-    int Px = 0;
-    int32_t diff = 0;
-    int bitcount = 0;
-    uint8_t* out = self->encoded;
-    int w = self->encodedWritten;
-    uint8_t next = 0;
-    uint8_t nextbits = 8;
-    while (pixcount--) {
-        uint16_t p = *pixel;
-        if (self->delinearize) p = self->delinearize[p];
-        rows[1][col] = p;
-
-        if ((row == 0)&&(col == 0))
-            Px = 1 << (self->bitdepth-1);
-        else if (row == 0)
-            Px = rows[1][col-1];
-        else if (col == 0)
-            Px = rows[0][col];
-        else
-            Px = rows[0][col] + ((rows[1][col-1] - rows[0][col-1])>>1);
-        diff = rows[1][col] - Px;
-        diff = diff%65536;
-        int ssss = 32 - count_leading_zeros(abs(diff));
-        if (diff==0) ssss=0;
-        //printf("%d %d %d %d %d\n",col,row,Px,diff,ssss);
-
-        // Write the huffman code for the ssss value
+// Bytes writeHeader and writePost can write
+#define HEADER_SPACE 69
+#define POST_SPACE 2
+
+// Write the huffman code and extra bits of count differences to out at *w,
+// then the final bits padded to a byte. Codes are put together in a 64 bit
+// buffer, which never holds more than 7+32 bits. Bytes are only written
+// before end, which should leave room for a stuffed 0x00 after it.
+static int writeBits(lje* self, int16_t* diffs, int count, uint8_t* out, int* written, int end) {
+    int w = *written;
+    u64 acc = 0;
+    int nbits = 0;
+    for (int i=0;i<count;i++) {
+        int diff = diffs[i];
+        int ssss = ssssof(diff);
         int huffcode = self->huffsym[ssss];
-        int huffenc = self->huffenc[huffcode];
-        int huffbits = self->huffbits[huffcode];
-        bitcount += huffbits + ssss;
-
-        int vt = ssss>0?(1<<(ssss-1)):0;
-        //printf("%d %d %d %d\n",rows[1][col],Px,diff,Px+diff);
-#ifdef DEBUG
-#endif
-        if (diff < vt)
+        if (diff < 0)
             diff += (1 << (ssss))-1;
-
-        // Write the ssss
-        while (huffbits>0) {
-            int usebits = huffbits>nextbits?nextbits:huffbits;
-            // Add top usebits from huffval to next usebits of nextbits
-            int tophuff = huffenc >> (huffbits - usebits);
-            next |= (tophuff << (nextbits-usebits));
-            nextbits -= usebits;
-            huffbits -= usebits;
-            huffenc &= (1<<huffbits)-1;
-            if (nextbits==0) {
-                if(w >= self->encodedLength - 1)
-                {
-                    free(rowcache);
-                    return LJ92_ERROR_ENCODER;
-                }
-                out[w++] = next;
-                if (next==0xff) out[w++] = 0x0;
-                next = 0;
-                nextbits = 8;
-            }
-        }
-        // Write the rest of the bits for the value
-
-        while (ssss>0) {
-            int usebits = ssss>nextbits?nextbits:ssss;
-            // Add top usebits from huffval to next usebits of nextbits
-            int tophuff = diff >> (ssss - usebits);
-            next |= (tophuff << (nextbits-usebits));
-            nextbits -= usebits;
-            ssss -= usebits;
-            diff &= (1<<ssss)-1;
-            if (nextbits==0) {
-                if(w >= self->encodedLength - 1)
-                {
-                    free(rowcache);
-                    return LJ92_ERROR_ENCODER;
-                }
-                out[w++] = next;
-                if (next==0xff) out[w++] = 0x0;
-                next = 0;
-                nextbits = 8;
-            }
+        int len = self->huffbits[huffcode] + ssss;
+        acc = (acc << len) | ((u64)self->huffenc[huffcode] << ssss) | (diff & ((1 << ssss)-1));
+        nbits += len;
+        while (nbits >= 8) {
+            nbits -= 8;
+            uint8_t byte = (uint8_t)(acc >> nbits);
+            if (w >= end) return LJ92_ERROR_ENCODER;
+            out[w++] = byte;
+            if (byte==0xff) out[w++] = 0x0;
         }
+    }
+    // Flush the final bits
+    if (nbits>0) {
+        uint8_t byte = (uint8_t)(acc << (8-nbits));
+        if (w >= end) return LJ92_ERROR_ENCODER;
+        out[w++] = byte;
+        if (byte==0xff) out[w++] = 0x0;
+    }
+    *written = w;
+    return LJ92_ERROR_NONE;
+}
 
-        //printf("%d %d\n",diff,ssss);
-        pixel++;
-        scan--;
-        col++;
-        if (scan==0) { pixel += self->skipLength; scan = self->readLength; }
-        if (col==self->width) {
-            uint16_t* tmprow = rows[1];
-            rows[1] = rows[0];
-            rows[0] = tmprow;
-            col=0;
-            row++;
+static int writeBody(lje* self) {
+    // Room for writePost after the stuffed 0x00
+    int end = self->encodedLength - 1 - POST_SPACE;
+    return writeBits(self, self->diffs, self->width*self->height, self->encoded, &self->encodedWritten, end);
+}
+
+// Writes a slice's intervals to its own memory, each but the very first
+// interval starting with a RSTn marker
+static void writeSlice(void* arg, int slice) {
+    lje* self = arg;
+    int first = slice * self->intervals / self->slices;
+    int last = (slice+1) * self->intervals / self->slices;
+    u8* out = self->slice[slice].encoded;
+    int end = self->slice[slice].encodedlen - 1;
+    int w = 0;
+    int ret = LJ92_ERROR_NONE;
+    for (int i = first; i < last && ret == LJ92_ERROR_NONE; i++) {
+        int row = i * self->intervalrows;
+        int rows = (self->height - row < self->intervalrows) ? self->height - row : self->intervalrows;
+        if (i > 0) {
+            if (w + 2 > end) { ret = LJ92_ERROR_ENCODER; break; }
+            out[w++] = 0xff; out[w++] = 0xd0 | ((i-1)%8); //RSTn
         }
+        ret = writeBits(self, &self->diffs[row*self->width], rows*self->width, out, &w, end);
     }
-    // Flush the final bits
-    if (nextbits<8) {
-        out[w++] = next;
-        if (next==0xff) out[w++] = 0x0;
+    self->slice[slice].written = w;
+    self->slice[slice].ret = ret;
+}
+
+// Bytes a slice's intervals can take, from its histogram
+static int sliceSpace(lje* self, int slice, int worst) {
+    u64 bits = 0;
+    for (int ssss = 0; ssss < 17; ssss++)
+        bits += (u64)self->slice[slice].hist[ssss] * (self->huffbits[self->huffsym[ssss]] + ssss);
+    int intervals = (slice+1) * self->intervals / self->slices - slice * self->intervals / self->slices;
+    u64 bytes = bits/8 + intervals*3 + 16;
+    // Every byte could be 0xFF and get stuffed, but few are
+    bytes += worst ? bytes : bytes/64;
+    return (bytes > 0x7FFFFFFF) ? 0x7FFFFFFF : (int)bytes;
+}
+
+// Encodes the slices and puts them together after the header
+static int encodeSlices(lje* self) {
+    for (int i = 0; i < self->slices; i++) {
+        if (!reserve(self->alloc, self->alloc_ud, (void**)&self->slice[i].encoded, &self->slice[i].encodedlen, sliceSpace(self, i, 0), 1))
+            return LJ92_ERROR_NO_MEMORY;
     }
-#ifdef DEBUG
-    int sort[18];
-    for (int h=0;h<18;h++) {
-        sort[h] = h;
-        printf("%d:%d\n",h,self->hist[h]);
+    runParts(self->parallel, self->parallel_ud, self->slices, writeSlice, self);
+    for (int i = 0; i < self->slices; i++) {
+        if (self->slice[i].ret == LJ92_ERROR_NONE) continue;
+        // Rare, did not fit. Try again with room for everything to be stuffed
+        if (!reserve(self->alloc, self->alloc_ud, (void**)&self->slice[i].encoded, &self->slice[i].encodedlen, sliceSpace(self, i, 1), 1))
+            return LJ92_ERROR_NO_MEMORY;
+        writeSlice(self, i);
+        if (self->slice[i].ret != LJ92_ERROR_NONE) return self->slice[i].ret;
+    }
+    for (int i = 0; i < self->slices; i++) {
+        if (self->slice[i].written > self->encodedLength - POST_SPACE - self->encodedWritten)
+            return LJ92_ERROR_ENCODER;
+        memcpy(&self->encoded[self->encodedWritten], self->slice[i].encoded, self->slice[i].written);
+        self->encodedWritten += self->slice[i].written;
     }
-    printf("Total bytes: %d\n",bitcount>>3);
-#endif
-    free(rowcache);
-    self->encodedWritten = w;
     return LJ92_ERROR_NONE;
 }
-/* Encoder
- * Read tile from an image and encode in one shot
- * Return the encoded data
- */
-int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
-                int readLength, int skipLength,
-                uint16_t* delinearize,int delinearizeLength,
-                uint8_t** encoded, int* encodedLength) {
-    int ret = LJ92_ERROR_NONE;
 
-    lje* self = (lje*)calloc(sizeof(lje),1);
+int lj92_encoder_create(lj92_encoder* encoder, lj92_alloc alloc, void* alloc_ud) {
+    if (alloc == NULL) alloc = default_alloc;
+    lje* self = (lje*)alloc(alloc_ud, NULL, 0, sizeof(lje));
     if (self==NULL) return LJ92_ERROR_NO_MEMORY;
+    memset(self,0,sizeof(lje));
+    self->alloc = alloc;
+    self->alloc_ud = alloc_ud;
+    self->slices = 1;
+    *encoder = self;
+    return LJ92_ERROR_NONE;
+}
+
+int lj92_encoder_encode(lj92_encoder encoder,
+                        uint16_t* image, int width, int height, int bitdepth,
+                        int readLength, int skipLength,
+                        uint16_t* delinearize, int delinearizeLength,
+                        uint8_t* encoded, int encodedSpace, int* encodedLength) {
+    lje* self = encoder;
+    if (self==NULL) return LJ92_ERROR_BAD_HANDLE;
+    if (width<=0 || height<=0 || width>65535 || height>65535 || bitdepth<2 || bitdepth>16) return LJ92_ERROR_ENCODER;
+    if (encodedSpace < HEADER_SPACE+POST_SPACE) return LJ92_ERROR_ENCODER;
     self->image = image;
     self->width = width;
     self->height = height;
@@ -1186,40 +1445,107 @@ int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
     self->skipLength = skipLength;
     self->delinearize = delinearize;
     self->delinearizeLength = delinearizeLength;
-    self->encodedLength = width*height*3+200;
-    self->encoded = malloc(self->encodedLength);
-    if (self->encoded==NULL) { free(self); return LJ92_ERROR_NO_MEMORY; }
-    // Scan through data to gather frequencies of ssss prefixes
-    ret = frequencyScan(self);
-    if (ret != LJ92_ERROR_NONE) {
-        free(self->encoded);
-        free(self);
-        return ret;
+    self->encoded = encoded;
+    self->encodedWritten = 0;
+    self->encodedLength = encodedSpace;
+    // Restart intervals can be at most 65535 pixels, and are whole rows
+    int slices = (self->slices < height) ? self->slices : height;
+    self->intervalrows = height;
+    self->intervals = 1;
+    if (slices > 1) {
+        int rows = (height + slices - 1) / slices;
+        self->intervalrows = (rows < 65535/width) ? rows : 65535/width;
+        self->intervals = (height + self->intervalrows - 1) / self->intervalrows;
+        if (slices > self->intervals) slices = self->intervals;
     }
-    // Create encoded table based on frequencies
-    createEncodeTable(self);
-    // Write JPEG head and scan header
-    writeHeader(self);
-    // Scan through and do the compression
-    ret = writeBody(self);
-    if (ret != LJ92_ERROR_NONE) {
-        free(self->encoded);
-        free(self);
-        return ret;
+    int sliced = self->slices;
+    self->slices = slices;
+    if (!reserve(self->alloc, self->alloc_ud, (void**)&self->rowcache, &self->rowcachelen, width*2*slices, sizeof(u16))
+     || !reserve(self->alloc, self->alloc_ud, (void**)&self->diffs, &self->diffslen, width*height, sizeof(int16_t))) {
+        self->slices = sliced;
+        return LJ92_ERROR_NO_MEMORY;
     }
+    // Predict all pixels and gather frequencies of ssss prefixes
+    runParts(self->parallel, self->parallel_ud, slices, predictSlice, self);
+    int ret = LJ92_ERROR_NONE;
+    memset(self->hist,0,sizeof(self->hist));
+    for (int i = 0; i < slices; i++) {
+        if (self->slice[i].ret != LJ92_ERROR_NONE) ret = self->slice[i].ret;
+        for (int h = 0; h < 18; h++) self->hist[h] += self->slice[i].hist[h];
+    }
+#ifdef DEBUG
+    for (int h=0;h<17;h++) {
+        printf("%d:%d\n",h,self->hist[h]);
+    }
+#endif
+    if (ret == LJ92_ERROR_NONE) {
+        // Create encoded table based on frequencies
+        createEncodeTable(self);
+        // Write JPEG head and scan header
+        writeHeader(self);
+        // Scan through and do the compression
+        if (self->intervals > 1)
+            ret = encodeSlices(self);
+        else
+            ret = writeBody(self);
+    }
+    self->slices = sliced;
+    if (ret != LJ92_ERROR_NONE) return ret;
     // Finish
     writePost(self);
 #ifdef DEBUG
     printf("written:%d\n",self->encodedWritten);
 #endif
-    self->encoded = realloc(self->encoded,self->encodedWritten);
-    self->encodedLength = self->encodedWritten;
-    *encoded = self->encoded;
-    *encodedLength = self->encodedLength;
-
-    free(self);
+    *encodedLength = self->encodedWritten;
+    return LJ92_ERROR_NONE;
+}
 
-    return ret;
+int lj92_encoder_set_slices(lj92_encoder encoder, int slices,
+                            lj92_parallel parallel, void* parallel_ud) {
+    lje* self = encoder;
+    if (self==NULL) return LJ92_ERROR_BAD_HANDLE;
+    if (slices<1 || slices>MAX_PARTS) return LJ92_ERROR_ENCODER;
+    self->slices = slices;
+    self->parallel = parallel;
+    self->parallel_ud = parallel_ud;
+    return LJ92_ERROR_NONE;
 }
 
+void lj92_encoder_destroy(lj92_encoder encoder) {
+    lje* self = encoder;
+    if (self==NULL) return;
+    for (int i = 0; i < MAX_PARTS; i++)
+        if (self->slice[i].encoded) self->alloc(self->alloc_ud, self->slice[i].encoded, self->slice[i].encodedlen, 0);
+    if (self->rowcache) self->alloc(self->alloc_ud, self->rowcache, self->rowcachelen*sizeof(u16), 0);
+    if (self->diffs) self->alloc(self->alloc_ud, self->diffs, self->diffslen*sizeof(int16_t), 0);
+    self->alloc(self->alloc_ud, self, sizeof(lje), 0);
+}
 
+/* Encoder
+ * Read tile from an image and encode in one shot
+ * Return the encoded data
+ */
+int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
+                int readLength, int skipLength,
+                uint16_t* delinearize,int delinearizeLength,
+                uint8_t** encoded, int* encodedLength) {
+    lj92_encoder encoder;
+    int ret = lj92_encoder_create(&encoder, NULL, NULL);
+    if (ret != LJ92_ERROR_NONE) return ret;
+    int space = width*height*3+200;
+    uint8_t* out = malloc(space);
+    if (out==NULL) { lj92_encoder_destroy(encoder); return LJ92_ERROR_NO_MEMORY; }
+    int written = 0;
+    ret = lj92_encoder_encode(encoder, image, width, height, bitdepth,
+                              readLength, skipLength, delinearize, delinearizeLength,
+                              out, space, &written);
+    lj92_encoder_destroy(encoder);
+    if (ret != LJ92_ERROR_NONE) {
+        free(out);
+        return ret;
+    }
+    uint8_t* shrunk = realloc(out,written);
+    *encoded = (shrunk != NULL) ? shrunk : out;
+    *encodedLength = written;
+    return ret;
+}
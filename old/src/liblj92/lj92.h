@@ -24,6 +24,8 @@ SOFTWARE.
 #ifndef LJ92_H
 #define LJ92_H
 
+#include <stdint.h>
+
 enum LJ92_ERRORS {
     LJ92_ERROR_NONE = 0,
     LJ92_ERROR_CORRUPT = -1,
@@ -45,9 +47,39 @@ int lj92_open(lj92* lj, // Return handle here
               uint8_t* data,int datalen, // The encoded data
               int* width,int* height,int* bitdepth,int* components); // Width, height, bitdepth and components
 
+/* Allocator for the decoder's memory, same as lua_Alloc: frees ptr if nsize is
+ * zero, otherwise reallocates it (or allocates if ptr is NULL) */
+typedef void* (*lj92_alloc)(void* ud, void* ptr, uint64_t osize, uint64_t nsize);
+
+/* Same as lj92_open, but all memory is allocated with alloc */
+int lj92_open_with_allocator(lj92* lj,
+                             uint8_t* data, int datalen,
+                             int* width, int* height, int* bitdepth, int* components,
+                             lj92_alloc alloc, void* alloc_ud);
+
+/* Opens an already open decoder on new data, so that it can be used for many
+ * images without allocating each time (memory is only reallocated if it is
+ * not big enough). If this fails, the handle can not be used to decode until
+ * it is reopened successfully, but must still be closed */
+int lj92_reopen(lj92 lj,
+                uint8_t* data, int datalen,
+                int* width, int* height, int* bitdepth, int* components);
+
 /* Release a decoder object */
 void lj92_close(lj92 lj);
 
+/* Runs func(arg, index) for every index from 0 to count-1, and returns when
+ * all of them have finished. They can be run on different threads at once. */
+typedef void (*lj92_parallel)(void* ud, int count, void (*func)(void* arg, int index), void* arg);
+
+/* Most slices an image can be split in to */
+#define LJ92_MAX_SLICES 64
+
+/* Images with restart intervals can be decoded in slices. If parallel is set,
+ * lj92_decode splits the image in up to LJ92_MAX_SLICES slices and decodes
+ * them through it. Kept when reopened. */
+void lj92_set_parallel(lj92 lj, lj92_parallel parallel, void* parallel_ud);
+
 /*
  * Decode previously opened lossless JPEG (1992) into a 2D tile of memory
  * Starting at target, write writeLength 16bit values, then skip 16bit skipLength value before writing again
@@ -68,4 +100,34 @@ int lj92_encode(uint16_t* image, int width, int height, int bitdepth,
                 int readLength, int skipLength,
                 uint16_t* delinearize,int delinearizeLength,
                 uint8_t** encoded, int* encodedLength);
+
+typedef struct _lje* lj92_encoder;
+
+/* Create an encoder that can be reused for many images. Its memory is
+ * allocated with alloc (malloc if NULL) and kept between images, so encoding
+ * images of the same size does not allocate.
+ * Returns status code, if LJ92_ERROR_NONE it must be destroyed with
+ * lj92_encoder_destroy. One encoder can only be used by one thread at a time.
+ */
+int lj92_encoder_create(lj92_encoder* encoder, lj92_alloc alloc, void* alloc_ud);
+
+/*
+ * Same as lj92_encode, but the lossless JPEG stream is written to encoded,
+ * which has encodedSpace bytes. Returns LJ92_ERROR_ENCODER if it does not fit.
+ */
+int lj92_encoder_encode(lj92_encoder encoder,
+                        uint16_t* image, int width, int height, int bitdepth,
+                        int readLength, int skipLength,
+                        uint16_t* delinearize, int delinearizeLength,
+                        uint8_t* encoded, int encodedSpace, int* encodedLength);
+
+/* Encode images as this many slices (1 to LJ92_MAX_SLICES), each of them
+ * made of whole restart intervals, so that they can be encoded and decoded
+ * on their own. With parallel set, slices are encoded through it. With one
+ * slice (the default) there are no restart intervals. */
+int lj92_encoder_set_slices(lj92_encoder encoder, int slices,
+                            lj92_parallel parallel, void* parallel_ud);
+
+/* Release an encoder object */
+void lj92_encoder_destroy(lj92_encoder encoder);
 #endif
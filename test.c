@@ -1,4 +1,4 @@
-// gcc -c -O3 *.c; gcc *.o -o test; rm *.o;
+// gcc -c -O3 *.c old/src/MLVFrameUtils.c old/src/liblj92/lj92.c; gcc *.o -o test -lpthread; rm *.o;
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>